@@ -0,0 +1,146 @@
+/**
+ * @file bufferPool.cpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#include "bufferPool.hpp"
+
+#include "cpuTopology.hpp"
+
+#include <memory>
+#include <utility>
+
+namespace {
+
+/// Size of the smallest buffers handed out by the pool.
+constexpr std::size_t minBufferSizeLog = 12;
+
+std::size_t sizeClass(const std::size_t size)
+{
+    std::size_t log = minBufferSizeLog;
+    while ((std::size_t{1} << log) < size)
+        ++log;
+
+    return log;
+}
+
+} // namespace
+
+namespace one {
+namespace etls {
+
+BufferPool::Buffer::Buffer(
+    BufferPool &pool, char *data, const std::size_t size)
+    : m_pool{&pool}
+    , m_data{data}
+    , m_size{size}
+{
+}
+
+BufferPool::Buffer::Buffer(Buffer &&other) noexcept
+    : m_pool{other.m_pool}
+    , m_data{std::exchange(other.m_data, nullptr)}
+    , m_size{std::exchange(other.m_size, 0)}
+{
+}
+
+BufferPool::Buffer &BufferPool::Buffer::operator=(Buffer &&other) noexcept
+{
+    if (this != &other) {
+        reset();
+        m_pool = other.m_pool;
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+    }
+
+    return *this;
+}
+
+BufferPool::Buffer::~Buffer() { reset(); }
+
+void BufferPool::Buffer::reset()
+{
+    if (m_data)
+        m_pool->giveBack(std::exchange(m_data, nullptr), m_size);
+
+    m_size = 0;
+}
+
+BufferPool &BufferPool::instance()
+{
+    return instance(CpuTopology::instance().currentNode());
+}
+
+BufferPool &BufferPool::instance(const std::size_t node)
+{
+    // Never destroyed, as sockets may still return buffers during exit.
+    // The default limit is shared between the nodes.
+    static auto pools = [] {
+        const auto nodes = CpuTopology::instance().nodes();
+        auto result = new std::unique_ptr<BufferPool>[nodes];
+        for (std::size_t i = 0; i < nodes; ++i)
+            result[i] = std::make_unique<BufferPool>(defaultLimit / nodes);
+
+        return result;
+    }();
+
+    return *pools[node];
+}
+
+BufferPool::BufferPool(const std::size_t limit)
+    : m_limit{limit}
+{
+}
+
+BufferPool::~BufferPool()
+{
+    for (auto &buffers : m_free)
+        for (auto buffer : buffers)
+            delete[] buffer;
+}
+
+BufferPool::Buffer BufferPool::borrow(const std::size_t size)
+{
+    const auto log = sizeClass(size);
+    const auto classSize = std::size_t{1} << log;
+    m_borrowed += classSize;
+
+    {
+        std::lock_guard<std::mutex> guard{m_mutex};
+        auto &buffers = m_free[log];
+        if (!buffers.empty()) {
+            auto data = buffers.back();
+            buffers.pop_back();
+            m_pooled -= classSize;
+            return {*this, data, classSize};
+        }
+    }
+
+    return {*this, new char[classSize], classSize};
+}
+
+void BufferPool::giveBack(char *data, const std::size_t size)
+{
+    m_borrowed -= size;
+
+    {
+        std::lock_guard<std::mutex> guard{m_mutex};
+        if (m_pooled + size <= m_limit) {
+            m_free[sizeClass(size)].push_back(data);
+            m_pooled += size;
+            return;
+        }
+    }
+
+    delete[] data;
+}
+
+std::size_t BufferPool::pooledBytes() const { return m_pooled; }
+
+std::size_t BufferPool::borrowedBytes() const { return m_borrowed; }
+
+} // namespace etls
+} // namespace one
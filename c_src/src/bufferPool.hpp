@@ -0,0 +1,128 @@
+/**
+ * @file bufferPool.hpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#ifndef ONE_ETLS_BUFFER_POOL_HPP
+#define ONE_ETLS_BUFFER_POOL_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace one {
+namespace etls {
+
+/**
+ * The @c BufferPool class lends out memory for buffers that are needed only
+ * while an I/O operation is in progress. Returned buffers are kept for reuse
+ * in power-of-two size classes, up to a limit of pooled bytes, so that idle
+ * connections don't hold any buffer memory of their own.
+ */
+class BufferPool {
+public:
+    /**
+     * A buffer borrowed from the pool. It's returned to the pool when
+     * destroyed or reset.
+     */
+    class Buffer {
+        friend class BufferPool;
+
+    public:
+        Buffer() = default;
+        Buffer(Buffer &&other) noexcept;
+        Buffer &operator=(Buffer &&other) noexcept;
+        ~Buffer();
+
+        /**
+         * @returns The buffer's memory.
+         */
+        char *data() const { return m_data; }
+
+        /**
+         * @returns The buffer's capacity, which may exceed the size
+         * requested from the pool.
+         */
+        std::size_t size() const { return m_size; }
+
+        /**
+         * @returns Whether the buffer holds any memory.
+         */
+        explicit operator bool() const { return m_data != nullptr; }
+
+        /**
+         * Returns the buffer's memory to the pool.
+         */
+        void reset();
+
+    private:
+        Buffer(BufferPool &pool, char *data, const std::size_t size);
+
+        BufferPool *m_pool = nullptr;
+        char *m_data = nullptr;
+        std::size_t m_size = 0;
+    };
+
+    /// Maximum number of bytes kept for reuse by default.
+    static constexpr std::size_t defaultLimit = 64 * 1024 * 1024;
+
+    /**
+     * @returns The pool of the NUMA node the calling thread runs on. Each
+     * node has a pool of its own, so that buffers are reused on the node
+     * whose threads allocated them.
+     */
+    static BufferPool &instance();
+
+    /**
+     * @param node A NUMA node, below @c CpuTopology::nodes().
+     * @returns The pool of the node.
+     */
+    static BufferPool &instance(const std::size_t node);
+
+    /**
+     * Constructor.
+     * @param limit Maximum number of bytes kept in the pool for reuse.
+     */
+    explicit BufferPool(const std::size_t limit = defaultLimit);
+
+    ~BufferPool();
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    /**
+     * Borrows a buffer from the pool.
+     * @param size Minimum size of the buffer.
+     * @returns A buffer of at least @c size bytes.
+     */
+    Buffer borrow(const std::size_t size);
+
+    /**
+     * @returns Number of bytes kept in the pool for reuse.
+     */
+    std::size_t pooledBytes() const;
+
+    /**
+     * @returns Number of bytes currently lent out.
+     */
+    std::size_t borrowedBytes() const;
+
+private:
+    void giveBack(char *data, const std::size_t size);
+
+    const std::size_t m_limit;
+    std::mutex m_mutex;
+    std::array<std::vector<char *>, sizeof(std::size_t) * 8> m_free;
+    std::atomic<std::size_t> m_pooled{0};
+    std::atomic<std::size_t> m_borrowed{0};
+};
+
+} // namespace etls
+} // namespace one
+
+#endif // ONE_ETLS_BUFFER_POOL_HPP
@@ -9,13 +9,150 @@
 #ifndef ONE_ETLS_COMMON_DEFS_HPP
 #define ONE_ETLS_COMMON_DEFS_HPP
 
-#include <functional>
+#include <cstddef>
+#include <memory>
+#include <new>
 #include <string>
+#include <type_traits>
+#include <utility>
 
 #include <system_error>
 
 namespace one {
 namespace etls {
+namespace detail {
+
+/**
+ * A type-erased, move-only function object. Functions of up to @c Size bytes
+ * are stored inline, so that creating and moving callbacks around doesn't
+ * allocate; larger ones are kept on the heap.
+ */
+template <typename Signature, std::size_t Size = 48> class InlineFunction;
+
+template <typename R, typename... Args, std::size_t Size>
+class InlineFunction<R(Args...), Size> {
+public:
+    InlineFunction() = default;
+
+    template <typename F,
+        typename = std::enable_if_t<
+            !std::is_same<std::decay_t<F>, InlineFunction>::value>>
+    InlineFunction(F &&function)
+    {
+        using Function = std::decay_t<F>;
+        constexpr bool fits = sizeof(Function) <= Size &&
+            alignof(Function) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible<Function>::value;
+
+        construct(
+            std::forward<F>(function), std::integral_constant<bool, fits>{});
+    }
+
+    InlineFunction(InlineFunction &&other) noexcept { moveFrom(other); }
+
+    InlineFunction &operator=(InlineFunction &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+
+        return *this;
+    }
+
+    InlineFunction(const InlineFunction &) = delete;
+    InlineFunction &operator=(const InlineFunction &) = delete;
+
+    ~InlineFunction() { reset(); }
+
+    R operator()(Args... args) const
+    {
+        return m_ops->invoke(
+            const_cast<void *>(static_cast<const void *>(&m_storage)),
+            std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const { return m_ops != nullptr; }
+
+private:
+    struct Ops {
+        R (*invoke)(void *, Args...);
+        void (*move)(void *, void *);
+        void (*destroy)(void *);
+    };
+
+    template <typename F> void construct(F &&function, std::true_type)
+    {
+        using Function = std::decay_t<F>;
+        new (&m_storage) Function(std::forward<F>(function));
+        m_ops = ops<Function, Function>();
+    }
+
+    template <typename F> void construct(F &&function, std::false_type)
+    {
+        using Function = std::decay_t<F>;
+        using Stored = std::unique_ptr<Function>;
+        new (&m_storage)
+            Stored(std::make_unique<Function>(std::forward<F>(function)));
+        m_ops = ops<Function, Stored>();
+    }
+
+    template <typename Function>
+    static Function &target(Function &function)
+    {
+        return function;
+    }
+
+    template <typename Function>
+    static Function &target(std::unique_ptr<Function> &function)
+    {
+        return *function;
+    }
+
+    template <typename Function, typename Stored>
+    static R invoke(void *storage, Args... args)
+    {
+        Function &function = target(*static_cast<Stored *>(storage));
+        return function(std::forward<Args>(args)...);
+    }
+
+    template <typename Stored> static void move(void *from, void *to)
+    {
+        new (to) Stored(std::move(*static_cast<Stored *>(from)));
+        static_cast<Stored *>(from)->~Stored();
+    }
+
+    template <typename Stored> static void destroy(void *storage)
+    {
+        static_cast<Stored *>(storage)->~Stored();
+    }
+
+    template <typename Function, typename Stored> static const Ops *ops()
+    {
+        static const Ops ops{&invoke<Function, Stored>, &move<Stored>,
+            &destroy<Stored>};
+        return &ops;
+    }
+
+    void moveFrom(InlineFunction &other)
+    {
+        if (other.m_ops) {
+            other.m_ops->move(&other.m_storage, &m_storage);
+            m_ops = std::exchange(other.m_ops, nullptr);
+        }
+    }
+
+    void reset()
+    {
+        if (m_ops)
+            std::exchange(m_ops, nullptr)->destroy(&m_storage);
+    }
+
+    std::aligned_storage_t<Size, alignof(std::max_align_t)> m_storage;
+    const Ops *m_ops = nullptr;
+};
+
+} // namespace detail
 
 /**
  * A callback class for signalling either an error or a success.
@@ -47,8 +184,8 @@ public:
     void operator()(const std::error_code &ec) const { m_errorFun(ec); }
 
 private:
-    std::function<void(Args...)> m_successFun;
-    std::function<void(const std::error_code)> m_errorFun;
+    detail::InlineFunction<void(Args...)> m_successFun;
+    detail::InlineFunction<void(const std::error_code)> m_errorFun;
 };
 
 } // namespace etls
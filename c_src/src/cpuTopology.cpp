@@ -0,0 +1,163 @@
+/**
+ * @file cpuTopology.cpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#include "cpuTopology.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+/**
+ * Reads the CPUs of each node from sysfs. Nodes are numbered sparsely on
+ * some machines, so they're looked up by their directories' names.
+ */
+std::vector<std::vector<int>> readNodes()
+{
+    std::vector<std::vector<int>> nodes;
+
+#if defined(__linux__)
+    const std::string root{"/sys/devices/system/node/"};
+    if (auto dir = ::opendir(root.c_str())) {
+        while (auto entry = ::readdir(dir)) {
+            const std::string name{entry->d_name};
+            if (name.size() <= 4 || name.compare(0, 4, "node") != 0 ||
+                !std::all_of(name.begin() + 4, name.end(),
+                    [](const unsigned char c) { return std::isdigit(c); }))
+                continue;
+
+            const auto node = std::strtoul(name.c_str() + 4, nullptr, 10);
+            std::ifstream file{root + name + "/cpulist"};
+            std::string list;
+            if (!std::getline(file, list))
+                continue;
+
+            if (nodes.size() <= node)
+                nodes.resize(node + 1);
+
+            nodes[node] = one::etls::CpuTopology::parseCpuList(list);
+        }
+
+        ::closedir(dir);
+    }
+#endif
+
+    return nodes;
+}
+
+} // namespace
+
+namespace one {
+namespace etls {
+
+const CpuTopology &CpuTopology::instance()
+{
+    static const CpuTopology topology{readNodes()};
+    return topology;
+}
+
+CpuTopology::CpuTopology(std::vector<std::vector<int>> nodes)
+    : m_nodes{std::max<std::size_t>(nodes.size(), 1)}
+{
+    for (std::size_t node = 0; node < nodes.size(); ++node) {
+        for (const auto cpu : nodes[node]) {
+            if (cpu < 0)
+                continue;
+
+            if (m_nodeOf.size() <= static_cast<std::size_t>(cpu))
+                m_nodeOf.resize(cpu + 1, 0);
+
+            m_nodeOf[cpu] = node;
+        }
+    }
+}
+
+std::size_t CpuTopology::nodes() const { return m_nodes; }
+
+std::size_t CpuTopology::nodeOf(const int cpu) const
+{
+    if (cpu < 0 || static_cast<std::size_t>(cpu) >= m_nodeOf.size())
+        return 0;
+
+    return m_nodeOf[cpu];
+}
+
+std::size_t CpuTopology::currentNode() const
+{
+#if defined(__linux__)
+    if (m_nodes > 1)
+        return nodeOf(::sched_getcpu());
+#endif
+
+    return 0;
+}
+
+std::vector<int> CpuTopology::spread(const std::vector<int> &cpus) const
+{
+    std::vector<std::vector<int>> byNode(m_nodes);
+    for (const auto cpu : cpus)
+        byNode[nodeOf(cpu)].emplace_back(cpu);
+
+    std::vector<int> result;
+    result.reserve(cpus.size());
+    for (std::size_t i = 0; result.size() < cpus.size(); ++i)
+        for (const auto &node : byNode)
+            if (i < node.size())
+                result.emplace_back(node[i]);
+
+    return result;
+}
+
+std::vector<int> CpuTopology::allowedCpus()
+{
+    std::vector<int> cpus;
+
+#if defined(__linux__)
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &set))
+                cpus.emplace_back(cpu);
+    }
+#endif
+
+    return cpus;
+}
+
+std::vector<int> CpuTopology::parseCpuList(const std::string &list)
+{
+    std::vector<int> cpus;
+    std::istringstream stream{list};
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+        char *end = nullptr;
+        const auto first = std::strtol(range.c_str(), &end, 10);
+        if (end == range.c_str())
+            continue;
+
+        const auto last =
+            *end == '-' ? std::strtol(end + 1, nullptr, 10) : first;
+
+        for (auto cpu = first; cpu <= last; ++cpu)
+            cpus.emplace_back(static_cast<int>(cpu));
+    }
+
+    return cpus;
+}
+
+} // namespace etls
+} // namespace one
@@ -0,0 +1,80 @@
+/**
+ * @file cpuTopology.hpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#ifndef ONE_ETLS_CPU_TOPOLOGY_HPP
+#define ONE_ETLS_CPU_TOPOLOGY_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace one {
+namespace etls {
+
+/**
+ * The @c CpuTopology class maps CPUs to the NUMA nodes they belong to.
+ * CPUs that aren't listed in any node, and all CPUs on systems without NUMA,
+ * belong to node 0.
+ */
+class CpuTopology {
+public:
+    /**
+     * @returns The topology of the machine, read once from sysfs.
+     */
+    static const CpuTopology &instance();
+
+    /**
+     * Constructor.
+     * @param nodes CPUs of each node, indexed by node.
+     */
+    explicit CpuTopology(std::vector<std::vector<int>> nodes);
+
+    /**
+     * @returns Number of nodes, at least 1.
+     */
+    std::size_t nodes() const;
+
+    /**
+     * @param cpu A CPU.
+     * @returns The node the CPU belongs to.
+     */
+    std::size_t nodeOf(const int cpu) const;
+
+    /**
+     * @returns The node of the CPU the calling thread runs on.
+     */
+    std::size_t currentNode() const;
+
+    /**
+     * Orders CPUs so that consecutive ones belong to different nodes, while
+     * keeping their order within each node. Threads pinned to a prefix of
+     * the result are spread evenly over the nodes.
+     * @param cpus The CPUs to order.
+     */
+    std::vector<int> spread(const std::vector<int> &cpus) const;
+
+    /**
+     * @returns The CPUs the process may run on, in ascending order.
+     */
+    static std::vector<int> allowedCpus();
+
+    /**
+     * Parses a list of CPUs in the kernel's format, e.g. "0-3,8,10-11".
+     * @param list The list.
+     */
+    static std::vector<int> parseCpuList(const std::string &list);
+
+private:
+    std::size_t m_nodes;
+    std::vector<std::size_t> m_nodeOf;
+};
+
+} // namespace etls
+} // namespace one
+
+#endif // ONE_ETLS_CPU_TOPOLOGY_HPP
@@ -8,6 +8,7 @@
 
 #include "detail.hpp"
 
+#include <asio/detail/reactor.hpp>
 #include <asio/ssl/context.hpp>
 #include <asio/ssl/rfc2818_verification.hpp>
 
@@ -24,6 +25,19 @@ std::unique_ptr<BIO, decltype(&BIO_free)> bufferToBIO(asio::const_buffer buffer)
         BIO_free};
 }
 
+#if defined(ASIO_HAS_EPOLL)
+// asio doesn't expose the epoll descriptor of its reactor. Explicit
+// instantiations may name private members, which is used to reach it.
+using ReactorFd = int asio::detail::epoll_reactor::*;
+ReactorFd reactorFd();
+
+template <ReactorFd Member> struct ReactorFdAccess {
+    friend ReactorFd reactorFd() { return Member; }
+};
+
+template struct ReactorFdAccess<&asio::detail::epoll_reactor::epoll_fd_>;
+#endif
+
 } // namespace
 
 namespace one {
@@ -139,6 +153,16 @@ void WithSSLContext::setVerifyMode(const asio::ssl::verify_mode mode)
     m_context->set_verify_mode(mode);
 }
 
+int reactorDescriptor(asio::io_service &ioService)
+{
+#if defined(ASIO_HAS_EPOLL)
+    return asio::use_service<asio::detail::reactor>(ioService).*reactorFd();
+#else
+    static_cast<void>(ioService);
+    return -1;
+#endif
+}
+
 } // namespace detail
 } // namespace etls
 } // namespace one
@@ -10,6 +10,7 @@
 #define ONE_ETLS_DETAIL_HPP
 
 #include <asio/buffer.hpp>
+#include <asio/io_service.hpp>
 #include <asio/ssl/context.hpp>
 
 #include <memory>
@@ -78,6 +79,13 @@ protected:
     std::shared_ptr<asio::ssl::context> m_context;
 };
 
+/**
+ * @param ioService An @c io_service.
+ * @returns The epoll descriptor of the @c io_service's reactor, or -1 where
+ * the reactor doesn't use epoll.
+ */
+int reactorDescriptor(asio::io_service &ioService);
+
 } // namespace detail
 } // namespace etls
 } // namespace one
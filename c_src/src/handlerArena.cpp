@@ -0,0 +1,61 @@
+/**
+ * @file handlerArena.cpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#include "handlerArena.hpp"
+
+#include <new>
+
+namespace one {
+namespace etls {
+namespace detail {
+
+HandlerArena::~HandlerArena() { delete m_slots.load(); }
+
+void *HandlerArena::allocate(const std::size_t size)
+{
+    if (size <= slotSize) {
+        auto s = slots();
+        for (std::size_t i = 0; i < slotCount; ++i)
+            if (!s->used[i].exchange(true, std::memory_order_acquire))
+                return s->slots[i].data;
+    }
+
+    return ::operator new(size);
+}
+
+void HandlerArena::deallocate(void *pointer, const std::size_t /*size*/)
+{
+    if (auto s = m_slots.load(std::memory_order_acquire)) {
+        const auto slot = static_cast<Slots::Slot *>(pointer);
+        if (slot >= s->slots.data() && slot < s->slots.data() + slotCount) {
+            s->used[slot - s->slots.data()].store(
+                false, std::memory_order_release);
+            return;
+        }
+    }
+
+    ::operator delete(pointer);
+}
+
+HandlerArena::Slots *HandlerArena::slots()
+{
+    auto s = m_slots.load(std::memory_order_acquire);
+    if (s)
+        return s;
+
+    auto fresh = new Slots;
+    if (m_slots.compare_exchange_strong(s, fresh, std::memory_order_acq_rel))
+        return fresh;
+
+    delete fresh;
+    return s;
+}
+
+} // namespace detail
+} // namespace etls
+} // namespace one
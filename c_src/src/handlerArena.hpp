@@ -0,0 +1,192 @@
+/**
+ * @file handlerArena.hpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#ifndef ONE_ETLS_HANDLER_ARENA_HPP
+#define ONE_ETLS_HANDLER_ARENA_HPP
+
+#include <asio/detail/handler_cont_helpers.hpp>
+#include <asio/detail/handler_invoke_helpers.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace one {
+namespace etls {
+namespace detail {
+
+/**
+ * @c HandlerArena recycles memory of a socket's asynchronous operations.
+ * A socket has at most a few operations in flight, so a handful of slots,
+ * allocated with the first operation, serve all of them; operations that
+ * don't fit in a free slot fall back to the heap.
+ */
+class HandlerArena {
+public:
+    /**
+     * A standard allocator drawing memory from an arena.
+     */
+    template <typename T> class Allocator {
+    public:
+        using value_type = T;
+
+        template <typename U> struct rebind {
+            using other = Allocator<U>;
+        };
+
+        explicit Allocator(HandlerArena &arena) noexcept
+            : m_arena{&arena}
+        {
+        }
+
+        template <typename U>
+        Allocator(const Allocator<U> &other) noexcept
+            : m_arena{other.m_arena}
+        {
+        }
+
+        T *allocate(const std::size_t n)
+        {
+            return static_cast<T *>(m_arena->allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T *pointer, const std::size_t n)
+        {
+            m_arena->deallocate(pointer, n * sizeof(T));
+        }
+
+        template <typename U> bool operator==(const Allocator<U> &other) const
+        {
+            return m_arena == other.m_arena;
+        }
+
+        template <typename U> bool operator!=(const Allocator<U> &other) const
+        {
+            return m_arena != other.m_arena;
+        }
+
+    private:
+        template <typename U> friend class Allocator;
+
+        HandlerArena *m_arena;
+    };
+
+    HandlerArena() = default;
+    HandlerArena(const HandlerArena &) = delete;
+    HandlerArena &operator=(const HandlerArena &) = delete;
+    ~HandlerArena();
+
+    /**
+     * Allocates memory for an operation. Safe to call from any thread.
+     * @param size Size of the memory.
+     */
+    void *allocate(const std::size_t size);
+
+    /**
+     * Frees memory allocated with @c allocate.
+     * @param pointer The memory.
+     * @param size Size of the memory.
+     */
+    void deallocate(void *pointer, const std::size_t size);
+
+    /**
+     * Wraps a handler so that memory of operations it's passed to is drawn
+     * from the arena. The handler must keep the arena's owner alive.
+     * @param handler The handler to wrap.
+     */
+    template <typename Handler> auto wrap(Handler &&handler);
+
+private:
+    static constexpr std::size_t slotSize = 384;
+    static constexpr std::size_t slotCount = 4;
+
+    struct Slots {
+        struct alignas(std::max_align_t) Slot {
+            unsigned char data[slotSize];
+        };
+
+        std::array<Slot, slotCount> slots;
+        std::array<std::atomic<bool>, slotCount> used{};
+    };
+
+    Slots *slots();
+
+    std::atomic<Slots *> m_slots{nullptr};
+};
+
+/**
+ * A handler whose operations' memory is drawn from a @c HandlerArena.
+ */
+template <typename Handler> class ArenaHandler {
+public:
+    using allocator_type = HandlerArena::Allocator<void>;
+
+    ArenaHandler(HandlerArena &arena, Handler handler)
+        : m_arena{&arena}
+        , m_handler(std::move(handler))
+    {
+    }
+
+    template <typename... Args> void operator()(Args &&... args)
+    {
+        m_handler(std::forward<Args>(args)...);
+    }
+
+    allocator_type get_allocator() const noexcept
+    {
+        return allocator_type{*m_arena};
+    }
+
+    friend void *asio_handler_allocate(
+        const std::size_t size, ArenaHandler *handler)
+    {
+        return handler->m_arena->allocate(size);
+    }
+
+    friend void asio_handler_deallocate(
+        void *pointer, const std::size_t size, ArenaHandler *handler)
+    {
+        handler->m_arena->deallocate(pointer, size);
+    }
+
+    friend bool asio_handler_is_continuation(ArenaHandler *handler)
+    {
+        return asio_handler_cont_helpers::is_continuation(handler->m_handler);
+    }
+
+    template <typename Function>
+    friend void asio_handler_invoke(Function &function, ArenaHandler *handler)
+    {
+        asio_handler_invoke_helpers::invoke(function, handler->m_handler);
+    }
+
+    template <typename Function>
+    friend void asio_handler_invoke(
+        const Function &function, ArenaHandler *handler)
+    {
+        asio_handler_invoke_helpers::invoke(function, handler->m_handler);
+    }
+
+private:
+    HandlerArena *m_arena;
+    Handler m_handler;
+};
+
+template <typename Handler> auto HandlerArena::wrap(Handler &&handler)
+{
+    return ArenaHandler<std::decay_t<Handler>>{
+        *this, std::forward<Handler>(handler)};
+}
+
+} // namespace detail
+} // namespace etls
+} // namespace one
+
+#endif // ONE_ETLS_HANDLER_ARENA_HPP
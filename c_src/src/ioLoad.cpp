@@ -0,0 +1,136 @@
+/**
+ * @file ioLoad.cpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#include "ioLoad.hpp"
+
+#include <algorithm>
+
+#include <time.h>
+
+namespace {
+
+/**
+ * @returns CPU time used by the calling thread.
+ */
+std::chrono::nanoseconds threadCpuTime()
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    timespec ts;
+    if (::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return std::chrono::seconds{ts.tv_sec} +
+            std::chrono::nanoseconds{ts.tv_nsec};
+#endif
+
+    return std::chrono::nanoseconds{0};
+}
+
+} // namespace
+
+namespace one {
+namespace etls {
+
+asio::execution_context::id IoLoad::id;
+
+IoLoad::IoLoad(asio::io_service &ioService)
+    : asio::execution_context::service{ioService}
+    , m_queue{asio::use_service<SubmissionQueue>(ioService)}
+{
+}
+
+void IoLoad::addSocket() { m_sockets.fetch_add(1, std::memory_order_relaxed); }
+
+void IoLoad::removeSocket()
+{
+    m_sockets.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void IoLoad::addBytes(const std::size_t n)
+{
+    m_bytes.fetch_add(n, std::memory_order_relaxed);
+}
+
+void IoLoad::sample()
+{
+    const auto now = std::chrono::steady_clock::now();
+    const auto cpu = threadCpuTime();
+    const auto bytes = m_bytes.load(std::memory_order_relaxed);
+
+    // The first call only marks the start of a period.
+    if (m_sampled != std::chrono::steady_clock::time_point{}) {
+        const auto elapsed =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                now - m_sampled)
+                .count();
+
+        if (elapsed > 0) {
+            m_bytesPerSecond.store(
+                (bytes - m_sampledBytes) * 1000000000 / elapsed,
+                std::memory_order_relaxed);
+
+            const auto busy = (cpu - m_sampledCpu).count() * 1000 / elapsed;
+            m_busyPermille.store(
+                static_cast<std::uint32_t>(std::min<std::int64_t>(busy, 1000)),
+                std::memory_order_relaxed);
+        }
+    }
+
+    m_sampled = now;
+    m_sampledCpu = cpu;
+    m_sampledBytes = bytes;
+}
+
+IoLoad::Stats IoLoad::stats() const
+{
+    Stats stats;
+    stats.sockets = m_sockets.load(std::memory_order_relaxed);
+    stats.bytes = m_bytes.load(std::memory_order_relaxed);
+    stats.bytesPerSecond = m_bytesPerSecond.load(std::memory_order_relaxed);
+    stats.queueDepth = m_queue.pending();
+    stats.busy = m_busyPermille.load(std::memory_order_relaxed) / 1000.0;
+    return stats;
+}
+
+bool IoLoad::lighterThan(const IoLoad &other) const
+{
+    const auto busy = m_busyPermille.load(std::memory_order_relaxed) / 50;
+    const auto otherBusy =
+        other.m_busyPermille.load(std::memory_order_relaxed) / 50;
+
+    if (busy != otherBusy)
+        return busy < otherBusy;
+
+    const auto depth = m_queue.pending();
+    const auto otherDepth = other.m_queue.pending();
+    if (depth != otherDepth)
+        return depth < otherDepth;
+
+    return m_sockets.load(std::memory_order_relaxed) <
+        other.m_sockets.load(std::memory_order_relaxed);
+}
+
+void IoLoad::shed(asio::io_service *target, const std::size_t n)
+{
+    m_shedTarget = target;
+    m_toShed = target ? n : 0;
+}
+
+asio::io_service *IoLoad::shedTarget() const
+{
+    return m_toShed > 0 ? m_shedTarget : nullptr;
+}
+
+void IoLoad::shedOne()
+{
+    if (m_toShed > 0)
+        --m_toShed;
+}
+
+void IoLoad::shutdown() {}
+
+} // namespace etls
+} // namespace one
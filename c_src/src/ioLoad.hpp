@@ -0,0 +1,144 @@
+/**
+ * @file ioLoad.hpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#ifndef ONE_ETLS_IO_LOAD_HPP
+#define ONE_ETLS_IO_LOAD_HPP
+
+#include "submissionQueue.hpp"
+
+#include <asio/io_service.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace one {
+namespace etls {
+
+/**
+ * The @c IoLoad service keeps track of how loaded the thread running an
+ * @c io_service is: the sockets placed on it, the bytes they move, the
+ * operations waiting for it and the share of time it's busy. Sockets report
+ * themselves and their traffic; the rates are updated by @c sample(), called
+ * periodically by the thread itself. Safe to read from any thread.
+ * The thread can also ask its sockets to move elsewhere, see @c shed().
+ */
+class IoLoad : public asio::execution_context::service {
+public:
+    /**
+     * A snapshot of the load.
+     */
+    struct Stats {
+        /// Number of sockets placed on the @c io_service.
+        std::size_t sockets = 0;
+
+        /// Bytes sent and received by the sockets in total.
+        std::uint64_t bytes = 0;
+
+        /// Bytes sent and received by the sockets per second, over the
+        /// last sampling period.
+        std::uint64_t bytesPerSecond = 0;
+
+        /// Number of operations submitted and not yet run.
+        std::size_t queueDepth = 0;
+
+        /// Share of the last sampling period the thread spent on the CPU,
+        /// from 0 to 1.
+        double busy = 0;
+    };
+
+    static asio::execution_context::id id;
+
+    /**
+     * Constructor.
+     * @param ioService The @c io_service whose load is kept.
+     */
+    explicit IoLoad(asio::io_service &ioService);
+
+    /**
+     * Counts a socket placed on the @c io_service.
+     */
+    void addSocket();
+
+    /**
+     * Stops counting a socket placed on the @c io_service.
+     */
+    void removeSocket();
+
+    /**
+     * Counts bytes moved by a socket.
+     * @param n Number of bytes.
+     */
+    void addBytes(const std::size_t n);
+
+    /**
+     * Updates the rates with the time passed since the previous call. Only
+     * to be called by the thread running the @c io_service, as the busy
+     * share is measured with the calling thread's CPU time.
+     */
+    void sample();
+
+    /**
+     * @returns A snapshot of the load.
+     */
+    Stats stats() const;
+
+    /**
+     * Compares the loads of two @c io_services. The busy shares are compared
+     * in steps of 5%, so that threads about as busy are told apart by their
+     * queues, and then by the number of their sockets.
+     * @param other The other @c io_service's load.
+     * @returns Whether this load is lower.
+     */
+    bool lighterThan(const IoLoad &other) const;
+
+    /**
+     * Asks sockets on the @c io_service to move to another one. Sockets
+     * check for it when they start an operation, see @c shedTarget().
+     * Only to be called by the thread running the @c io_service.
+     * @param target The @c io_service to move to; @c nullptr withdraws the
+     * request.
+     * @param n Number of sockets to move.
+     */
+    void shed(asio::io_service *target, const std::size_t n);
+
+    /**
+     * Only to be called by the thread running the @c io_service.
+     * @returns The @c io_service sockets were asked to move to, or
+     * @c nullptr if no more sockets are to be moved.
+     */
+    asio::io_service *shedTarget() const;
+
+    /**
+     * Counts a socket moved at the request of @c shed(). Only to be called
+     * by the thread running the @c io_service.
+     */
+    void shedOne();
+
+private:
+    void shutdown() override;
+
+    SubmissionQueue &m_queue;
+    std::atomic<std::size_t> m_sockets{0};
+    std::atomic<std::uint64_t> m_bytes{0};
+    std::atomic<std::uint64_t> m_bytesPerSecond{0};
+    std::atomic<std::uint32_t> m_busyPermille{0};
+
+    // Used only by the thread running the io_service.
+    std::chrono::steady_clock::time_point m_sampled;
+    std::chrono::nanoseconds m_sampledCpu{0};
+    std::uint64_t m_sampledBytes = 0;
+    asio::io_service *m_shedTarget = nullptr;
+    std::size_t m_toShed = 0;
+};
+
+} // namespace etls
+} // namespace one
+
+#endif // ONE_ETLS_IO_LOAD_HPP
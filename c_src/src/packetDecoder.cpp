@@ -0,0 +1,603 @@
+/**
+ * @file packetDecoder.cpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#include "packetDecoder.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const char *findByteScalar(const char *begin, const char *end, const char byte)
+{
+    auto found = std::memchr(begin, byte, end - begin);
+    return found ? static_cast<const char *>(found) : end;
+}
+
+#if defined(__x86_64__)
+
+const char *findByteSSE2(const char *begin, const char *end, const char byte)
+{
+    const __m128i needle = _mm_set1_epi8(byte);
+    for (; end - begin >= 16; begin += 16) {
+        const __m128i chunk =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+
+        const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask)
+            return begin + __builtin_ctz(mask);
+    }
+
+    return findByteScalar(begin, end, byte);
+}
+
+__attribute__((target("avx2"))) const char *findByteAVX2(
+    const char *begin, const char *end, const char byte)
+{
+    const __m256i needle = _mm256_set1_epi8(byte);
+    for (; end - begin >= 32; begin += 32) {
+        const __m256i chunk =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+
+        const int mask =
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+        if (mask)
+            return begin + __builtin_ctz(mask);
+    }
+
+    return findByteSSE2(begin, end, byte);
+}
+
+#endif
+
+void unmaskScalar(char *data, const std::size_t size, const unsigned char *key)
+{
+    for (std::size_t i = 0; i < size; ++i)
+        data[i] ^= key[i % 4];
+}
+
+#if defined(__x86_64__)
+
+// Vector widths are multiples of the key's size, so the scalar tail always
+// starts at key[0].
+
+void unmaskSSE2(char *data, std::size_t size, const unsigned char *key)
+{
+    std::int32_t k;
+    std::memcpy(&k, key, sizeof(k));
+    const __m128i mask = _mm_set1_epi32(k);
+
+    for (; size >= 16; data += 16, size -= 16) {
+        auto chunk = reinterpret_cast<__m128i *>(data);
+        _mm_storeu_si128(chunk, _mm_xor_si128(_mm_loadu_si128(chunk), mask));
+    }
+
+    unmaskScalar(data, size, key);
+}
+
+__attribute__((target("avx2"))) void unmaskAVX2(
+    char *data, std::size_t size, const unsigned char *key)
+{
+    std::int32_t k;
+    std::memcpy(&k, key, sizeof(k));
+    const __m256i mask = _mm256_set1_epi32(k);
+
+    for (; size >= 32; data += 32, size -= 32) {
+        auto chunk = reinterpret_cast<__m256i *>(data);
+        _mm256_storeu_si256(
+            chunk, _mm256_xor_si256(_mm256_loadu_si256(chunk), mask));
+    }
+
+    unmaskSSE2(data, size, key);
+}
+
+#endif
+
+bool startsWith(const char *begin, const char *end, const char *prefix)
+{
+    const auto len = std::strlen(prefix);
+    return static_cast<std::size_t>(end - begin) >= len &&
+        std::memcmp(begin, prefix, len) == 0;
+}
+
+bool startsWithNoCase(const char *begin, const char *end, const char *prefix)
+{
+    const auto len = std::strlen(prefix);
+    return static_cast<std::size_t>(end - begin) >= len &&
+        std::equal(prefix, prefix + len, begin, [](char a, char b) {
+            return a == std::tolower(static_cast<unsigned char>(b));
+        });
+}
+
+bool isSpace(const char c) { return c == ' ' || c == '\t'; }
+
+/**
+ * Parses "HTTP/x.y" at the beginning of a range.
+ * @returns Pointer past the parsed version, or nullptr on error.
+ */
+const char *parseVersion(const char *begin, const char *end,
+    unsigned int &major, unsigned int &minor)
+{
+    if (!startsWith(begin, end, "HTTP/"))
+        return nullptr;
+
+    auto parseNumber = [&](const char *it, unsigned int &number) {
+        if (it == end || !std::isdigit(static_cast<unsigned char>(*it)))
+            return static_cast<const char *>(nullptr);
+
+        number = 0;
+        for (; it != end && std::isdigit(static_cast<unsigned char>(*it));
+             ++it)
+            number = number * 10 + (*it - '0');
+
+        return it;
+    };
+
+    auto it = parseNumber(begin + 5, major);
+    if (!it || it == end || *it != '.')
+        return nullptr;
+
+    return parseNumber(it + 1, minor);
+}
+
+asio::const_buffer range(const char *begin, const char *end)
+{
+    return {begin, static_cast<std::size_t>(end - begin)};
+}
+
+bool parseRequestLine(
+    const char *begin, const char *end, one::etls::PacketDecoder::Packet &p)
+{
+    auto methodEnd = std::find(begin, end, ' ');
+    if (methodEnd == begin || methodEnd == end)
+        return false;
+
+    auto uriBegin = methodEnd + 1;
+    auto uriEnd = std::find(uriBegin, end, ' ');
+    if (uriEnd == uriBegin || uriEnd == end)
+        return false;
+
+    if (parseVersion(uriEnd + 1, end, p.versionMajor, p.versionMinor) != end)
+        return false;
+
+    p.kind = one::etls::PacketDecoder::Packet::Kind::httpRequest;
+    p.name = range(begin, methodEnd);
+    p.value = range(uriBegin, uriEnd);
+    return true;
+}
+
+bool parseStatusLine(
+    const char *begin, const char *end, one::etls::PacketDecoder::Packet &p)
+{
+    auto it = parseVersion(begin, end, p.versionMajor, p.versionMinor);
+    if (!it || it == end || *it != ' ')
+        return false;
+
+    auto statusBegin = it + 1;
+    if (end - statusBegin < 3)
+        return false;
+
+    p.status = 0;
+    for (it = statusBegin; it != statusBegin + 3; ++it) {
+        if (!std::isdigit(static_cast<unsigned char>(*it)))
+            return false;
+
+        p.status = p.status * 10 + (*it - '0');
+    }
+
+    if (it != end && *it++ != ' ')
+        return false;
+
+    p.kind = one::etls::PacketDecoder::Packet::Kind::httpResponse;
+    p.value = range(it, end);
+    return true;
+}
+
+bool parseHeader(
+    const char *begin, const char *end, one::etls::PacketDecoder::Packet &p)
+{
+    auto nameEnd = std::find(begin, end, ':');
+    if (nameEnd == begin || nameEnd == end ||
+        std::find_if(begin, nameEnd, isSpace) != nameEnd)
+        return false;
+
+    auto valueBegin = std::find_if_not(nameEnd + 1, end, isSpace);
+    auto valueEnd = end;
+    while (valueEnd != valueBegin && isSpace(*(valueEnd - 1)))
+        --valueEnd;
+
+    p.kind = one::etls::PacketDecoder::Packet::Kind::httpHeader;
+    p.name = range(begin, nameEnd);
+    p.value = range(valueBegin, valueEnd);
+    return true;
+}
+
+/// Largest growth of the buffer for a single read, in multiples of the read
+/// size.
+constexpr std::size_t maxGrowthSteps = 4;
+
+} // namespace
+
+namespace one {
+namespace etls {
+
+constexpr std::size_t PacketDecoder::defaultMaxSize;
+
+PacketDecoder::PacketDecoder(const std::size_t readSize)
+    : m_readSize{readSize}
+{
+}
+
+void PacketDecoder::setType(const Type type, const std::size_t maxSize)
+{
+    if (type != m_type) {
+        m_httpHeaders = false;
+        m_wsFragmented = false;
+        m_wanted = 0;
+    }
+
+    m_type = type;
+    m_maxSize = maxSize ? maxSize : defaultMaxSize;
+}
+
+asio::mutable_buffer PacketDecoder::prepare()
+{
+    // The buffer grows in steps as a large packet arrives, rather than by
+    // the size its header declares.
+    const auto wanted =
+        std::max(m_readSize, std::min(m_wanted, m_readSize * maxGrowthSteps));
+
+    if (m_begin == m_end) {
+        m_begin = m_decoded = m_end = m_wsBegin = m_wsEnd = 0;
+    }
+    else if (m_buffer.size() - m_end < wanted && m_begin > 0) {
+        std::memmove(m_buffer.data(), m_buffer.data() + m_begin, m_end - m_begin);
+        if (m_wsFragmented) {
+            m_wsBegin -= m_begin;
+            m_wsEnd -= m_begin;
+        }
+        m_decoded -= m_begin;
+        m_end -= m_begin;
+        m_begin = 0;
+    }
+
+    if (m_buffer.size() - m_end < wanted)
+        m_buffer.resize(m_end + wanted);
+
+    return asio::buffer(m_buffer) + m_end;
+}
+
+void PacketDecoder::commit(const std::size_t n) { m_end += n; }
+
+std::error_code PacketDecoder::decode(std::vector<Packet> &packets)
+{
+    std::error_code ec;
+    switch (m_type) {
+        case Type::line:
+            while (decodeLine(packets, ec))
+                ;
+            break;
+
+        case Type::http:
+        case Type::httph:
+            while (decodeHttp(packets, ec))
+                ;
+            break;
+
+        case Type::websocket:
+            while (decodeWebSocket(packets, ec))
+                ;
+            break;
+    }
+
+    return ec;
+}
+
+void PacketDecoder::consume()
+{
+    m_begin = m_wsFragmented ? m_wsBegin : m_decoded;
+}
+
+std::size_t PacketDecoder::take(asio::mutable_buffer buffer)
+{
+    const auto n = asio::buffer_copy(
+        buffer, asio::buffer(m_buffer.data() + m_begin, m_end - m_begin));
+
+    m_begin += n;
+    m_decoded = std::max(m_decoded, m_begin);
+    return n;
+}
+
+std::size_t PacketDecoder::buffered() const { return m_end - m_begin; }
+
+PacketDecoder::Uri PacketDecoder::parseUri(const asio::const_buffer &uri)
+{
+    const auto begin = asio::buffer_cast<const char *>(uri);
+    const auto end = begin + asio::buffer_size(uri);
+
+    Uri parts;
+    parts.path = uri;
+
+    if (end - begin == 1 && *begin == '*') {
+        parts.kind = Uri::Kind::asterisk;
+        return parts;
+    }
+
+    if (end - begin <= 1 || *begin == '/') {
+        parts.kind = Uri::Kind::absPath;
+        return parts;
+    }
+
+    parts.https = startsWithNoCase(begin, end, "https://");
+    if (!parts.https && !startsWithNoCase(begin, end, "http://")) {
+        const auto colon = std::find(begin, end, ':');
+        if (colon != end) {
+            parts.kind = Uri::Kind::scheme;
+            parts.scheme = range(begin, colon);
+            parts.path = range(colon + 1, end);
+        }
+
+        return parts;
+    }
+
+    // http://host[:port][/path]
+    parts.kind = Uri::Kind::absoluteUri;
+    const auto hostBegin = begin + (parts.https ? 8 : 7);
+    const auto hostEnd = std::find(hostBegin, end, '/');
+    const auto colon = std::find(hostBegin, hostEnd, ':');
+    parts.host = range(hostBegin, colon);
+    parts.path = range(hostEnd, end);
+
+    if (colon != hostEnd) {
+        unsigned int port = 0;
+        auto it = colon + 1;
+        while (it != hostEnd && port <= 65535 &&
+            std::isdigit(static_cast<unsigned char>(*it)))
+            port = port * 10 + (*it++ - '0');
+
+        if (it == hostEnd && port <= 65535)
+            parts.port = port;
+    }
+
+    return parts;
+}
+
+const char *PacketDecoder::findLine(std::error_code &ec) const
+{
+    const auto begin = m_buffer.data() + m_decoded;
+    const auto end = m_buffer.data() + m_end;
+    const auto newline = detail::findByte(begin, end, '\n');
+
+    const auto size = newline == end ? end - begin : newline - begin + 1;
+    if (static_cast<std::size_t>(size) > m_maxSize) {
+        ec = std::make_error_code(std::errc::message_size);
+        return nullptr;
+    }
+
+    return newline == end ? nullptr : newline;
+}
+
+bool PacketDecoder::decodeLine(std::vector<Packet> &packets, std::error_code &ec)
+{
+    const auto newline = findLine(ec);
+    if (!newline)
+        return false;
+
+    const auto begin = m_buffer.data() + m_decoded;
+    Packet p;
+    p.kind = Packet::Kind::line;
+    p.data = range(begin, newline + 1);
+    packets.emplace_back(std::move(p));
+
+    m_decoded = newline + 1 - m_buffer.data();
+    return true;
+}
+
+bool PacketDecoder::decodeHttp(std::vector<Packet> &packets, std::error_code &ec)
+{
+    const auto newline = findLine(ec);
+    if (!newline)
+        return false;
+
+    const auto begin = m_buffer.data() + m_decoded;
+    const auto end = newline > begin && *(newline - 1) == '\r' ? newline - 1
+                                                              : newline;
+
+    m_decoded = newline + 1 - m_buffer.data();
+
+    Packet p;
+    p.data = range(begin, newline + 1);
+
+    if (m_type == Type::http && !m_httpHeaders) {
+        // Empty lines preceding a start line are ignored (RFC 7230 3.5).
+        if (begin == end)
+            return true;
+
+        if (parseStatusLine(begin, end, p) || parseRequestLine(begin, end, p))
+            m_httpHeaders = true;
+        else
+            p.kind = Packet::Kind::httpError;
+    }
+    else if (begin == end) {
+        p.kind = Packet::Kind::httpEoh;
+        m_httpHeaders = false;
+    }
+    else if (!parseHeader(begin, end, p)) {
+        p.kind = Packet::Kind::httpError;
+    }
+
+    if (p.kind == Packet::Kind::httpError)
+        p.value = range(begin, end);
+
+    packets.emplace_back(std::move(p));
+    return true;
+}
+
+bool PacketDecoder::decodeWebSocket(
+    std::vector<Packet> &packets, std::error_code &ec)
+{
+    const auto frame =
+        reinterpret_cast<const unsigned char *>(m_buffer.data() + m_decoded);
+    const std::size_t available = m_end - m_decoded;
+
+    if (available < 2) {
+        m_wanted = 2 - available;
+        return false;
+    }
+
+    const bool fin = frame[0] & 0x80;
+    const bool masked = frame[1] & 0x80;
+    const unsigned int opcode = frame[0] & 0x0F;
+    const bool control = opcode & 0x08;
+
+    std::uint64_t size = frame[1] & 0x7F;
+    std::size_t headerSize = 2 + (masked ? 4 : 0);
+    headerSize += size == 126 ? 2 : size == 127 ? 8 : 0;
+
+    if (available < headerSize) {
+        m_wanted = headerSize - available;
+        return false;
+    }
+
+    if (size == 126) {
+        size = (frame[2] << 8) | frame[3];
+    }
+    else if (size == 127) {
+        size = 0;
+        for (auto i = 2; i < 10; ++i)
+            size = (size << 8) | frame[i];
+    }
+
+    const bool reservedOpcode = (opcode > 2 && opcode < 8) || opcode > 10;
+    const bool badControl = control && (!fin || size > 125);
+    const bool badContinuation = !control && (opcode == 0) != m_wsFragmented;
+
+    if ((frame[0] & 0x70) || reservedOpcode || badControl || badContinuation) {
+        ec = std::make_error_code(std::errc::protocol_error);
+        return false;
+    }
+
+    const auto messageSize =
+        size + (m_wsFragmented && !control ? m_wsEnd - m_wsBegin : 0);
+
+    if (messageSize > m_maxSize) {
+        ec = std::make_error_code(std::errc::message_size);
+        return false;
+    }
+
+    if (available - headerSize < size) {
+        m_wanted = size - (available - headerSize);
+        return false;
+    }
+
+    m_wanted = 0;
+    const auto payload = m_decoded + headerSize;
+    if (masked)
+        detail::unmask(m_buffer.data() + payload, size, frame + headerSize - 4);
+
+    m_decoded = payload + size;
+
+    Packet p;
+    p.kind = Packet::Kind::webSocket;
+
+    if (control) {
+        p.opcode = opcode;
+        p.data = range(m_buffer.data() + payload, m_buffer.data() + m_decoded);
+        packets.emplace_back(std::move(p));
+
+        // The next continuation frame would overwrite this frame's payload,
+        // so a control frame interleaved with a fragmented message ends the
+        // batch.
+        return !m_wsFragmented;
+    }
+
+    if (!m_wsFragmented) {
+        m_wsOpcode = opcode;
+        m_wsBegin = m_wsEnd = payload;
+    }
+    else if (size > 0) {
+        std::memmove(
+            m_buffer.data() + m_wsEnd, m_buffer.data() + payload, size);
+    }
+
+    m_wsEnd += size;
+    m_wsFragmented = !fin;
+
+    if (fin) {
+        p.opcode = m_wsOpcode;
+        p.data = range(m_buffer.data() + m_wsBegin, m_buffer.data() + m_wsEnd);
+        packets.emplace_back(std::move(p));
+    }
+
+    return true;
+}
+
+namespace detail {
+
+const char *findByte(const char *begin, const char *end, const char byte)
+{
+#if defined(__x86_64__)
+    static const auto impl =
+        __builtin_cpu_supports("avx2") ? findByteAVX2 : findByteSSE2;
+
+    return impl(begin, end, byte);
+#else
+    return findByteScalar(begin, end, byte);
+#endif
+}
+
+void unmask(char *data, const std::size_t size, const unsigned char *key)
+{
+#if defined(__x86_64__)
+    static const auto impl =
+        __builtin_cpu_supports("avx2") ? unmaskAVX2 : unmaskSSE2;
+
+    impl(data, size, key);
+#else
+    unmaskScalar(data, size, key);
+#endif
+}
+
+std::size_t encodeWebSocketHeader(unsigned char *header,
+    const unsigned int opcode, const std::uint64_t size,
+    const unsigned char *key)
+{
+    std::size_t headerSize = 2;
+    header[0] = 0x80 | (opcode & 0x0F);
+
+    if (size < 126) {
+        header[1] = size;
+    }
+    else if (size <= 0xFFFF) {
+        header[1] = 126;
+        header[headerSize++] = size >> 8;
+        header[headerSize++] = size;
+    }
+    else {
+        header[1] = 127;
+        for (auto shift = 56; shift >= 0; shift -= 8)
+            header[headerSize++] = size >> shift;
+    }
+
+    if (key) {
+        header[1] |= 0x80;
+        std::memcpy(header + headerSize, key, 4);
+        headerSize += 4;
+    }
+
+    return headerSize;
+}
+
+} // namespace detail
+} // namespace etls
+} // namespace one
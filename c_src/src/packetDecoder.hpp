@@ -0,0 +1,229 @@
+/**
+ * @file packetDecoder.hpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#ifndef ONE_ETLS_PACKET_DECODER_HPP
+#define ONE_ETLS_PACKET_DECODER_HPP
+
+#include <asio/buffer.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+#include <vector>
+
+namespace one {
+namespace etls {
+
+/**
+ * The @c PacketDecoder class splits a stream of decrypted bytes into packets.
+ * Received data is stored in the decoder's own buffer, so that decoded packets
+ * can point directly into it without intermediate copies.
+ */
+class PacketDecoder {
+public:
+    /**
+     * Types of packets understood by the decoder.
+     */
+    enum class Type { line, http, httph, websocket };
+
+    /**
+     * A single decoded packet.
+     * All buffers point into the decoder's storage and stay valid until
+     * @c consume() is called.
+     */
+    struct Packet {
+        enum class Kind {
+            line,
+            httpRequest,
+            httpResponse,
+            httpHeader,
+            httpEoh,
+            httpError,
+            webSocket
+        };
+
+        Kind kind;
+
+        /// Whole packet, as received; unmasked payload of a WebSocket
+        /// message.
+        asio::const_buffer data;
+
+        /// Request method, or header name.
+        asio::const_buffer name;
+
+        /// Request URI, response reason phrase, or header value.
+        asio::const_buffer value;
+
+        unsigned int versionMajor = 0;
+        unsigned int versionMinor = 0;
+        unsigned int status = 0;
+
+        /// WebSocket opcode of the message.
+        unsigned int opcode = 0;
+    };
+
+    /**
+     * Parts of a request URI, told apart as by erlang:decode_packet/3.
+     * All buffers point into the URI.
+     */
+    struct Uri {
+        enum class Kind { asterisk, absPath, absoluteUri, scheme, string };
+
+        Kind kind = Kind::string;
+
+        /// Whether an absolute URI is an https one rather than http.
+        bool https = false;
+
+        /// Scheme of a @c scheme URI.
+        asio::const_buffer scheme;
+
+        /// Host of an absolute URI.
+        asio::const_buffer host;
+
+        /// Port of an absolute URI; 0 if not given or not a number.
+        unsigned int port = 0;
+
+        /// Path of an absolute or @c absPath URI, empty if an absolute URI
+        /// has none; the part after the colon of a @c scheme URI; the whole
+        /// URI otherwise.
+        asio::const_buffer path;
+    };
+
+    /**
+     * Maximum size of a packet when none is set. Sizes declared by the peer
+     * are checked against it before any memory is reserved for a packet.
+     */
+    static constexpr std::size_t defaultMaxSize = 64 * 1024 * 1024;
+
+    /**
+     * Constructor.
+     * @param readSize The minimum number of bytes that a buffer returned by
+     * @c prepare() can hold.
+     */
+    PacketDecoder(const std::size_t readSize = 16 * 1024);
+
+    /**
+     * Sets the type of packets to decode.
+     * Changing the type resets the state of an HTTP or WebSocket decoder.
+     * @param type The type of packets.
+     * @param maxSize Maximum size of a packet, 0 for @c defaultMaxSize. For
+     * WebSocket, the limit applies to a whole reassembled message.
+     */
+    void setType(const Type type, const std::size_t maxSize);
+
+    /**
+     * @returns A buffer that received data should be written to.
+     */
+    asio::mutable_buffer prepare();
+
+    /**
+     * Marks @c n bytes of a buffer returned by @c prepare() as received.
+     * @param n Number of bytes received.
+     */
+    void commit(const std::size_t n);
+
+    /**
+     * Decodes all complete packets from the received data.
+     * @param packets A container to append decoded packets to.
+     * @returns @c std::errc::message_size if a packet exceeds the maximum
+     * size, @c std::errc::protocol_error on a malformed WebSocket frame,
+     * success otherwise.
+     */
+    std::error_code decode(std::vector<Packet> &packets);
+
+    /**
+     * Releases storage of packets returned by the last @c decode() call.
+     */
+    void consume();
+
+    /**
+     * Moves received but not yet decoded bytes into a buffer.
+     * Used when the packet type is switched to raw.
+     * @param buffer The buffer to copy data into.
+     * @returns Number of bytes copied.
+     */
+    std::size_t take(asio::mutable_buffer buffer);
+
+    /**
+     * @returns Number of received bytes that have not been consumed.
+     */
+    std::size_t buffered() const;
+
+    /**
+     * Splits a request URI into parts.
+     * @param uri The URI of a @c Packet::Kind::httpRequest packet.
+     * @returns The parts of the URI.
+     */
+    static Uri parseUri(const asio::const_buffer &uri);
+
+private:
+    bool decodeLine(std::vector<Packet> &packets, std::error_code &ec);
+    bool decodeHttp(std::vector<Packet> &packets, std::error_code &ec);
+    bool decodeWebSocket(std::vector<Packet> &packets, std::error_code &ec);
+    const char *findLine(std::error_code &ec) const;
+
+    Type m_type = Type::line;
+    std::size_t m_maxSize = defaultMaxSize;
+    std::size_t m_readSize;
+    std::size_t m_wanted = 0;
+    bool m_httpHeaders = false;
+
+    // Payload of a fragmented WebSocket message is gathered in place,
+    // over the headers of its frames.
+    bool m_wsFragmented = false;
+    unsigned int m_wsOpcode = 0;
+    std::size_t m_wsBegin = 0;
+    std::size_t m_wsEnd = 0;
+
+    std::vector<char> m_buffer;
+    std::size_t m_begin = 0;
+    std::size_t m_decoded = 0;
+    std::size_t m_end = 0;
+};
+
+namespace detail {
+
+/**
+ * Finds the first occurrence of a byte in a range, using vector instructions
+ * when they are available.
+ * @returns Pointer to the found byte, or @c end.
+ */
+const char *findByte(const char *begin, const char *end, const char byte);
+
+/**
+ * Maximum size of a WebSocket frame header.
+ */
+constexpr std::size_t maxWebSocketHeaderSize = 14;
+
+/**
+ * XORs data with a WebSocket masking key, using vector instructions when
+ * they are available. As the operation is symmetric, it both masks and
+ * unmasks.
+ * @param data The data to (un)mask in place.
+ * @param size Size of the data.
+ * @param key 4-byte masking key.
+ */
+void unmask(char *data, const std::size_t size, const unsigned char *key);
+
+/**
+ * Encodes a header of an unfragmented WebSocket frame.
+ * @param header Output buffer of at least @c maxWebSocketHeaderSize bytes.
+ * @param opcode The frame's opcode.
+ * @param size Size of the frame's payload.
+ * @param key 4-byte masking key, or nullptr for an unmasked frame.
+ * @returns Size of the encoded header.
+ */
+std::size_t encodeWebSocketHeader(unsigned char *header,
+    const unsigned int opcode, const std::uint64_t size,
+    const unsigned char *key = nullptr);
+
+} // namespace detail
+} // namespace etls
+} // namespace one
+
+#endif // ONE_ETLS_PACKET_DECODER_HPP
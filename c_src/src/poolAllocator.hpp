@@ -0,0 +1,130 @@
+/**
+ * @file poolAllocator.hpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#ifndef ONE_ETLS_POOL_ALLOCATOR_HPP
+#define ONE_ETLS_POOL_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+
+namespace one {
+namespace etls {
+namespace detail {
+
+/**
+ * @c FixedSizePool hands out memory blocks of a single size. Blocks are
+ * carved out of slabs that are never released; freed blocks are kept on a
+ * free list for reuse.
+ */
+template <std::size_t Size, std::size_t Align> class FixedSizePool {
+public:
+    /**
+     * @returns The pool shared by all allocations of this size.
+     */
+    static FixedSizePool &instance()
+    {
+        // Never destroyed, as blocks may still be freed during exit.
+        static auto pool = new FixedSizePool;
+        return *pool;
+    }
+
+    void *allocate()
+    {
+        std::lock_guard<std::mutex> guard{m_mutex};
+        if (!m_free)
+            refill();
+
+        auto block = m_free;
+        m_free = block->next;
+        return block;
+    }
+
+    void deallocate(void *pointer)
+    {
+        auto block = static_cast<Block *>(pointer);
+        std::lock_guard<std::mutex> guard{m_mutex};
+        block->next = m_free;
+        m_free = block;
+    }
+
+private:
+    union Block {
+        Block *next;
+        typename std::aligned_storage<Size, Align>::type storage;
+    };
+
+    static constexpr std::size_t blocksPerSlab = 64;
+
+    void refill()
+    {
+        auto slab = new Block[blocksPerSlab];
+        for (std::size_t i = 0; i + 1 < blocksPerSlab; ++i)
+            slab[i].next = &slab[i + 1];
+
+        slab[blocksPerSlab - 1].next = nullptr;
+        m_free = slab;
+    }
+
+    std::mutex m_mutex;
+    Block *m_free = nullptr;
+};
+
+} // namespace detail
+
+/**
+ * @c PoolAllocator is an allocator for objects that are created often and
+ * in large numbers, such as accepted sockets. Single objects are allocated
+ * from a @c detail::FixedSizePool of their size, so that after a warm-up
+ * creating one doesn't reach the heap.
+ */
+template <typename T> class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() = default;
+
+    template <typename U> PoolAllocator(const PoolAllocator<U> &) {}
+
+    T *allocate(const std::size_t n)
+    {
+        if (n != 1)
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+
+        return static_cast<T *>(Pool::instance().allocate());
+    }
+
+    void deallocate(T *pointer, const std::size_t n)
+    {
+        if (n != 1)
+            ::operator delete(pointer);
+        else
+            Pool::instance().deallocate(pointer);
+    }
+
+private:
+    using Pool = detail::FixedSizePool<sizeof(T), alignof(T)>;
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T> &, const PoolAllocator<U> &)
+{
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T> &, const PoolAllocator<U> &)
+{
+    return false;
+}
+
+} // namespace etls
+} // namespace one
+
+#endif // ONE_ETLS_POOL_ALLOCATOR_HPP
@@ -0,0 +1,151 @@
+/**
+ * @file submissionQueue.cpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#include "submissionQueue.hpp"
+
+#include <asio/detail/reactor.hpp>
+
+namespace one {
+namespace etls {
+
+asio::execution_context::id SubmissionQueue::id;
+
+SubmissionQueue::SubmissionQueue(asio::io_service &ioService)
+    : asio::execution_context::service{ioService}
+    , m_ioService{ioService}
+    , m_cells{new Cell[capacity]}
+{
+    for (std::size_t i = 0; i < capacity; ++i)
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+SubmissionQueue::Stats SubmissionQueue::stats() const
+{
+    Stats stats;
+    stats.submitted = m_submitted.load(std::memory_order_relaxed);
+    stats.wakeups = m_wakeups.load(std::memory_order_relaxed);
+    stats.overflows = m_overflows.load(std::memory_order_relaxed);
+    stats.latency = std::chrono::nanoseconds{
+        m_latency.load(std::memory_order_relaxed)};
+
+    return stats;
+}
+
+std::size_t SubmissionQueue::pending() const
+{
+    // Run operations are read first, so that the difference doesn't go
+    // below zero when submissions race with the read.
+    const auto submitted = m_submitted.load(std::memory_order_relaxed);
+    const auto pushed = m_tail.load(std::memory_order_relaxed) +
+        m_overflows.load(std::memory_order_relaxed);
+
+    return pushed > submitted ? pushed - submitted : 0;
+}
+
+void SubmissionQueue::setPolled()
+{
+    m_reactor.store(&asio::use_service<asio::detail::reactor>(m_ioService),
+        std::memory_order_release);
+}
+
+void SubmissionQueue::shutdown()
+{
+    while (auto operation = pop())
+        operation->complete(operation, false);
+}
+
+bool SubmissionQueue::push(Operation *operation)
+{
+    auto position = m_tail.load(std::memory_order_relaxed);
+    for (;;) {
+        auto &cell = m_cells[position % capacity];
+        const auto sequence = cell.sequence.load(std::memory_order_acquire);
+        const auto diff = static_cast<std::intptr_t>(sequence) -
+            static_cast<std::intptr_t>(position);
+
+        if (diff < 0)
+            return false;
+
+        if (diff > 0) {
+            position = m_tail.load(std::memory_order_relaxed);
+        }
+        else if (m_tail.compare_exchange_weak(
+                     position, position + 1, std::memory_order_relaxed)) {
+            cell.operation = operation;
+            cell.sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+    }
+}
+
+SubmissionQueue::Operation *SubmissionQueue::pop()
+{
+    auto &cell = m_cells[m_head % capacity];
+    if (cell.sequence.load(std::memory_order_acquire) != m_head + 1)
+        return nullptr;
+
+    auto operation = cell.operation;
+    cell.sequence.store(m_head + capacity, std::memory_order_release);
+    ++m_head;
+    return operation;
+}
+
+void SubmissionQueue::schedule()
+{
+    if (m_scheduled.exchange(true, std::memory_order_acq_rel))
+        return;
+
+    m_wakeups.fetch_add(1, std::memory_order_relaxed);
+    asio::post(m_ioService, m_arena.wrap([this] {
+        // Submissions that find the flag set rely on this drain, so the
+        // flag is cleared before the ring is checked.
+        m_scheduled.exchange(false, std::memory_order_acq_rel);
+        this->drain(capacity);
+    }));
+
+    wake();
+}
+
+void SubmissionQueue::wake()
+{
+    if (auto reactor = m_reactor.load(std::memory_order_acquire))
+        reactor->interrupt();
+}
+
+void SubmissionQueue::drain(std::size_t limit)
+{
+    while (limit-- > 0) {
+        auto operation = pop();
+        if (!operation)
+            return;
+
+        this->run(operation);
+    }
+
+    // Operations were left in the ring so that other handlers of the
+    // io_service get their turn; they're drained in the next round.
+    schedule();
+}
+
+void SubmissionQueue::run(Operation *operation)
+{
+    const auto latency =
+        std::chrono::steady_clock::now() - operation->submitted;
+
+    m_submitted.store(m_submitted.load(std::memory_order_relaxed) + 1,
+        std::memory_order_relaxed);
+    m_latency.store(m_latency.load(std::memory_order_relaxed) +
+            std::chrono::duration_cast<std::chrono::nanoseconds>(latency)
+                .count(),
+        std::memory_order_relaxed);
+
+    operation->complete(operation, true);
+}
+
+} // namespace etls
+} // namespace one
@@ -0,0 +1,189 @@
+/**
+ * @file submissionQueue.hpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#ifndef ONE_ETLS_SUBMISSION_QUEUE_HPP
+#define ONE_ETLS_SUBMISSION_QUEUE_HPP
+
+#include "handlerArena.hpp"
+
+#include <asio/associated_allocator.hpp>
+#include <asio/detail/reactor_fwd.hpp>
+#include <asio/io_service.hpp>
+#include <asio/post.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace one {
+namespace etls {
+
+/**
+ * The @c SubmissionQueue service carries operations submitted from other
+ * threads to the thread running an @c io_service. Submitters push onto a
+ * bounded lock-free ring; the ring is drained by a single handler posted to
+ * the @c io_service, and only when no drain is already pending, so that a
+ * burst of submissions costs one trip through the @c io_service's queue and
+ * at most one wakeup of its thread. When the ring is full, operations are
+ * posted to the @c io_service directly.
+ * The @c io_service must be run by a single thread.
+ */
+class SubmissionQueue : public asio::execution_context::service {
+public:
+    /**
+     * Statistics of a queue.
+     */
+    struct Stats {
+        /// Number of operations run.
+        std::uint64_t submitted = 0;
+
+        /// Number of times a drain was posted to the @c io_service.
+        std::uint64_t wakeups = 0;
+
+        /// Number of operations that didn't fit in the ring.
+        std::uint64_t overflows = 0;
+
+        /// Total time between submission and start of operations.
+        std::chrono::nanoseconds latency{0};
+    };
+
+    static asio::execution_context::id id;
+
+    /**
+     * Constructor.
+     * @param ioService The @c io_service operations are submitted to.
+     */
+    explicit SubmissionQueue(asio::io_service &ioService);
+
+    /**
+     * Submits an operation to the @c io_service. Safe to call from any
+     * thread. The operation's memory is drawn from the handler's associated
+     * allocator.
+     * @param handler The operation to run.
+     */
+    template <typename Handler> void submit(Handler &&handler);
+
+    /**
+     * @returns The queue's statistics.
+     */
+    Stats stats() const;
+
+    /**
+     * @returns Number of operations submitted and not yet run. Read without
+     * synchronization with the submitters, so it's only an estimate.
+     */
+    std::size_t pending() const;
+
+    /**
+     * Makes the queue interrupt the @c io_service's reactor whenever it
+     * posts to the @c io_service. A thread blocked in @c run() is woken up
+     * by the @c io_service itself; this is for an @c io_service that's
+     * polled, with the reactor's descriptor watched between polls.
+     */
+    void setPolled();
+
+private:
+    struct Operation {
+        void (*complete)(Operation *, bool);
+        std::chrono::steady_clock::time_point submitted;
+    };
+
+    template <typename Handler> struct HandlerOperation;
+
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        Operation *operation;
+    };
+
+    static constexpr std::size_t capacity = 1024;
+
+    void shutdown() override;
+
+    bool push(Operation *operation);
+    Operation *pop();
+    void schedule();
+    void drain(std::size_t limit);
+    void run(Operation *operation);
+    void wake();
+
+    asio::io_service &m_ioService;
+    detail::HandlerArena m_arena;
+    std::unique_ptr<Cell[]> m_cells;
+    std::atomic<asio::detail::reactor *> m_reactor{nullptr};
+    alignas(64) std::atomic<std::size_t> m_tail{0};
+    alignas(64) std::size_t m_head = 0;
+    alignas(64) std::atomic<bool> m_scheduled{false};
+    std::atomic<std::uint64_t> m_wakeups{0};
+    std::atomic<std::uint64_t> m_overflows{0};
+    std::atomic<std::uint64_t> m_submitted{0};
+    std::atomic<std::uint64_t> m_latency{0};
+};
+
+template <typename Handler>
+struct SubmissionQueue::HandlerOperation : public Operation {
+    using Allocator = typename std::allocator_traits<
+        typename asio::associated_allocator<Handler>::type>::template
+        rebind_alloc<HandlerOperation>;
+
+    explicit HandlerOperation(Handler h)
+        : handler(std::move(h))
+    {
+        complete = &HandlerOperation::doComplete;
+    }
+
+    static void doComplete(Operation *base, const bool invoke)
+    {
+        auto op = static_cast<HandlerOperation *>(base);
+        Allocator allocator{asio::get_associated_allocator(op->handler)};
+
+        // The memory is freed before the handler is run, so that it can be
+        // reused by operations the handler starts.
+        auto handler = std::move(op->handler);
+        op->~HandlerOperation();
+        std::allocator_traits<Allocator>::deallocate(allocator, op, 1);
+
+        if (invoke)
+            handler();
+    }
+
+    Handler handler;
+};
+
+template <typename Handler> void SubmissionQueue::submit(Handler &&handler)
+{
+    using Op = HandlerOperation<std::decay_t<Handler>>;
+    typename Op::Allocator allocator{asio::get_associated_allocator(handler)};
+
+    auto memory = std::allocator_traits<typename Op::Allocator>::allocate(
+        allocator, 1);
+    auto op = new (memory) Op{std::forward<Handler>(handler)};
+    op->submitted = std::chrono::steady_clock::now();
+
+    if (push(op)) {
+        schedule();
+        return;
+    }
+
+    // Operations already in the ring are drained first, to keep operations
+    // in the order of submission.
+    m_overflows.fetch_add(1, std::memory_order_relaxed);
+    asio::post(m_ioService, m_arena.wrap([this, op] {
+        this->drain(capacity);
+        this->run(op);
+    }));
+
+    wake();
+}
+
+} // namespace etls
+} // namespace one
+
+#endif // ONE_ETLS_SUBMISSION_QUEUE_HPP
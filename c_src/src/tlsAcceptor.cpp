@@ -8,6 +8,7 @@
 
 #include "tlsAcceptor.hpp"
 
+#include "poolAllocator.hpp"
 #include "tlsApplication.hpp"
 
 namespace one {
@@ -20,6 +21,7 @@ TLSAcceptor::TLSAcceptor(TLSApplication &app, const unsigned short port,
           keyPath, std::move(rfc2818Hostname)}
     , m_app{app}
     , m_ioService{app.ioService()}
+    , m_queue{asio::use_service<SubmissionQueue>(m_ioService)}
     , m_acceptor{m_ioService, asio::ip::tcp::v4()}
 {
     m_acceptor.set_option(asio::socket_base::reuse_address{true});
@@ -29,11 +31,18 @@ TLSAcceptor::TLSAcceptor(TLSApplication &app, const unsigned short port,
 
 void TLSAcceptor::acceptAsync(Ptr self, Callback<TLSSocket::Ptr> callback)
 {
-    asio::post(m_ioService, [
-        =, self = std::move(self), callback = std::move(callback)
+    // The socket's io_service is picked by the accepting thread rather than
+    // the acceptor's, so that it's placed as if the caller created it.
+    auto &ioService = m_app.ioService();
+    m_queue.submit(m_arena.wrap([
+        =, &ioService, self = std::move(self), callback = std::move(callback)
     ]() mutable {
-        auto sock = std::make_shared<TLSSocket>(m_app, m_context);
-        m_acceptor.async_accept(sock->m_socket.lowest_layer(), [
+        auto sock = std::allocate_shared<TLSSocket>(
+            PoolAllocator<TLSSocket>{}, m_app, ioService, m_context);
+        // The handler doesn't keep the acceptor alive, so it draws memory
+        // from the socket's arena instead.
+        auto &arena = sock->m_arena;
+        m_acceptor.async_accept(sock->m_socket.lowest_layer(), arena.wrap([
             =, s = std::weak_ptr<TLSAcceptor>{self},
             callback = std::move(callback)
         ](const auto ec) mutable {
@@ -49,14 +58,14 @@ void TLSAcceptor::acceptAsync(Ptr self, Callback<TLSSocket::Ptr> callback)
             else {
                 callback(std::make_error_code(std::errc::operation_canceled));
             }
-        });
-    });
+        }));
+    }));
 }
 
 void TLSAcceptor::localEndpointAsync(
     Ptr self, Callback<const asio::ip::tcp::endpoint &> callback)
 {
-    asio::post(m_ioService, [
+    m_queue.submit([
         =, self = std::move(self), callback = std::move(callback)
     ]() mutable { callback(m_acceptor.local_endpoint()); });
 }
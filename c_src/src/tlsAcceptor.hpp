@@ -11,6 +11,8 @@
 
 #include "callback.hpp"
 #include "detail.hpp"
+#include "handlerArena.hpp"
+#include "submissionQueue.hpp"
 #include "tlsSocket.hpp"
 
 #include <asio/io_service.hpp>
@@ -76,6 +78,8 @@ public:
 private:
     TLSApplication &m_app;
     asio::io_service &m_ioService;
+    SubmissionQueue &m_queue;
+    detail::HandlerArena m_arena;
     asio::ip::tcp::acceptor m_acceptor;
 };
 
@@ -8,41 +8,436 @@
 
 #include "tlsApplication.hpp"
 
+#include "cpuTopology.hpp"
+#include "detail.hpp"
 #include "utils.hpp"
 
+#include <asio/detail/reactor.hpp>
+
 #include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <functional>
+#include <random>
+#include <string>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
 
 namespace one {
 namespace etls {
 
-TLSApplication::TLSApplication(std::size_t n)
-    : m_threadsNum{n}
+namespace {
+
+#if defined(ASIO_HAS_EPOLL)
+constexpr bool selectAvailable = true;
+#else
+constexpr bool selectAvailable = false;
+#endif
+
+/**
+ * Names a thread with a prefix, a role and an index, shortened to fit the
+ * system's limit.
+ */
+void nameThread(
+    const std::string &prefix, const char *role, const std::size_t index)
 {
-    std::generate_n(std::back_inserter(m_ioServices), m_threadsNum,
-        [] { return std::make_unique<asio::io_service>(1); });
+    utils::nameThread((prefix + role + std::to_string(index)).substr(0, 15));
+}
 
-    for (auto &ios : m_ioServices) {
-        m_works.emplace_back(asio::make_work_guard(*ios));
-        m_threads.emplace_back([&] {
-            utils::nameThread("TLSApplication");
-            ios->run();
-        });
-    }
+/// How often I/O threads sample their load.
+constexpr std::chrono::milliseconds loadSamplePeriod{100};
+
+/// How often I/O threads move sockets to less busy ones.
+constexpr std::chrono::seconds rebalancePeriod{1};
+
+/// Difference in busy shares worth moving sockets for.
+constexpr double rebalanceThreshold = 0.1;
+
+/// Picks candidates for load-aware placement.
+thread_local std::minstd_rand placementRandom{std::random_device{}()};
+
+/// Ids of applications.
+std::atomic<std::uint64_t> nextApplicationId{1};
+
+/// The io_service the calling thread is paired with, and the id of the
+/// application it belongs to.
+thread_local std::uint64_t threadApplication = 0;
+thread_local asio::io_service *threadService = nullptr;
+
+/**
+ * Reads a number of CPUs from a cgroup's quota and period, rounded up.
+ */
+std::size_t quotaCpus(const long quota, const long period)
+{
+    return static_cast<std::size_t>((quota + period - 1) / period);
+}
+
+} // namespace
+
+TLSApplication::TLSApplication(Config config)
+    : m_config(std::move(config))
+    , m_id{nextApplicationId++}
+{
+    if (!selectAvailable)
+        m_config.engine = Engine::threads;
+
+    m_target = m_config.ioThreads ? m_config.ioThreads : availableCpus();
+    m_capacity = std::max<std::size_t>(
+        m_target, std::thread::hardware_concurrency());
+
+    m_services.reset(new std::unique_ptr<Service>[m_capacity]);
+    m_pinned = m_config.engine == Engine::threads && !m_config.cpus.empty();
+
+    if (m_config.engine == Engine::select ||
+        m_config.placement == Placement::scheduler)
+        m_config.rebalance = false;
+
+    if (m_config.engine == Engine::select)
+        start();
+}
+
+TLSApplication::TLSApplication(const std::size_t n, const Engine engine)
+    : TLSApplication{Config{n, 0, "TLS", {}, engine}}
+{
 }
 
 TLSApplication::~TLSApplication()
 {
-    for (auto &ios : m_ioServices)
-        ios->stop();
+    const auto started = m_started.load();
+    for (std::size_t i = 0; i < started; ++i)
+        m_services[i]->ioService.stop();
 
-    for (auto &thread : m_threads)
+    for (std::size_t i = 0; i < started; ++i)
+        if (m_services[i]->thread.joinable())
+            m_services[i]->thread.join();
+
+    m_workerService.stop();
+    for (auto &thread : m_workers)
         thread.join();
 }
 
 asio::io_service &TLSApplication::ioService()
 {
-    return *m_ioServices[m_nextService++ % m_threadsNum];
+    auto active = m_active.load(std::memory_order_acquire);
+    if (active == 0)
+        active = start();
+
+    switch (m_config.placement) {
+        case Placement::scheduler:
+            return pairedService(active);
+        case Placement::powerOfTwo:
+            return lightestService(active, 2);
+        case Placement::leastLoaded:
+            return lightestService(active, active);
+        case Placement::roundRobin:
+            break;
+    }
+
+    const auto next = m_nextService++;
+
+    // Services are taken in turns, skipping those on other nodes; pinned
+    // threads are spread over the nodes, so the turns stay even.
+    const auto &topology = CpuTopology::instance();
+    if (m_pinned && topology.nodes() > 1) {
+        const auto node = topology.currentNode();
+        for (std::size_t i = 0; i < active; ++i) {
+            auto &service = *m_services[(next + i) % active];
+            if (service.node == node)
+                return service.ioService;
+        }
+    }
+
+    return m_services[next % active]->ioService;
+}
+
+asio::io_service &TLSApplication::workerService()
+{
+    std::call_once(m_workersStarted, [this] {
+        m_workerWork = std::make_unique<
+            asio::executor_work_guard<asio::io_service::executor_type>>(
+            asio::make_work_guard(m_workerService));
+
+        const auto workers =
+            m_config.workerThreads ? m_config.workerThreads : size();
+
+        for (std::size_t i = 0; i < workers; ++i)
+            m_workers.emplace_back([this, i] {
+                nameThread(m_config.threadName, "Worker", i);
+                m_workerService.run();
+            });
+    });
+
+    return m_workerService;
+}
+
+TLSApplication::Engine TLSApplication::engine() const
+{
+    return m_config.engine;
+}
+
+TLSApplication::Placement TLSApplication::placement() const
+{
+    return m_config.placement;
+}
+
+std::size_t TLSApplication::size() const
+{
+    const auto active = m_active.load(std::memory_order_acquire);
+    return active ? active : m_target;
+}
+
+std::size_t TLSApplication::resize(std::size_t n)
+{
+    std::lock_guard<std::mutex> guard{m_resizeMutex};
+    if (m_config.engine == Engine::select ||
+        m_config.placement == Placement::scheduler)
+        return m_target;
+
+    m_target = std::min(std::max<std::size_t>(n, 1), m_capacity);
+    if (m_active.load(std::memory_order_relaxed) > 0)
+        grow(m_target);
+
+    return m_target;
+}
+
+std::size_t TLSApplication::start()
+{
+    std::lock_guard<std::mutex> guard{m_resizeMutex};
+    if (m_active.load(std::memory_order_relaxed) == 0)
+        grow(m_target);
+
+    return m_active.load(std::memory_order_relaxed);
+}
+
+void TLSApplication::grow(const std::size_t n)
+{
+    for (auto i = m_started.load(std::memory_order_relaxed); i < n; ++i) {
+        m_services[i] = std::make_unique<Service>();
+        auto &service = *m_services[i];
+
+        // A polled io_service is woken up through its reactor's descriptor,
+        // so the reactor is started up front, and submissions interrupt it
+        // as there's no thread for the io_service to wake up.
+        if (m_config.engine == Engine::select) {
+            asio::use_service<asio::detail::reactor>(service.ioService)
+                .init_task();
+            asio::use_service<SubmissionQueue>(service.ioService)
+                .setPolled();
+        }
+        else {
+            const auto cpu = m_pinned
+                ? m_config.cpus[i % m_config.cpus.size()]
+                : -1;
+
+            service.cpu = cpu;
+            service.node = CpuTopology::instance().nodeOf(cpu);
+            service.rebalanced = std::chrono::steady_clock::now();
+            sampleLoad(service);
+
+            service.thread = std::thread{[this, &service, i, cpu] {
+                nameThread(m_config.threadName, "IO", i);
+                if (cpu >= 0)
+                    utils::pinThread(cpu);
+
+                threadApplication = m_id;
+                threadService = &service.ioService;
+
+                // Load is measured with the thread's own CPU time.
+                service.load.sample();
+                service.ioService.run();
+            }};
+        }
+
+        m_started.store(i + 1, std::memory_order_release);
+    }
+
+    m_active.store(n, std::memory_order_release);
+}
+
+void TLSApplication::sampleLoad(Service &service)
+{
+    service.sampler.expires_after(loadSamplePeriod);
+    service.sampler.async_wait([this, &service](const std::error_code &ec) {
+        if (ec)
+            return;
+
+        service.load.sample();
+
+        const auto now = std::chrono::steady_clock::now();
+        if (m_config.rebalance &&
+            now - service.rebalanced >= rebalancePeriod) {
+            service.rebalanced = now;
+            this->rebalance(service);
+        }
+
+        this->sampleLoad(service);
+    });
+}
+
+void TLSApplication::rebalance(Service &service)
+{
+    service.load.shed(nullptr, 0);
+
+    Service *lightest = nullptr;
+    const auto active = m_active.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < active; ++i) {
+        auto &other = *m_services[i];
+        if (&other == &service || (m_pinned && other.node != service.node))
+            continue;
+
+        if (!lightest || other.load.lighterThan(lightest->load))
+            lightest = &other;
+    }
+
+    if (!lightest)
+        return;
+
+    const auto load = service.load.stats();
+    const auto difference = load.busy - lightest->load.stats().busy;
+    if (load.sockets < 2 || difference < rebalanceThreshold)
+        return;
+
+    // Sockets are taken to be equally busy; moving this many of them evens
+    // the threads out.
+    const auto n = static_cast<std::size_t>(
+        load.sockets * difference / (2 * load.busy));
+
+    service.load.shed(&lightest->ioService, std::max<std::size_t>(n, 1));
+}
+
+asio::io_service &TLSApplication::lightestService(
+    const std::size_t active, const std::size_t choices)
+{
+    if (active == 1)
+        return m_services[0]->ioService;
+
+    // Pinned threads on the calling thread's node are preferred to any on
+    // other nodes, so that sockets stay close to the memory they use.
+    const auto &topology = CpuTopology::instance();
+    const auto node = m_pinned ? topology.currentNode() : 0;
+
+    auto lighter = [&](const Service &a, const Service &b) {
+        if (a.node != b.node && (a.node == node || b.node == node))
+            return a.node == node;
+
+        return a.load.lighterThan(b.load);
+    };
+
+    Service *best = nullptr;
+    if (choices >= active) {
+        best = m_services[0].get();
+        for (std::size_t i = 1; i < active; ++i)
+            if (lighter(*m_services[i], *best))
+                best = m_services[i].get();
+    }
+    else {
+        // Two distinct services picked at random.
+        const auto first = placementRandom() % active;
+        auto second = placementRandom() % (active - 1);
+        if (second >= first)
+            ++second;
+
+        best = m_services[first].get();
+        if (lighter(*m_services[second], *best))
+            best = m_services[second].get();
+    }
+
+    return best->ioService;
+}
+
+asio::io_service &TLSApplication::pairedService(const std::size_t active)
+{
+    if (threadApplication == m_id)
+        return *threadService;
+
+    // A thread running on a pinned I/O thread's CPU, such as a scheduler
+    // bound to it, is paired with that thread.
+    auto index = m_nextService++ % active;
+#if defined(__linux__)
+    if (m_pinned) {
+        const auto cpu = ::sched_getcpu();
+        for (std::size_t i = 0; i < active; ++i)
+            if (m_services[i]->cpu == cpu) {
+                index = i;
+                break;
+            }
+    }
+#endif
+
+    threadApplication = m_id;
+    threadService = &m_services[index]->ioService;
+    return *threadService;
+}
+
+int TLSApplication::pollDescriptor(const std::size_t index)
+{
+    return detail::reactorDescriptor(m_services[index]->ioService);
+}
+
+bool TLSApplication::pollOne(const std::size_t index)
+{
+    return m_services[index]->ioService.poll_one() > 0;
+}
+
+SubmissionQueue::Stats TLSApplication::submissionStats() const
+{
+    SubmissionQueue::Stats total;
+    const auto started = m_started.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < started; ++i) {
+        const auto stats =
+            asio::use_service<SubmissionQueue>(m_services[i]->ioService)
+                .stats();
+
+        total.submitted += stats.submitted;
+        total.wakeups += stats.wakeups;
+        total.overflows += stats.overflows;
+        total.latency += stats.latency;
+    }
+
+    return total;
+}
+
+std::vector<IoLoad::Stats> TLSApplication::loads() const
+{
+    std::vector<IoLoad::Stats> loads;
+    const auto active = m_active.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < active; ++i)
+        loads.emplace_back(m_services[i]->load.stats());
+
+    return loads;
+}
+
+std::size_t TLSApplication::availableCpus()
+{
+    std::size_t cpus = std::max(std::thread::hardware_concurrency(), 1u);
+
+#if defined(__linux__)
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        cpus = std::min<std::size_t>(cpus, CPU_COUNT(&set));
+
+    // cgroup v2 keeps "<quota> <period>" or "max <period>" in cpu.max;
+    // cgroup v1 keeps them in separate files, with -1 for no quota.
+    std::ifstream cpuMax{"/sys/fs/cgroup/cpu.max"};
+    std::string quota;
+    long period = 0;
+    if (cpuMax >> quota >> period) {
+        if (quota != "max" && period > 0)
+            cpus = std::min(cpus, quotaCpus(std::stol(quota), period));
+    }
+    else {
+        std::ifstream quotaFile{"/sys/fs/cgroup/cpu/cpu.cfs_quota_us"};
+        std::ifstream periodFile{"/sys/fs/cgroup/cpu/cpu.cfs_period_us"};
+        long quotaUs = 0;
+        if (quotaFile >> quotaUs && periodFile >> period && quotaUs > 0 &&
+            period > 0)
+            cpus = std::min(cpus, quotaCpus(quotaUs, period));
+    }
+#endif
+
+    return std::max<std::size_t>(cpus, 1);
 }
 
 } // namespace etls
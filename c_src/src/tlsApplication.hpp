@@ -9,13 +9,20 @@
 #ifndef ONE_ETLS_TLS_APPLICATION_HPP
 #define ONE_ETLS_TLS_APPLICATION_HPP
 
+#include "ioLoad.hpp"
+#include "submissionQueue.hpp"
+
 #include <asio/executor_work_guard.hpp>
 #include <asio/io_service.hpp>
 #include <asio/ssl/context.hpp>
+#include <asio/steady_timer.hpp>
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -28,12 +35,94 @@ namespace etls {
  */
 class TLSApplication {
 public:
+    /**
+     * Ways of running the @c io_services.
+     */
+    enum class Engine {
+        /// Each @c io_service is run by a thread of its own.
+        threads,
+
+        /// No threads are started; the @c io_services are polled by the
+        /// application, which waits for their @c pollDescriptor to become
+        /// readable.
+        select
+    };
+
+    /**
+     * Ways of placing new sockets on the @c io_services.
+     */
+    enum class Placement {
+        /// The @c io_services are taken in turns.
+        roundRobin,
+
+        /// The less loaded of two @c io_services picked at random, see
+        /// @c IoLoad::lighterThan().
+        powerOfTwo,
+
+        /// The least loaded of all @c io_services.
+        leastLoaded,
+
+        /// Each thread asking for an @c io_service is paired with one on its
+        /// first call, and always gets that one. Meant for the VM's
+        /// schedulers, with as many @c io_services as there are schedulers,
+        /// so that each scheduler has an I/O thread of its own.
+        scheduler
+    };
+
+    /**
+     * Configuration of the threads.
+     */
+    struct Config {
+        /// Number of @c io_services; 0 picks the number of CPUs the process
+        /// may run on, see @c availableCpus().
+        std::size_t ioThreads = 0;
+
+        /// Number of threads of the worker pool; 0 picks the number of
+        /// @c io_services.
+        std::size_t workerThreads = 0;
+
+        /// Prefix of the threads' names.
+        std::string threadName = "TLS";
+
+        /// CPUs the I/O threads are pinned to, the i-th thread to
+        /// @c cpus[i % cpus.size()]; empty leaves the threads unpinned.
+        /// Once pinned, new sockets are placed on threads of the NUMA node
+        /// they're created on. Not used with @c Engine::select.
+        std::vector<int> cpus;
+
+        /// The way @c io_services are run.
+        Engine engine = Engine::threads;
+
+        /// The way new sockets are placed on @c io_services.
+        Placement placement = Placement::roundRobin;
+
+        /// Whether I/O threads move sockets to less busy threads once a
+        /// second, when they're at least 10% busier. Sockets move when
+        /// they start an operation with none in progress other than
+        /// waiting for data, and stay on a thread for at least 10 seconds.
+        /// Pinned threads move sockets only within their NUMA node. Not
+        /// used with @c Engine::select or @c Placement::scheduler.
+        bool rebalance = false;
+    };
+
     /**
      * Constructor.
-     * Starts N threads where N is by default the result of @c
-     * std::hardware_concurrency().
+     * With @c Engine::threads, the @c io_services are created and their
+     * threads started on first use. With @c Engine::select they're created
+     * up front. Select engine is only available where the @c io_service
+     * uses epoll; elsewhere threads are used anyway.
+     * @param config Configuration of the threads.
      */
-    TLSApplication(std::size_t n = std::thread::hardware_concurrency());
+    explicit TLSApplication(Config config);
+
+    /**
+     * Constructor.
+     * @param n Number of @c io_services; 0 picks the number of available
+     * CPUs.
+     * @param engine The way @c io_services are run.
+     */
+    explicit TLSApplication(
+        std::size_t n = 0, Engine engine = Engine::threads);
 
     /**
      * Destructor.
@@ -42,17 +131,132 @@ public:
     ~TLSApplication();
 
     /**
-     * @returns An @c io_service object managed by this.
+     * @returns An @c io_service object managed by this. With
+     * @c Placement::scheduler it's the one paired with the calling thread;
+     * the application's own threads are paired with the @c io_service they
+     * run. Otherwise, if the I/O threads are pinned, it's run by a thread on
+     * the calling thread's NUMA node where there's one; with
+     * @c Placement::powerOfTwo and @c Placement::leastLoaded such threads
+     * are preferred to less loaded ones on other nodes.
      */
     asio::io_service &ioService();
 
+    /**
+     * @returns An @c io_service run by a pool of worker threads, for
+     * offloading CPU-bound and blocking work from the I/O threads. The pool
+     * is started on first use, also with @c Engine::select. Results are
+     * to be submitted back through the @c SubmissionQueue of the
+     * @c io_service they're for, which also wakes up a polled one.
+     */
+    asio::io_service &workerService();
+
+    /**
+     * @returns The way the @c io_services are run.
+     */
+    Engine engine() const;
+
+    /**
+     * @returns The way new sockets are placed on the @c io_services.
+     */
+    Placement placement() const;
+
+    /**
+     * @returns Number of the @c io_services new sockets are placed on.
+     */
+    std::size_t size() const;
+
+    /**
+     * Changes the number of @c io_services new sockets are placed on.
+     * New @c io_services get threads of their own; @c io_services taken out
+     * keep running the sockets already placed on them, and are the first to
+     * be put back. With @c Engine::select or @c Placement::scheduler the
+     * number is fixed.
+     * @param n The new number, capped at the larger of the initial number
+     * and @c std::thread::hardware_concurrency().
+     * @returns The number in effect.
+     */
+    std::size_t resize(std::size_t n);
+
+    /**
+     * @param index Index of an @c io_service, below @c size().
+     * @returns A descriptor that becomes readable when the @c io_service
+     * may have handlers ready to run. Only for @c Engine::select.
+     */
+    int pollDescriptor(const std::size_t index);
+
+    /**
+     * Runs one ready handler of an @c io_service, without waiting for any.
+     * Only for @c Engine::select; an @c io_service mustn't be polled by
+     * more than one thread at a time.
+     * @param index Index of an @c io_service, below @c size().
+     * @returns Whether a handler was run.
+     */
+    bool pollOne(const std::size_t index);
+
+    /**
+     * @returns Statistics of operations submitted to the I/O threads,
+     * summed over all threads.
+     */
+    SubmissionQueue::Stats submissionStats() const;
+
+    /**
+     * @returns The load of each @c io_service new sockets are placed on.
+     * With @c Engine::select the load isn't sampled, as the @c io_services
+     * are run by threads doing other work: only the sockets, total bytes and
+     * queue depths are kept, and the rates and busy shares stay 0.
+     */
+    std::vector<IoLoad::Stats> loads() const;
+
+    /**
+     * @returns Number of CPUs the process may run on: the smaller of the
+     * process's CPU affinity and the CPU quota of its cgroup, if any.
+     */
+    static std::size_t availableCpus();
+
 private:
-    std::size_t m_threadsNum;
-    std::vector<std::unique_ptr<asio::io_service>> m_ioServices;
-    std::vector<asio::executor_work_guard<asio::io_service::executor_type>>
-        m_works;
-    std::vector<std::thread> m_threads;
+    struct Service {
+        asio::io_service ioService{1};
+        asio::executor_work_guard<asio::io_service::executor_type> work{
+            asio::make_work_guard(ioService)};
+        IoLoad &load{asio::use_service<IoLoad>(ioService)};
+        asio::steady_timer sampler{ioService};
+        std::chrono::steady_clock::time_point rebalanced;
+        std::thread thread;
+        int cpu = -1;
+        std::size_t node = 0;
+    };
+
+    std::size_t start();
+    void grow(const std::size_t n);
+    void sampleLoad(Service &service);
+    void rebalance(Service &service);
+    asio::io_service &pairedService(const std::size_t active);
+    asio::io_service &lightestService(
+        const std::size_t active, const std::size_t choices);
+
+    Config m_config;
+    std::size_t m_capacity;
+    bool m_pinned;
+    std::unique_ptr<std::unique_ptr<Service>[]> m_services;
+
+    // Services are created up to m_started and never destroyed before the
+    // application; new sockets are placed on the first m_active of them.
+    std::mutex m_resizeMutex;
+    std::size_t m_target;
+    std::atomic<std::size_t> m_started{0};
+    std::atomic<std::size_t> m_active{0};
     std::atomic<std::size_t> m_nextService{0};
+
+    // Identifies the application in its threads' pairings, which outlive
+    // it; addresses could be reused.
+    const std::uint64_t m_id;
+
+    std::once_flag m_workersStarted;
+    asio::io_service m_workerService;
+    std::unique_ptr<
+        asio::executor_work_guard<asio::io_service::executor_type>>
+        m_workerWork;
+    std::vector<std::thread> m_workers;
 };
 
 } // namespace etls
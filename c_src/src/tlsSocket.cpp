@@ -13,7 +13,16 @@
 
 #include <asio.hpp>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
 #include <algorithm>
+#include <cerrno>
 #include <functional>
 #include <random>
 #include <system_error>
@@ -21,6 +30,27 @@
 
 namespace {
 
+/// Largest TLS record payload.
+constexpr std::size_t maxRecordSize = 16 * 1024;
+
+/// Smallest record size accepted by @c SSL_set_max_send_fragment.
+constexpr std::size_t minRecordSize = 512;
+
+/// TLS record header, explicit nonce and tag of an AEAD cipher.
+constexpr std::size_t recordOverhead = 5 + 8 + 16;
+
+/// Bytes sent in segment-sized records after an idle period.
+constexpr std::size_t smallRecordsThreshold = 64 * 1024;
+
+/// Time after which a connection is considered idle.
+constexpr auto idleTimeout = std::chrono::seconds{1};
+
+/// Time a socket stays on an I/O thread before it can be moved to shed load.
+constexpr auto minPlacementTime = std::chrono::seconds{10};
+
+using MaxSegment =
+    asio::detail::socket_option::integer<IPPROTO_TCP, TCP_MAXSEG>;
+
 std::vector<unsigned char> certToDer(X509 *cert)
 {
     if (!cert)
@@ -43,124 +73,253 @@ std::vector<unsigned char> certToDer(X509 *cert)
 namespace one {
 namespace etls {
 
+struct TLSSocket::FileTransfer {
+    FileTransfer(const int descriptor)
+        : fd{descriptor}
+    {
+    }
+
+    ~FileTransfer() { ::close(fd); }
+
+    int fd;
+    off_t offset = 0;
+    std::size_t remaining = 0;
+    std::size_t sent = 0;
+    std::unique_ptr<char[]> buffer;
+    std::size_t bufferSize = 0;
+};
+
 TLSSocket::TLSSocket(TLSApplication &app, const std::string &keyPath,
     const std::string &certPath, std::string rfc2818Hostname)
     : detail::WithSSLContext{asio::ssl::context::tlsv12_client, keyPath,
           certPath, std::move(rfc2818Hostname)}
-    , m_ioService{app.ioService()}
-    , m_resolver{m_ioService}
-    , m_socket{m_ioService, *m_context}
+    , m_app{app}
+    , m_ioService{&app.ioService()}
+    , m_queue{&asio::use_service<SubmissionQueue>(*m_ioService)}
+    , m_load{&asio::use_service<IoLoad>(*m_ioService)}
+    , m_placed{std::chrono::steady_clock::now()}
+    , m_socket{*m_ioService, *m_context}
+    , m_smallRecordSize{1460 - recordOverhead}
 {
+    ioLoad().addSocket();
 }
 
 TLSSocket::TLSSocket(
     TLSApplication &app, std::shared_ptr<asio::ssl::context> context)
+    : TLSSocket{app, app.ioService(), std::move(context)}
+{
+}
+
+TLSSocket::TLSSocket(TLSApplication &app, asio::io_service &ioService,
+    std::shared_ptr<asio::ssl::context> context)
     : detail::WithSSLContext{std::move(context)}
-    , m_ioService{app.ioService()}
-    , m_resolver{m_ioService}
-    , m_socket{m_ioService, *m_context}
+    , m_app{app}
+    , m_ioService{&ioService}
+    , m_queue{&asio::use_service<SubmissionQueue>(ioService)}
+    , m_load{&asio::use_service<IoLoad>(ioService)}
+    , m_placed{std::chrono::steady_clock::now()}
+    , m_socket{ioService, *m_context}
+    , m_smallRecordSize{1460 - recordOverhead}
 {
+    ioLoad().addSocket();
 }
 
+TLSSocket::~TLSSocket() { ioLoad().removeSocket(); }
+
 void TLSSocket::connectAsync(Ptr self, std::string host,
     const unsigned short port, Callback<Ptr> callback)
 {
-    m_resolver.async_resolve({std::move(host), std::to_string(port)}, [
-        this, self = std::move(self), callback = std::move(callback)
-    ](const auto ec1, auto iterator) mutable {
+    // The name is resolved on the worker pool and the result submitted to
+    // the socket's thread; asio's own resolver thread would post it without
+    // waking up a polled io_service.
+    asio::post(m_app.workerService(), [
+        this, self = std::move(self), host = std::move(host), port,
+        callback = std::move(callback)
+    ]() mutable {
+        std::error_code ec;
+        asio::ip::tcp::resolver resolver{m_app.workerService()};
+        auto iterator = resolver.resolve({host, std::to_string(port)}, ec);
+
+        this->submit([
+            this, self = std::move(self), ec, iterator,
+            callback = std::move(callback)
+        ]() mutable {
+            this->connect(std::move(self), ec, std::move(iterator),
+                std::move(callback));
+        });
+    });
+}
 
-        auto endpoints = this->shuffleEndpoints(std::move(iterator));
+void TLSSocket::connect(Ptr self, const std::error_code &ec1,
+    asio::ip::tcp::resolver::iterator iterator, Callback<Ptr> callback)
+{
+    auto endpoints = shuffleEndpoints(std::move(iterator));
 
-        if (ec1) {
-            callback(ec1);
-            return;
-        }
+    if (ec1) {
+        callback(ec1);
+        return;
+    }
 
-        asio::async_connect(m_socket.lowest_layer(), endpoints.begin(),
-            endpoints.end(),
-            [ this, self = std::move(self), callback = std::move(callback) ](
-                                const auto ec2, auto) mutable {
+    asio::async_connect(m_socket.lowest_layer(), endpoints.begin(),
+        endpoints.end(),
+        [ this, self = std::move(self), callback = std::move(callback) ](
+                            const auto ec2, auto) mutable {
 
-                if (ec2) {
-                    callback(ec2);
-                    return;
-                }
+            if (ec2) {
+                callback(ec2);
+                return;
+            }
 
-                m_socket.lowest_layer().set_option(
-                    asio::ip::tcp::no_delay{true});
-
-                m_socket.async_handshake(asio::ssl::stream_base::client, [
-                    this, self = std::move(self), callback = std::move(callback)
-                ](const auto ec3) mutable {
-                    if (ec3) {
-                        callback(ec3);
-                    }
-                    else {
-                        this->saveChain(false);
-                        callback(std::move(self));
-                    }
-                });
+            m_socket.lowest_layer().set_option(asio::ip::tcp::no_delay{true});
+
+            m_socket.async_handshake(asio::ssl::stream_base::client, [
+                this, self = std::move(self), callback = std::move(callback)
+            ](const auto ec3) mutable {
+                if (ec3) {
+                    callback(ec3);
+                }
+                else {
+                    this->saveChain(false);
+                    this->initRecordSizing();
+                    callback(std::move(self));
+                }
             });
-    });
+        });
 }
 
 void TLSSocket::recvAsync(Ptr self, asio::mutable_buffer buffer,
     Callback<asio::mutable_buffer> callback)
 {
-    asio::post(m_ioService, [
+    submit(m_arena.wrap([
         =, self = std::move(self), callback = std::move(callback)
     ]() mutable {
-        asio::async_read(m_socket, asio::mutable_buffers_1{buffer},
-            [ =, self = std::move(self), callback = std::move(callback) ](
-                             const auto ec, const auto read) mutable {
-                if (ec)
+        auto buffered = m_decoder.take(buffer);
+        buffered += this->takeStashed(buffer + buffered);
+        asio::async_read(m_socket, asio::mutable_buffers_1{buffer + buffered},
+            m_arena.wrap([
+                =, self = std::move(self), callback = std::move(callback)
+            ](const auto ec, const auto read) mutable {
+                if (ec) {
                     callback(ec);
-                else
-                    callback(std::move(buffer));
-            });
-    });
+                    return;
+                }
+
+                this->ioLoad().addBytes(read);
+                this->stashBuffered();
+                callback(std::move(buffer));
+            }));
+    }));
 }
 
 void TLSSocket::recvAnyAsync(Ptr self, asio::mutable_buffer buffer,
     Callback<asio::mutable_buffer> callback)
 {
-    asio::post(m_ioService, [
+    submit(m_arena.wrap([
         =, self = std::move(self), callback = std::move(callback)
     ]() mutable {
+        auto buffered = m_decoder.take(buffer);
+        if (!buffered)
+            buffered = this->takeStashed(buffer);
+
+        if (buffered) {
+            callback(asio::buffer(buffer, buffered));
+            return;
+        }
+
         m_socket.async_read_some(asio::mutable_buffers_1{buffer},
-            [ =, self = std::move(self), callback = std::move(callback) ](
-                                     const auto ec, const auto read) {
-                if (ec)
+            m_arena.wrap([
+                =, self = std::move(self), callback = std::move(callback)
+            ](const auto ec, const auto read) {
+                if (ec) {
                     callback(ec);
-                else
-                    callback(asio::buffer(buffer, read));
-            });
-    });
+                    return;
+                }
+
+                this->ioLoad().addBytes(read);
+                this->adaptRecvBuffer(read, asio::buffer_size(buffer));
+                this->stashBuffered();
+                callback(asio::buffer(buffer, read));
+            }));
+    }));
+}
+
+void TLSSocket::recvPacketsAsync(Ptr self, const PacketDecoder::Type type,
+    const std::size_t maxSize,
+    Callback<const std::vector<PacketDecoder::Packet> &> callback)
+{
+    submit(m_arena.wrap([
+        =, self = std::move(self), callback = std::move(callback)
+    ]() mutable {
+        m_decoder.setType(type, maxSize);
+
+        // Data put aside by a raw receive is older than anything the
+        // decoder would read from the socket.
+        while (m_stashed.load(std::memory_order_relaxed) > 0) {
+            const auto n = this->takeStashed(m_decoder.prepare());
+            m_decoder.commit(n);
+        }
+
+        this->decodePackets(std::move(self), std::move(callback));
+    }));
+}
+
+void TLSSocket::decodePackets(
+    Ptr self, Callback<const std::vector<PacketDecoder::Packet> &> callback)
+{
+    std::vector<PacketDecoder::Packet> packets;
+    const auto ec = m_decoder.decode(packets);
+
+    if (!packets.empty()) {
+        callback(packets);
+        m_decoder.consume();
+        return;
+    }
+
+    if (ec) {
+        callback(ec);
+        return;
+    }
+
+    m_socket.async_read_some(asio::mutable_buffers_1{m_decoder.prepare()},
+        m_arena.wrap([
+            this, self = std::move(self), callback = std::move(callback)
+        ](const auto ec1, const auto read) mutable {
+            if (ec1) {
+                callback(ec1);
+                return;
+            }
+
+            this->ioLoad().addBytes(read);
+            m_decoder.commit(read);
+            this->decodePackets(std::move(self), std::move(callback));
+        }));
 }
 
 void TLSSocket::handshakeAsync(Ptr self, Callback<> callback)
 {
-    asio::post(m_ioService, [
+    submit(m_arena.wrap([
         =, self = std::move(self), callback = std::move(callback)
     ]() mutable {
         m_socket.async_handshake(asio::ssl::stream_base::server,
-            [ =, self = std::move(self), callback = std::move(callback) ](
-                                     const auto ec) {
+            m_arena.wrap([
+                =, self = std::move(self), callback = std::move(callback)
+            ](const auto ec) {
                 if (ec) {
                     callback(ec);
                 }
                 else {
                     this->saveChain(true);
+                    this->initRecordSizing();
                     callback();
                 }
-            });
-    });
+            }));
+    }));
 }
 
 void TLSSocket::shutdownAsync(
     Ptr self, const asio::socket_base::shutdown_type type, Callback<> callback)
 {
-    asio::post(m_ioService, [
+    submit([
         =, self = std::move(self), callback = std::move(callback)
     ]() mutable {
         std::error_code ec;
@@ -174,14 +333,11 @@ void TLSSocket::shutdownAsync(
 
 void TLSSocket::closeAsync(Ptr self, Callback<> callback)
 {
-    asio::post(m_ioService, [
+    submit([
         =, self = std::move(self), callback = std::move(callback)
     ]() mutable {
         std::error_code ec;
-        m_socket.lowest_layer().shutdown(
-            asio::ip::tcp::socket::shutdown_both, ec);
-
-        m_socket.lowest_layer().close(ec);
+        m_socket.close(ec);
         if (ec)
             callback(ec);
         else
@@ -189,6 +345,123 @@ void TLSSocket::closeAsync(Ptr self, Callback<> callback)
     });
 }
 
+void TLSSocket::requestRehome()
+{
+    if (m_app.placement() == TLSApplication::Placement::scheduler)
+        m_rehome = true;
+}
+
+void TLSSocket::rehomeAsync(Ptr self)
+{
+    if (!m_rehome.load(std::memory_order_relaxed))
+        return;
+
+    auto &target = m_app.ioService();
+    submit([ this, self = std::move(self), &target ] {
+        if (this->moveTo(target))
+            m_rehome = false;
+    });
+}
+
+void TLSSocket::migrateAsync(
+    Ptr self, asio::io_service &ioService, Callback<bool> callback)
+{
+    submit([
+        this, self = std::move(self), &ioService,
+        callback = std::move(callback)
+    ] { callback(this->moveTo(ioService)); });
+}
+
+IoLoad &TLSSocket::ioLoad() const
+{
+    return *m_load.load(std::memory_order_relaxed);
+}
+
+bool TLSSocket::moveTo(asio::io_service &target)
+{
+    if (m_ioService == &target)
+        return true;
+
+    if (!m_socket.rebind(target))
+        return false;
+
+    m_ioService = &target;
+    m_queue.store(
+        &asio::use_service<SubmissionQueue>(target), std::memory_order_release);
+
+    ioLoad().removeSocket();
+    m_load.store(&asio::use_service<IoLoad>(target), std::memory_order_relaxed);
+    ioLoad().addSocket();
+    m_placed = std::chrono::steady_clock::now();
+    return true;
+}
+
+bool TLSSocket::shed()
+{
+    // A socket stays put for a while after a move, so that a busy one
+    // doesn't bounce between threads.
+    const auto target = ioLoad().shedTarget();
+    if (!target ||
+        std::chrono::steady_clock::now() - m_placed < minPlacementTime)
+        return false;
+
+    auto &load = ioLoad();
+    if (!moveTo(*target))
+        return false;
+
+    load.shedOne();
+    return true;
+}
+
+void TLSSocket::setOptionAsync(
+    Ptr self, const Option option, const std::size_t value)
+{
+    submit([ =, self = std::move(self) ] {
+        switch (option) {
+            case Option::recordSize:
+                m_recordSize.store(value == 0
+                        ? 0
+                        : std::min(std::max(value, minRecordSize),
+                              maxRecordSize),
+                    std::memory_order_relaxed);
+                break;
+
+            case Option::readAhead:
+                m_socket.setReadAhead(value);
+                break;
+
+            case Option::writeWindow:
+                m_socket.setWriteWindow(value);
+                break;
+
+            case Option::sealWorkers:
+                m_socket.setSealWorkers(m_app.workerService(), value);
+                break;
+
+            case Option::pipelinedRecv:
+                m_socket.setPipelined(
+                    value ? &m_app.workerService() : nullptr);
+                break;
+
+            case Option::kernelTls:
+                m_socket.setKernelOffload(value != 0);
+                break;
+
+            case Option::recvBufferMin:
+                m_recvBufferMin = std::max<std::size_t>(value, 1);
+                m_recvBufferMax = std::max(m_recvBufferMax, m_recvBufferMin);
+                this->updateRecvBufferSize();
+                break;
+
+            case Option::recvBufferMax:
+                m_recvBufferMax = std::max<std::size_t>(value, 1);
+                m_recvBufferMin = std::min(m_recvBufferMin, m_recvBufferMax);
+                this->updateRecvBufferSize();
+                break;
+        }
+    });
+}
+
 void TLSSocket::setVerifyMode(const asio::ssl::verify_mode mode)
 {
     m_socket.set_verify_mode(mode);
@@ -204,7 +477,8 @@ void TLSSocket::saveChain(bool server)
     if (!chain)
         return;
 
-    decltype(m_certificateChain) certChain;
+    auto certChain =
+        std::make_unique<std::vector<std::vector<unsigned char>>>();
 
     auto numCerts = sk_X509_num(chain);
     for (auto i = 0u; i < numCerts; ++i) {
@@ -213,7 +487,7 @@ void TLSSocket::saveChain(bool server)
         if (certificateData.empty())
             return;
 
-        certChain.emplace_back(std::move(certificateData));
+        certChain->emplace_back(std::move(certificateData));
     }
 
     if (server) {
@@ -222,16 +496,329 @@ void TLSSocket::saveChain(bool server)
         if (certificateData.empty())
             return;
 
-        certChain.emplace_back(std::move(certificateData));
+        certChain->emplace_back(std::move(certificateData));
     }
 
     std::swap(m_certificateChain, certChain);
 }
 
+void TLSSocket::initRecordSizing()
+{
+    std::error_code ec;
+    MaxSegment mss;
+    m_socket.lowest_layer().get_option(mss, ec);
+
+    if (!ec && static_cast<std::size_t>(mss.value()) > recordOverhead)
+        m_smallRecordSize = std::min(
+            std::max(mss.value() - recordOverhead, minRecordSize),
+            maxRecordSize);
+}
+
+void TLSSocket::beginWrite()
+{
+    if (std::chrono::steady_clock::now() - m_lastWrite > idleTimeout)
+        m_sentSinceIdle = 0;
+}
+
+std::size_t TLSSocket::recordSize(const std::size_t transferred) const
+{
+    // Records fitting in a single segment can be decrypted as soon as they
+    // arrive, which improves time to first byte; full-sized records are
+    // cheaper once the connection is busy.
+    const auto fixed = m_recordSize.load(std::memory_order_relaxed);
+    return fixed ? fixed
+                 : m_sentSinceIdle + transferred < smallRecordsThreshold
+            ? m_smallRecordSize
+            : maxRecordSize;
+}
+
+std::size_t TLSSocket::nextRecordSize(const std::size_t transferred)
+{
+    const auto recordSize = this->recordSize(transferred);
+    if (recordSize != m_currentRecordSize) {
+        SSL_set_max_send_fragment(m_socket.native_handle(), recordSize);
+        m_currentRecordSize = recordSize;
+    }
+
+    return recordSize;
+}
+
+void TLSSocket::endWrite(const std::size_t written)
+{
+    ioLoad().addBytes(written);
+    m_sentSinceIdle += written;
+    m_lastWrite = std::chrono::steady_clock::now();
+}
+
+std::size_t TLSSocket::recvBufferSize() const
+{
+    return m_recvBufferSize.load(std::memory_order_relaxed);
+}
+
+std::size_t TLSSocket::bufferedBytes() const
+{
+    return m_stashed.load(std::memory_order_acquire);
+}
+
+std::size_t TLSSocket::tryRecv(asio::mutable_buffer buffer, const bool exact)
+{
+    const auto stashed = m_stashed.load(std::memory_order_acquire);
+    if (stashed == 0 || (exact && stashed < asio::buffer_size(buffer)))
+        return 0;
+
+    std::unique_lock<std::mutex> lock{m_stashMutex, std::try_to_lock};
+    if (!lock.owns_lock() ||
+        (exact && m_stashEnd - m_stashBegin < asio::buffer_size(buffer)))
+        return 0;
+
+    return unstash(buffer);
+}
+
+bool TLSSocket::trySend(asio::const_buffer buffer)
+{
+    const auto size = asio::buffer_size(buffer);
+    if (size > maxSyncSendSize)
+        return false;
+
+    // Writes are serialized by the socket's sender process, so the write
+    // bookkeeping isn't used by the I/O thread at the same time. The record
+    // size is applied by the stream under its lock.
+    beginWrite();
+    const auto recordSize = this->recordSize(0);
+    if (!m_socket.tryWrite(buffer, recordSize)) {
+        // The size may or may not have been applied; the write that
+        // follows sets it again.
+        m_currentRecordSize = 0;
+        return false;
+    }
+
+    m_currentRecordSize = recordSize;
+    endWrite(size);
+    return true;
+}
+
+void TLSSocket::stashBuffered()
+{
+    // Data left in the decoder has to be received first.
+    if (m_decoder.buffered() > 0 ||
+        m_stashed.load(std::memory_order_relaxed) > 0 ||
+        !m_socket.hasBuffered())
+        return;
+
+    std::lock_guard<std::mutex> guard{m_stashMutex};
+    auto stash = BufferPool::instance().borrow(recvBufferSize());
+    const auto read =
+        m_socket.readBuffered(asio::buffer(stash.data(), stash.size()));
+
+    if (read == 0)
+        return;
+
+    m_stash = std::move(stash);
+    m_stashBegin = 0;
+    m_stashEnd = read;
+    m_stashed.store(read, std::memory_order_release);
+}
+
+std::size_t TLSSocket::takeStashed(asio::mutable_buffer buffer)
+{
+    // Only the I/O thread adds data, so if there's none it can't appear
+    // while it's being checked.
+    if (m_stashed.load(std::memory_order_relaxed) == 0)
+        return 0;
+
+    std::lock_guard<std::mutex> guard{m_stashMutex};
+    return unstash(buffer);
+}
+
+std::size_t TLSSocket::unstash(asio::mutable_buffer buffer)
+{
+    const auto n = asio::buffer_copy(buffer,
+        asio::buffer(m_stash.data() + m_stashBegin, m_stashEnd - m_stashBegin));
+
+    m_stashBegin += n;
+    if (m_stashBegin == m_stashEnd)
+        m_stash.reset();
+
+    m_stashed.store(m_stashEnd - m_stashBegin, std::memory_order_release);
+    return n;
+}
+
+void TLSSocket::adaptRecvBuffer(const std::size_t read, const std::size_t size)
+{
+    // A filled buffer means more data may have been waiting, so the estimate
+    // grows at once and the buffer doubles; the estimate decays slowly, by an
+    // eighth of the difference per read, so that an occasional short read
+    // doesn't shrink a busy socket's buffers.
+    if (read >= size)
+        m_recvEstimate = std::max(m_recvEstimate, size);
+    else
+        m_recvEstimate = m_recvEstimate - m_recvEstimate / 8 + read / 8;
+
+    updateRecvBufferSize();
+}
+
+void TLSSocket::updateRecvBufferSize()
+{
+    m_recvBufferSize.store(
+        std::min(std::max(2 * m_recvEstimate, m_recvBufferMin), m_recvBufferMax),
+        std::memory_order_relaxed);
+}
+
+void TLSSocket::sendFileAsync(Ptr self, std::string path,
+    const std::size_t offset, const std::size_t length,
+    Callback<std::size_t> callback)
+{
+    submit([
+        =, self = std::move(self), path = std::move(path),
+        callback = std::move(callback)
+    ]() mutable {
+        const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            callback(std::error_code{errno, std::system_category()});
+            return;
+        }
+
+        this->sendFile(
+            std::move(self), fd, offset, length, std::move(callback));
+    });
+}
+
+void TLSSocket::sendFileAsync(Ptr self, const int fd,
+    const std::size_t offset, const std::size_t length,
+    Callback<std::size_t> callback)
+{
+    const auto dupFd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    const std::error_code ec{errno, std::system_category()};
+
+    submit([
+        =, self = std::move(self), callback = std::move(callback)
+    ]() mutable {
+        if (dupFd < 0)
+            callback(ec);
+        else
+            this->sendFile(
+                std::move(self), dupFd, offset, length, std::move(callback));
+    });
+}
+
+void TLSSocket::sendFile(Ptr self, const int fd, const std::size_t offset,
+    std::size_t length, Callback<std::size_t> callback)
+{
+    auto transfer = std::make_shared<FileTransfer>(fd);
+    transfer->offset = static_cast<off_t>(offset);
+
+    if (length == 0) {
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            callback(std::error_code{errno, std::system_category()});
+            return;
+        }
+
+        const auto size = static_cast<std::size_t>(st.st_size);
+        length = size > offset ? size - offset : 0;
+    }
+
+    transfer->remaining = length;
+    beginWrite();
+    sendFileChunk(std::move(self), std::move(transfer), std::move(callback));
+}
+
+void TLSSocket::sendFileChunk(Ptr self, std::shared_ptr<FileTransfer> transfer,
+    Callback<std::size_t> callback)
+{
+    auto &t = *transfer;
+
+#ifdef __linux__
+    // The kernel encrypts whatever is written to the socket, so the file's
+    // pages can be sent straight from the page cache.
+    while (t.remaining > 0 && m_socket.offloadWrites()) {
+        const auto result = ::sendfile(m_socket.lowest_layer().native_handle(),
+            t.fd, &t.offset, t.remaining);
+
+        if (result > 0) {
+            t.remaining -= static_cast<std::size_t>(result);
+            t.sent += static_cast<std::size_t>(result);
+            endWrite(static_cast<std::size_t>(result));
+        }
+        else if (result == 0) {
+            t.remaining = 0;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            m_socket.lowest_layer().async_wait(
+                asio::socket_base::wait_write, [
+                    this, self = std::move(self),
+                    transfer = std::move(transfer),
+                    callback = std::move(callback)
+                ](const std::error_code &ec) mutable {
+                    if (ec)
+                        callback(ec);
+                    else
+                        this->sendFileChunk(std::move(self),
+                            std::move(transfer), std::move(callback));
+                });
+            return;
+        }
+        else {
+            callback(std::error_code{errno, std::system_category()});
+            return;
+        }
+    }
+#endif
+
+    if (t.remaining == 0) {
+        callback(t.sent);
+        return;
+    }
+
+    if (!t.buffer) {
+        t.bufferSize = maxRecordSize * m_socket.writeWindow();
+        t.buffer.reset(new char[t.bufferSize]);
+    }
+
+    ssize_t result;
+    do {
+        result = ::pread(t.fd, t.buffer.get(),
+            std::min(t.remaining, t.bufferSize), t.offset);
+    } while (result < 0 && errno == EINTR);
+
+    if (result < 0) {
+        callback(std::error_code{errno, std::system_category()});
+        return;
+    }
+
+    if (result == 0) {
+        callback(t.sent);
+        return;
+    }
+
+    asio::async_write(m_socket,
+        asio::buffer(t.buffer.get(), static_cast<std::size_t>(result)),
+        [this](const std::error_code &ec, const std::size_t transferred) {
+            return ec ? 0 : this->nextRecordSize(transferred) *
+                    m_socket.writeWindow();
+        },
+        [
+          this, self = std::move(self), transfer = std::move(transfer),
+          callback = std::move(callback)
+        ](const std::error_code &ec, const std::size_t written) mutable {
+            this->endWrite(written);
+            if (ec) {
+                callback(ec);
+                return;
+            }
+
+            transfer->offset += static_cast<off_t>(written);
+            transfer->remaining -= written;
+            transfer->sent += written;
+            this->sendFileChunk(
+                std::move(self), std::move(transfer), std::move(callback));
+        });
+}
+
 void TLSSocket::localEndpointAsync(
     Ptr self, Callback<const asio::ip::tcp::endpoint &> callback)
 {
-    asio::post(m_ioService, [
+    submit([
         =, self = std::move(self), callback = std::move(callback)
     ]() mutable { callback(m_socket.lowest_layer().local_endpoint()); });
 }
@@ -239,15 +826,27 @@ void TLSSocket::localEndpointAsync(
 void TLSSocket::remoteEndpointAsync(
     Ptr self, Callback<const asio::ip::tcp::endpoint &> callback)
 {
-    asio::post(m_ioService, [
+    submit([
         =, self = std::move(self), callback = std::move(callback)
     ]() mutable { callback(m_socket.lowest_layer().remote_endpoint()); });
 }
 
+void TLSSocket::statsAsync(Ptr self, Callback<const Stats &> callback)
+{
+    submit([
+        =, self = std::move(self), callback = std::move(callback)
+    ]() mutable {
+        Stats stats;
+        stats.recvBuffer = this->recvBufferSize();
+        callback(stats);
+    });
+}
+
 const std::vector<std::vector<unsigned char>> &
 TLSSocket::certificateChain() const
 {
-    return m_certificateChain;
+    static const std::vector<std::vector<unsigned char>> noCertificates;
+    return m_certificateChain ? *m_certificateChain : noCertificates;
 }
 
 std::vector<asio::ip::basic_resolver_entry<asio::ip::tcp>>
@@ -11,13 +11,20 @@
 
 #include "callback.hpp"
 #include "detail.hpp"
+#include "handlerArena.hpp"
+#include "ioLoad.hpp"
+#include "packetDecoder.hpp"
+#include "submissionQueue.hpp"
+#include "tlsStream.hpp"
 
 #include <asio.hpp>
 #include <asio/io_service.hpp>
 #include <asio/ip/tcp.hpp>
-#include <asio/ssl/stream.hpp>
 
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -38,6 +45,46 @@ public:
      */
     using Ptr = std::shared_ptr<TLSSocket>;
 
+    /// Largest message sent synchronously by @c trySend.
+    static constexpr std::size_t maxSyncSendSize = 4 * 1024;
+
+    /**
+     * Native socket options.
+     */
+    enum class Option {
+        /// Size of outgoing TLS records; 0 sizes records dynamically.
+        recordSize,
+
+        /// Number of bytes requested from the socket by a single read.
+        readAhead,
+
+        /// Number of records encrypted before they're sent with one syscall.
+        writeWindow,
+
+        /// Number of worker tasks a write's records are encrypted by.
+        sealWorkers,
+
+        /// Whether received records are decrypted ahead of reads by a worker.
+        pipelinedRecv,
+
+        /// Whether record processing is offloaded to the kernel.
+        kernelTls,
+
+        /// Lower bound of the adaptive size of buffers for @c recvAnyAsync.
+        recvBufferMin,
+
+        /// Upper bound of the adaptive size of buffers for @c recvAnyAsync.
+        recvBufferMax
+    };
+
+    /**
+     * Runtime statistics of the socket.
+     */
+    struct Stats {
+        /// Buffer size currently suggested for @c recvAnyAsync.
+        std::size_t recvBuffer;
+    };
+
     /**
      * Constructor.
      * Prepares a new @c asio socket with a local @c ssl::context.
@@ -60,6 +107,25 @@ public:
      */
     TLSSocket(TLSApplication &app, std::shared_ptr<asio::ssl::context> context);
 
+    /**
+     * Constructor.
+     * Prepares a new @c asio socket with a given SSL context, placed on a
+     * given @c io_service.
+     * @param app @c TLSApplication object the @c io_service belongs to.
+     * @param ioService The @c io_service to run this object's asynchronous
+     * operations.
+     * @param acceptor a @c context handler to use for this socket's
+     * configuration.
+     */
+    TLSSocket(TLSApplication &app, asio::io_service &ioService,
+        std::shared_ptr<asio::ssl::context> context);
+
+    /**
+     * Destructor.
+     * Stops counting the socket in its @c io_service's load.
+     */
+    ~TLSSocket();
+
     /**
      * Asynchronously connects the socket to a remote service.
      * Calls success callback with @c self.
@@ -82,6 +148,33 @@ public:
     template <typename BufferSequence>
     void sendAsync(Ptr self, const BufferSequence &buffer, Callback<> callback);
 
+    /**
+     * Asynchronously sends a part of a file through the socket.
+     * The file is read and encrypted a write window at a time, so memory
+     * use doesn't depend on the length sent. If writes are offloaded to the
+     * kernel, the file is sent with @c sendfile instead, without copying
+     * it to userspace.
+     * Calls success callback with the number of bytes sent, which is less
+     * than requested if the file ends first.
+     * @param self Shared pointer to this.
+     * @param path Path of the file to send.
+     * @param offset Position in the file to start from.
+     * @param length Number of bytes to send; 0 sends the rest of the file.
+     * @param success Callback function to call on success.
+     * @param error Callback function to call on error.
+     */
+    void sendFileAsync(Ptr self, std::string path, const std::size_t offset,
+        const std::size_t length, Callback<std::size_t> callback);
+
+    /**
+     * @copydoc sendFileAsync(Ptr, std::string, const std::size_t, const
+     * std::size_t, Callback<std::size_t>)
+     * @param fd Descriptor of the file to send. The socket uses its own
+     * duplicate, so the caller may close @c fd at any time.
+     */
+    void sendFileAsync(Ptr self, const int fd, const std::size_t offset,
+        const std::size_t length, Callback<std::size_t> callback);
+
     /**
      * Asynchronously receives a message from the socket.
      * Calls success callback with @c buffer. Either all of the buffer will
@@ -107,6 +200,62 @@ public:
     void recvAnyAsync(Ptr self, asio::mutable_buffer buffer,
         Callback<asio::mutable_buffer> callback);
 
+    /**
+     * Suggests the size of a buffer for the next @c recvAnyAsync.
+     * The size follows a moving average of recent reads' sizes, bounded by
+     * @c Option::recvBufferMin and @c Option::recvBufferMax, so that
+     * sockets receiving small messages don't allocate large buffers.
+     * Safe to call from any thread.
+     * @returns The suggested buffer size.
+     */
+    std::size_t recvBufferSize() const;
+
+    /**
+     * After a receive, the I/O thread puts aside data that's already
+     * decrypted, so that the next receive can take it right away.
+     * Safe to call from any thread.
+     * @returns The number of bytes put aside.
+     */
+    std::size_t bufferedBytes() const;
+
+    /**
+     * Synchronously receives data put aside by the I/O thread, without
+     * waiting for the socket. Safe to call from any thread; gives up if the
+     * data is being used by the I/O thread at the moment.
+     * @param buffer Buffer to save the received data to.
+     * @param exact Whether to receive only if the whole buffer can be
+     * filled.
+     * @returns The number of bytes received.
+     */
+    std::size_t tryRecv(asio::mutable_buffer buffer, const bool exact);
+
+    /**
+     * Synchronously sends a small message, encrypting it on the calling
+     * thread. Safe to call from any thread, but not while another send is
+     * outstanding; gives up if the message is too large or the socket is in
+     * use by the I/O thread at the moment.
+     * If the message isn't sent whole, the rest is sent by @c sendAsync
+     * called with the same buffer.
+     * @param buffer Buffer with the message.
+     * @returns Whether the whole message was sent.
+     */
+    bool trySend(asio::const_buffer buffer);
+
+    /**
+     * Asynchronously receive packets of a given type from the socket.
+     * Calls success callback with all packets that could be decoded from the
+     * data received so far, which is at least one packet. The packets are
+     * only valid for the duration of the callback.
+     * @param self Shared pointer to this.
+     * @param type Type of packets to receive.
+     * @param maxSize Maximum size of a single packet, 0 for unlimited.
+     * @param success Callback function to call on success.
+     * @param error Callback function to call on error.
+     */
+    void recvPacketsAsync(Ptr self, const PacketDecoder::Type type,
+        const std::size_t maxSize,
+        Callback<const std::vector<PacketDecoder::Packet> &> callback);
+
     /**
      * Asynchronously perform a handshake for an incoming connection.
      * @param self Shared pointer to this.
@@ -151,6 +300,23 @@ public:
      */
     const std::vector<std::vector<unsigned char>> &certificateChain() const;
 
+    /**
+     * Asynchronously sets a native socket option.
+     * @param self Shared pointer to this.
+     * @param option The option to set.
+     * @param value The option's new value.
+     */
+    void setOptionAsync(Ptr self, const Option option, const std::size_t value);
+
+    /**
+     * Asynchronously retrieve runtime statistics of the socket.
+     * Calls success callback with the statistics.
+     * @param self Shared pointer to this.
+     * @param success Callback function to call on success.
+     * @param error Callback function to call on error.
+     */
+    void statsAsync(Ptr self, Callback<const Stats &> callback);
+
     /**
      * Asynchronously close the socket.
      * @param self Shared pointer to this.
@@ -159,36 +325,150 @@ public:
      */
     void closeAsync(Ptr self, Callback<> callback);
 
+    /**
+     * Marks the socket to be moved by @c rehomeAsync, when the application
+     * places sockets by scheduler. Used when the socket's controlling
+     * process changes.
+     */
+    void requestRehome();
+
+    /**
+     * Moves the socket to the @c io_service the application pairs with the
+     * calling thread, if a move was requested with @c requestRehome. A
+     * socket that's busy is left for a later call.
+     * @param self Shared pointer to this.
+     */
+    void rehomeAsync(Ptr self);
+
+    /**
+     * Asynchronously moves the socket to a given @c io_service, if it has
+     * no operation in progress other than waiting for data.
+     * Calls success callback with whether the socket was moved.
+     * @param self Shared pointer to this.
+     * @param ioService The @c io_service to move to, managed by the same
+     * @c TLSApplication.
+     * @param callback Callback to call when done.
+     */
+    void migrateAsync(
+        Ptr self, asio::io_service &ioService, Callback<bool> callback);
+
     void setVerifyMode(const asio::ssl::verify_mode mode) override;
 
 private:
     void saveChain(bool server);
 
+    void initRecordSizing();
+    void beginWrite();
+    std::size_t recordSize(const std::size_t transferred) const;
+    std::size_t nextRecordSize(const std::size_t transferred);
+    void endWrite(const std::size_t written);
+
+    void adaptRecvBuffer(const std::size_t read, const std::size_t size);
+    void updateRecvBufferSize();
+
+    void stashBuffered();
+    std::size_t takeStashed(asio::mutable_buffer buffer);
+    std::size_t unstash(asio::mutable_buffer buffer);
+
+    struct FileTransfer;
+    void sendFile(Ptr self, const int fd, const std::size_t offset,
+        std::size_t length, Callback<std::size_t> callback);
+    void sendFileChunk(Ptr self, std::shared_ptr<FileTransfer> transfer,
+        Callback<std::size_t> callback);
+
+    void decodePackets(Ptr self,
+        Callback<const std::vector<PacketDecoder::Packet> &> callback);
+
+    void connect(Ptr self, const std::error_code &ec1,
+        asio::ip::tcp::resolver::iterator iterator, Callback<Ptr> callback);
+
     std::vector<asio::ip::basic_resolver_entry<asio::ip::tcp>> shuffleEndpoints(
         asio::ip::tcp::resolver::iterator iterator);
 
-    asio::io_service &m_ioService;
-    asio::ip::tcp::resolver m_resolver;
-    asio::ssl::stream<asio::ip::tcp::socket> m_socket;
-    std::vector<std::vector<unsigned char>> m_certificateChain;
+    template <typename Handler> void submit(Handler &&handler);
+    IoLoad &ioLoad() const;
+    bool moveTo(asio::io_service &target);
+    bool shed();
+
+    TLSApplication &m_app;
+    // These are changed only by the thread running the socket, when the
+    // socket is moved to another io_service.
+    asio::io_service *m_ioService;
+    std::atomic<SubmissionQueue *> m_queue;
+    // Read also by trySend.
+    std::atomic<IoLoad *> m_load;
+    std::chrono::steady_clock::time_point m_placed;
+    std::atomic<bool> m_rehome{false};
+    detail::HandlerArena m_arena;
+    // Parts that accepted sockets usually don't need are created on demand,
+    // to keep the per-connection footprint small.
+    TLSStream m_socket;
+    std::unique_ptr<std::vector<std::vector<unsigned char>>>
+        m_certificateChain;
+    PacketDecoder m_decoder;
+
+    // Set by the I/O thread, read also by trySend.
+    std::atomic<std::size_t> m_recordSize{0};
+    std::size_t m_smallRecordSize;
+    std::size_t m_currentRecordSize = 0;
+    std::size_t m_sentSinceIdle = 0;
+    std::chrono::steady_clock::time_point m_lastWrite;
+
+    std::size_t m_recvBufferMin = 2 * 1024;
+    std::size_t m_recvBufferMax = 256 * 1024;
+    std::size_t m_recvEstimate = 8 * 1024;
+    std::atomic<std::size_t> m_recvBufferSize{16 * 1024};
+
+    // Decrypted data put aside after a receive. Only the I/O thread adds
+    // to it; the size is read without the lock to keep the fast path cheap
+    // when there's nothing to take.
+    std::mutex m_stashMutex;
+    BufferPool::Buffer m_stash;
+    std::size_t m_stashBegin = 0;
+    std::size_t m_stashEnd = 0;
+    std::atomic<std::size_t> m_stashed{0};
 };
 
 template <typename BufferSequence>
 void TLSSocket::sendAsync(
     Ptr self, const BufferSequence &buffers, Callback<> callback)
 {
-    asio::post(m_ioService, [
+    submit(m_arena.wrap([
         =, self = std::move(self), callback = std::move(callback)
     ]() mutable {
+        this->beginWrite();
         asio::async_write(m_socket, buffers,
-            [ =, self = std::move(self), callback = std::move(callback) ](
-                              const auto ec, const auto read) {
+            [this](const std::error_code &ec, const std::size_t transferred) {
+                return ec ? 0 : this->nextRecordSize(transferred) *
+                        m_socket.writeWindow();
+            },
+            m_arena.wrap([
+                =, self = std::move(self), callback = std::move(callback)
+            ](const auto ec, const auto written) {
+                this->endWrite(written);
                 if (ec)
                     callback(ec);
                 else
                     callback();
-            });
-    });
+            }));
+    }));
+}
+
+template <typename Handler> void TLSSocket::submit(Handler &&handler)
+{
+    // An operation submitted while the socket was being moved is passed on
+    // to the new io_service. The socket's thread may also move it before
+    // the operation starts, when it's asked to shed sockets.
+    auto queue = m_queue.load(std::memory_order_acquire);
+    queue->submit(m_arena.wrap([
+        this, queue, handler = std::forward<Handler>(handler)
+    ]() mutable {
+        if (m_queue.load(std::memory_order_acquire) != queue ||
+            this->shed())
+            this->submit(std::move(handler));
+        else
+            handler();
+    }));
 }
 
 } // namespace etls
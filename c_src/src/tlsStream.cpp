@@ -0,0 +1,1284 @@
+/**
+ * @file tlsStream.cpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#include "tlsStream.hpp"
+
+#include "detail.hpp"
+#include "submissionQueue.hpp"
+
+#include <asio/error.hpp>
+#include <asio/ssl/error.hpp>
+#include <ssl/internal.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/tls.h>
+#include <sys/epoll.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+
+namespace {
+
+int clampSize(const std::size_t size)
+{
+    return static_cast<int>(std::min<std::size_t>(size, INT_MAX));
+}
+
+bool wouldBlock(const int error)
+{
+    return error == EAGAIN || error == EWOULDBLOCK || error == EINTR;
+}
+
+long bioCtrl(BIO *, int cmd, long, void *)
+{
+    return cmd == BIO_CTRL_FLUSH ? 1 : 0;
+}
+
+std::uint64_t loadSequence(const std::uint8_t *sequence)
+{
+    std::uint64_t value = 0;
+    for (int i = 0; i < 8; ++i)
+        value = (value << 8) | sequence[i];
+
+    return value;
+}
+
+void storeSequence(std::uint64_t value, std::uint8_t *sequence)
+{
+    for (int i = 7; i >= 0; --i, value >>= 8)
+        sequence[i] = static_cast<std::uint8_t>(value);
+}
+
+// Explicit or sequence-derived nonces make AEAD records independent of each
+// other; CBC and stream ciphers carry state between records.
+bool isIndependent(const SSL *ssl, const SSL_AEAD_CTX *aead)
+{
+    return !SSL_in_init(ssl) && aead && !ssl->s3->short_header &&
+        ssl3_protocol_version(ssl) == TLS1_2_VERSION &&
+        (SSL_CIPHER_is_AESGCM(aead->cipher) ||
+            SSL_CIPHER_is_CHACHA20POLY1305(aead->cipher));
+}
+
+#ifdef __linux__
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+template <typename CryptoInfo>
+socklen_t fillCryptoInfo(CryptoInfo &info, const unsigned short cipher,
+    const std::uint8_t *key, const std::uint8_t *salt,
+    const std::uint8_t *sequence)
+{
+    info.info.version = TLS_1_2_VERSION;
+    info.info.cipher_type = cipher;
+    std::memcpy(info.key, key, sizeof(info.key));
+    std::memcpy(info.salt, salt, sizeof(info.salt));
+    std::memcpy(info.iv, sequence, sizeof(info.iv));
+    std::memcpy(info.rec_seq, sequence, sizeof(info.rec_seq));
+    return sizeof(info);
+}
+#endif
+
+constexpr std::size_t pipelineChunks = 4;
+constexpr std::size_t minPipelineChunkSize = 64 * 1024;
+
+} // namespace
+
+namespace one {
+namespace etls {
+
+/**
+ * State of a pipelined receive. It's shared with the pipeline's background
+ * work, which may outlive the stream; the stream pointer is guarded by
+ * @c mutex. Apart from the chunk being decrypted, the state is only
+ * accessed on the stream's I/O thread.
+ */
+struct TLSStream::Pipeline {
+    struct Chunk {
+        Chunk(const std::size_t bytes)
+            : data{new std::uint8_t[bytes]}
+            , capacity{bytes}
+        {
+        }
+
+        /// Decrypts the chunk's records until one can't be opened.
+        void open(SSL *ssl)
+        {
+            const auto aead = ssl->s3->aead_read_ctx;
+            const auto records = data.get();
+
+            opened = 0;
+            failedAt = 0;
+            while (failedAt < size) {
+                const auto record = records + failedAt;
+                const std::uint16_t version = (record[1] << 8) | record[2];
+                const std::size_t length = (record[3] << 8) | record[4];
+                if (record[0] != SSL3_RT_APPLICATION_DATA ||
+                    version != ssl->version ||
+                    failedAt + SSL3_RT_HEADER_LENGTH + length > size)
+                    break;
+
+                std::uint8_t seq[8];
+                storeSequence(sequence + opened, seq);
+
+                CBS out;
+                if (!SSL_AEAD_CTX_open(aead, &out, record[0], version, seq,
+                        record + SSL3_RT_HEADER_LENGTH, length) ||
+                    CBS_len(&out) == 0 ||
+                    CBS_len(&out) > SSL3_RT_MAX_PLAIN_LENGTH)
+                    break;
+
+                plaintext.emplace_back(CBS_data(&out), CBS_len(&out));
+                failedAt += SSL3_RT_HEADER_LENGTH + length;
+                ++opened;
+            }
+        }
+
+        std::unique_ptr<std::uint8_t[]> data;
+        std::size_t capacity;
+
+        /// Number of bytes received into the chunk.
+        std::size_t size = 0;
+
+        /// Sequence number of the first record.
+        std::uint64_t sequence = 0;
+
+        /// Decrypted records, filled in by a worker.
+        std::vector<asio::const_buffer> plaintext;
+        std::size_t opened = 0;
+        std::size_t failedAt = 0;
+
+        /// Position of data not yet delivered to a reader.
+        std::size_t next = 0;
+        std::size_t offset = 0;
+    };
+
+    Pipeline(TLSStream &s)
+        : stream{&s}
+    {
+    }
+
+    std::shared_timed_mutex mutex;
+    TLSStream *stream;
+    bool stopped = false;
+
+    std::size_t chunkSize = 0;
+    std::size_t allocated = 0;
+    std::vector<std::unique_ptr<Chunk>> spare;
+    std::unique_ptr<Chunk> filling;
+
+    /// Chunks of complete records, in order. The first @c decrypted ones
+    /// are ready to be delivered.
+    std::deque<std::unique_ptr<Chunk>> chunks;
+    std::size_t decrypted = 0;
+    bool busy = false;
+    bool failed = false;
+
+    std::uint64_t sequence = 0;
+    bool waiting = false;
+    bool eof = false;
+    std::error_code error;
+};
+
+TLSStream::TLSStream(asio::io_service &ioService, asio::ssl::context &context)
+    : m_socket{ioService}
+    , m_ssl{SSL_new(context.native_handle()), SSL_free}
+{
+    if (!m_ssl)
+        throw std::system_error{static_cast<int>(ERR_get_error()),
+            asio::error::get_ssl_category(), "SSL_new"};
+
+    SSL_set_mode(m_ssl.get(), SSL_MODE_ENABLE_PARTIAL_WRITE);
+    SSL_set_mode(m_ssl.get(), SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    SSL_set_mode(m_ssl.get(), SSL_MODE_RELEASE_BUFFERS);
+}
+
+TLSStream::~TLSStream()
+{
+    if (m_pipeline) {
+        std::lock_guard<std::shared_timed_mutex> guard{m_pipeline->mutex};
+        m_pipeline->stream = nullptr;
+    }
+}
+
+TLSStream::lowest_layer_type &TLSStream::lowest_layer() { return m_socket; }
+
+SSL *TLSStream::native_handle() { return m_ssl.get(); }
+
+void TLSStream::set_verify_mode(const asio::ssl::verify_mode mode)
+{
+    SSL_set_verify(m_ssl.get(), mode, SSL_get_verify_callback(m_ssl.get()));
+}
+
+void TLSStream::setReadAhead(const std::size_t size) { m_readAhead = size; }
+
+void TLSStream::setWriteWindow(const std::size_t records)
+{
+    m_writeWindow = std::max<std::size_t>(records, 1);
+}
+
+std::size_t TLSStream::writeWindow() const
+{
+    return m_writeWindow * std::max<std::size_t>(m_sealWorkers, 1);
+}
+
+void TLSStream::setPipelined(asio::io_service *service)
+{
+    m_pipelineService = service;
+}
+
+void TLSStream::setKernelOffload(const bool enabled) { m_offload = enabled; }
+
+bool TLSStream::offloadWrites() { return m_kernelTx || tryOffload(true); }
+
+bool TLSStream::hasBuffered() const
+{
+    return !m_pipeline && !m_kernelRx && !m_readError &&
+        (SSL_pending(m_ssl.get()) > 0 || m_readBegin != m_readEnd);
+}
+
+std::size_t TLSStream::readBuffered(const asio::mutable_buffer &buffer)
+{
+    std::lock_guard<std::mutex> guard{m_engineMutex};
+    if (!hasBuffered())
+        return 0;
+
+    const auto data = asio::buffer_cast<char *>(buffer);
+    const auto size = asio::buffer_size(buffer);
+
+    std::size_t transferred = 0;
+    while (transferred < size &&
+        (SSL_pending(m_ssl.get()) > 0 || m_readBegin != m_readEnd)) {
+        std::error_code ec;
+        std::size_t read = 0;
+        ERR_clear_error();
+        const auto want = complete(
+            SSL_read(m_ssl.get(), data + transferred,
+                clampSize(size - transferred)),
+            ec, read);
+
+        transferred += read;
+        if (ec)
+            m_readError = ec;
+
+        if (ec || want != Want::nothing)
+            break;
+    }
+
+    return transferred;
+}
+
+bool TLSStream::tryWrite(
+    const asio::const_buffer &buffer, const std::size_t recordSize)
+{
+    const auto data = asio::buffer_cast<const char *>(buffer);
+    const auto size = asio::buffer_size(buffer);
+
+    std::unique_lock<std::mutex> lock{m_engineMutex, std::try_to_lock};
+    if (!lock.owns_lock() || size == 0 || !m_socket.is_open() ||
+        !SSL_is_init_finished(m_ssl.get()) || m_offload || m_kernelTx ||
+        m_pipeline || m_sealing || m_sealPending > 0 || m_writeError ||
+        m_writeBegin != m_writeEnd || m_written > 0)
+        return false;
+
+    SSL_set_max_send_fragment(m_ssl.get(), recordSize);
+
+    m_staging = true;
+    while (m_written < size) {
+        std::error_code ec;
+        std::size_t written = 0;
+        ERR_clear_error();
+        const auto want = complete(
+            SSL_write(m_ssl.get(), data + m_written,
+                clampSize(size - m_written)),
+            ec, written);
+
+        m_written += written;
+        if (ec || want != Want::nothing)
+            break;
+    }
+    m_staging = false;
+
+    // Whatever isn't sent here is left to the write that follows.
+    std::error_code ec;
+    if (flush(ec) != Want::nothing || m_written < size) {
+        if (ec)
+            m_writeError = ec;
+
+        return false;
+    }
+
+    if (ec) {
+        m_writeError = ec;
+        return false;
+    }
+
+    m_written = 0;
+    return true;
+}
+
+void TLSStream::close(std::error_code &ec)
+{
+    std::lock_guard<std::mutex> guard{m_engineMutex};
+    m_socket.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+    m_socket.close(ec);
+}
+
+bool TLSStream::rebind(asio::io_service &ioService)
+{
+#ifdef __linux__
+    std::lock_guard<std::mutex> guard{m_engineMutex};
+    const auto reactor =
+        detail::reactorDescriptor(m_socket.get_io_context());
+
+    if (reactor < 0 || !m_socket.is_open() ||
+        !SSL_is_init_finished(m_ssl.get()) || m_operations != m_waits ||
+        m_resuming > 0 || m_offload || m_pipeline || m_sealing ||
+        m_sealPending > 0)
+        return false;
+
+    // asio can't hand a descriptor over, so the socket is reopened on the
+    // new io_service from a duplicate.
+    std::error_code ec;
+    const auto protocol = m_socket.local_endpoint(ec).protocol();
+    const auto fd = ec ? -1 : ::dup(m_socket.native_handle());
+    if (fd < 0)
+        return false;
+
+    lowest_layer_type socket{ioService};
+    socket.assign(protocol, fd, ec);
+    if (ec) {
+        ::close(fd);
+        return false;
+    }
+
+    socket.non_blocking(true, ec);
+    if (ec)
+        return false;
+
+    // asio leaves a closed descriptor for the kernel to remove from the
+    // epoll set, which it doesn't do while a duplicate is open.
+    epoll_event event{};
+    ::epoll_ctl(reactor, EPOLL_CTL_DEL, m_socket.native_handle(), &event);
+
+    m_generation.fetch_add(1);
+    m_resuming = m_waits;
+    m_socket.close(ec);
+    m_socket = std::move(socket);
+    return true;
+#else
+    static_cast<void>(ioService);
+    return false;
+#endif
+}
+
+void TLSStream::setSealWorkers(
+    asio::io_service &service, const std::size_t workers)
+{
+    m_sealService = &service;
+    m_sealWorkers = workers;
+}
+
+TLSStream::Want TLSStream::handshake(
+    const asio::ssl::stream_base::handshake_type type, std::error_code &ec)
+{
+    if (!SSL_get_rbio(m_ssl.get())) {
+        // The engine talks to the socket directly, without blocking.
+        m_socket.non_blocking(true, ec);
+        if (ec)
+            return Want::nothing;
+
+        auto bio = BIO_new(bioMethod());
+        if (!bio) {
+            ec = {static_cast<int>(ERR_get_error()),
+                asio::error::get_ssl_category()};
+            return Want::nothing;
+        }
+
+        bio->ptr = this;
+        bio->init = 1;
+        SSL_set_bio(m_ssl.get(), bio, bio);
+
+        if (type == asio::ssl::stream_base::client)
+            SSL_set_connect_state(m_ssl.get());
+        else
+            SSL_set_accept_state(m_ssl.get());
+    }
+
+    ERR_clear_error();
+    std::size_t transferred;
+    return complete(SSL_do_handshake(m_ssl.get()), ec, transferred);
+}
+
+TLSStream::Want TLSStream::read(const asio::mutable_buffer &buffer,
+    std::error_code &ec, std::size_t &transferred)
+{
+    const auto data = asio::buffer_cast<char *>(buffer);
+    const auto size = asio::buffer_size(buffer);
+    if (size == 0)
+        return Want::nothing;
+
+    if (m_readError) {
+        ec = m_readError;
+        m_readError = {};
+        return Want::nothing;
+    }
+
+    if (m_kernelRx || tryOffload(false))
+        return readKernel(data, size, ec, transferred);
+
+    if (!m_pipeline && canPipeline())
+        startPipeline();
+
+    if (m_pipeline) {
+        const auto want = readPipelined(data, size, ec, transferred);
+        if (m_pipeline || transferred > 0)
+            return want;
+    }
+
+    // Keep decrypting while there are records left in the engine or in the
+    // read-ahead buffer, instead of going back to the reactor after each one.
+    transferred = 0;
+    while (true) {
+        std::size_t read = 0;
+        ERR_clear_error();
+        const auto want = complete(
+            SSL_read(m_ssl.get(), data + transferred,
+                clampSize(size - transferred)),
+            ec, read);
+
+        transferred += read;
+
+        if (transferred > 0 && (ec || want != Want::nothing)) {
+            m_readError = ec;
+            ec = {};
+            return Want::nothing;
+        }
+
+        if (ec || want != Want::nothing || transferred == size ||
+            (SSL_pending(m_ssl.get()) == 0 && m_readBegin == m_readEnd))
+            return want;
+    }
+}
+
+TLSStream::Want TLSStream::write(const asio::const_buffer &buffer,
+    std::error_code &ec, std::size_t &transferred)
+{
+    const auto data = asio::buffer_cast<const char *>(buffer);
+    const auto size = asio::buffer_size(buffer);
+    if (size == 0)
+        return Want::nothing;
+
+    if (m_writeError) {
+        ec = m_writeError;
+        m_writeError = {};
+        return Want::nothing;
+    }
+
+    if (m_kernelTx || tryOffload(true))
+        return writeKernel(data, size, ec, transferred);
+
+    if (m_sealing) {
+        m_sealing = false;
+    }
+    else if (m_writeBegin == m_writeEnd &&
+        canSealInParallel(size - m_written)) {
+        if (sealInParallel(data + m_written, size - m_written) ==
+            Want::sealing) {
+            m_sealing = true;
+            return Want::sealing;
+        }
+    }
+    // Encrypt a window of records, then send them all at once. With partial
+    // writes enabled, each SSL_write produces a single record.
+    else if (m_writeBegin == m_writeEnd) {
+        m_staging = true;
+        for (std::size_t records = 0;
+             records < m_writeWindow && m_written < size; ++records) {
+            std::size_t written = 0;
+            ERR_clear_error();
+            const auto want = complete(
+                SSL_write(m_ssl.get(), data + m_written,
+                    clampSize(size - m_written)),
+                ec, written);
+
+            m_written += written;
+            if (ec || want != Want::nothing) {
+                m_staging = false;
+                if (m_written == 0) {
+                    m_writeEnd = 0;
+                    m_writeBuffer.reset();
+                    return want;
+                }
+
+                m_writeError = ec;
+                ec = {};
+                break;
+            }
+        }
+        m_staging = false;
+    }
+
+    if (m_sealFailed) {
+        m_sealFailed = false;
+        ec = std::make_error_code(std::errc::io_error);
+        m_writeBegin = m_writeEnd = m_written = 0;
+        m_writeBuffer.reset();
+        return Want::nothing;
+    }
+
+    const auto want = flush(ec);
+    if (want != Want::nothing || ec)
+        return want;
+
+    transferred = m_written;
+    m_written = 0;
+    return Want::nothing;
+}
+
+TLSStream::Want TLSStream::flush(std::error_code &ec)
+{
+    while (m_writeBegin < m_writeEnd) {
+        const auto result = ::send(m_socket.native_handle(),
+            m_writeBuffer.data() + m_writeBegin, m_writeEnd - m_writeBegin,
+            MSG_NOSIGNAL);
+
+        if (result < 0) {
+            if (wouldBlock(errno))
+                return Want::write;
+
+            ec = {errno, std::system_category()};
+            m_writeBegin = m_writeEnd = m_written = 0;
+            m_writeBuffer.reset();
+            return Want::nothing;
+        }
+
+        m_writeBegin += static_cast<std::size_t>(result);
+    }
+
+    m_writeBegin = m_writeEnd = 0;
+    m_writeBuffer.reset();
+    return Want::nothing;
+}
+
+bool TLSStream::tryOffload(const bool transmit)
+{
+    const auto ssl = m_ssl.get();
+    if (!m_offload || SSL_in_init(ssl))
+        return false;
+
+    // Records already taken off the socket, or encrypted but not yet sent,
+    // would be out of sequence with the kernel's.
+    const bool idle = transmit
+        ? m_writeBegin == m_writeEnd && m_written == 0 && !m_sealing &&
+            ssl->s3->send_shutdown == ssl_shutdown_none &&
+            !ssl_write_buffer_is_pending(ssl)
+        : !m_pipeline && m_readBegin == m_readEnd &&
+            ssl->s3->recv_shutdown == ssl_shutdown_none &&
+            SSL_pending(ssl) == 0 && ssl_read_buffer_len(ssl) == 0;
+
+    if (!idle)
+        return false;
+
+    // A failure means the kernel or the cipher doesn't support offloading,
+    // so it's not retried.
+    if (!enableKernelTLS(transmit)) {
+        m_offload = false;
+        return false;
+    }
+
+    (transmit ? m_kernelTx : m_kernelRx) = true;
+    return true;
+}
+
+bool TLSStream::enableKernelTLS(const bool transmit)
+{
+#ifdef __linux__
+    const auto ssl = m_ssl.get();
+    const auto aead =
+        transmit ? ssl->s3->aead_write_ctx : ssl->s3->aead_read_ctx;
+    const auto &tmp = ssl->s3->tmp;
+
+    if (!isIndependent(ssl, aead) || !SSL_CIPHER_is_AESGCM(aead->cipher) ||
+        tmp.new_mac_secret_len != 0 ||
+        tmp.new_fixed_iv_len != TLS_CIPHER_AES_GCM_128_SALT_SIZE)
+        return false;
+
+    // The key block holds the client's and the server's write keys,
+    // followed by their implicit nonces.
+    std::uint8_t keyBlock[2 *
+        (TLS_CIPHER_AES_GCM_256_KEY_SIZE + TLS_CIPHER_AES_GCM_256_SALT_SIZE)];
+    const auto keyBlockLen = SSL_get_key_block_len(ssl);
+    if (keyBlockLen > sizeof(keyBlock) ||
+        !SSL_generate_key_block(ssl, keyBlock, keyBlockLen))
+        return false;
+
+    const std::size_t keyLen = tmp.new_key_len;
+    const bool clientKeys = transmit == !ssl->server;
+    const auto key = keyBlock + (clientKeys ? 0 : keyLen);
+    const auto salt = keyBlock + 2 * keyLen +
+        (clientKeys ? 0 : TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+    const auto sequence =
+        transmit ? ssl->s3->write_sequence : ssl->s3->read_sequence;
+
+    union {
+        tls12_crypto_info_aes_gcm_128 aes128;
+        tls12_crypto_info_aes_gcm_256 aes256;
+    } info;
+    std::memset(&info, 0, sizeof(info));
+
+    socklen_t infoLen = 0;
+    if (keyLen == TLS_CIPHER_AES_GCM_128_KEY_SIZE)
+        infoLen = fillCryptoInfo(
+            info.aes128, TLS_CIPHER_AES_GCM_128, key, salt, sequence);
+    else if (keyLen == TLS_CIPHER_AES_GCM_256_KEY_SIZE)
+        infoLen = fillCryptoInfo(
+            info.aes256, TLS_CIPHER_AES_GCM_256, key, salt, sequence);
+
+    OPENSSL_cleanse(keyBlock, sizeof(keyBlock));
+
+    const auto fd = m_socket.native_handle();
+    if (infoLen > 0 && !m_tlsUlp &&
+        ::setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == 0)
+        m_tlsUlp = true;
+
+    const auto result = infoLen > 0 && m_tlsUlp &&
+        ::setsockopt(fd, SOL_TLS, transmit ? TLS_TX : TLS_RX, &info,
+            infoLen) == 0;
+
+    OPENSSL_cleanse(&info, sizeof(info));
+    return result;
+#else
+    (void)transmit;
+    return false;
+#endif
+}
+
+TLSStream::Want TLSStream::readKernel(char *data, const std::size_t size,
+    std::error_code &ec, std::size_t &transferred)
+{
+#ifdef __linux__
+    iovec iov{data, size};
+    char control[CMSG_SPACE(sizeof(unsigned char))];
+
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    const auto result = ::recvmsg(m_socket.native_handle(), &message, 0);
+    if (result < 0) {
+        if (wouldBlock(errno))
+            return Want::read;
+
+        ec = {errno, std::system_category()};
+        return Want::nothing;
+    }
+
+    if (result == 0) {
+        ec = asio::ssl::error::stream_truncated;
+        return Want::nothing;
+    }
+
+    // The kernel reports the type of records other than application data;
+    // after the handshake that can only be an alert.
+    const auto cmsg = CMSG_FIRSTHDR(&message);
+    if (cmsg && cmsg->cmsg_level == SOL_TLS &&
+        cmsg->cmsg_type == TLS_GET_RECORD_TYPE &&
+        *CMSG_DATA(cmsg) != SSL3_RT_APPLICATION_DATA) {
+        if (*CMSG_DATA(cmsg) == SSL3_RT_ALERT && result == 2 &&
+            data[1] == SSL_AD_CLOSE_NOTIFY)
+            ec = asio::error::eof;
+        else
+            ec = asio::error::connection_aborted;
+
+        return Want::nothing;
+    }
+
+    transferred = static_cast<std::size_t>(result);
+    return Want::nothing;
+#else
+    (void)data;
+    (void)size;
+    (void)ec;
+    (void)transferred;
+    return Want::nothing;
+#endif
+}
+
+TLSStream::Want TLSStream::writeKernel(const char *data,
+    const std::size_t size, std::error_code &ec, std::size_t &transferred)
+{
+    const auto result =
+        ::send(m_socket.native_handle(), data, size, MSG_NOSIGNAL);
+
+    if (result < 0) {
+        if (wouldBlock(errno))
+            return Want::write;
+
+        ec = {errno, std::system_category()};
+        return Want::nothing;
+    }
+
+    transferred = static_cast<std::size_t>(result);
+    return Want::nothing;
+}
+
+TLSStream::Want TLSStream::complete(
+    const int result, std::error_code &ec, std::size_t &transferred)
+{
+    // Errors are mapped the same way as asio::ssl::stream's, so that clients
+    // can tell apart a clean shutdown from a truncated stream.
+    switch (SSL_get_error(m_ssl.get(), result)) {
+        case SSL_ERROR_NONE:
+            transferred = static_cast<std::size_t>(result);
+            return Want::nothing;
+
+        case SSL_ERROR_WANT_READ:
+            return Want::read;
+
+        case SSL_ERROR_WANT_WRITE:
+            return Want::write;
+
+        case SSL_ERROR_ZERO_RETURN:
+            ec = asio::error::eof;
+            return Want::nothing;
+
+        case SSL_ERROR_SYSCALL: {
+            const auto error = ERR_get_error();
+            if (error)
+                ec = {ERR_GET_REASON(error), std::system_category()};
+            else if (result < 0 && errno)
+                ec = {errno, std::system_category()};
+            else
+                ec = asio::ssl::error::stream_truncated;
+
+            return Want::nothing;
+        }
+
+        default:
+            ec = {static_cast<int>(ERR_get_error()),
+                asio::error::get_ssl_category()};
+            return Want::nothing;
+    }
+}
+
+bool TLSStream::canSealInParallel(const std::size_t size) const
+{
+    const auto ssl = m_ssl.get();
+    if (m_sealWorkers < 2 || !m_sealService || size <= ssl->max_send_fragment)
+        return false;
+
+    return isIndependent(ssl, ssl->s3->aead_write_ctx) &&
+        ssl->s3->send_shutdown == ssl_shutdown_none &&
+        !ssl_write_buffer_is_pending(ssl);
+}
+
+TLSStream::Want TLSStream::sealInParallel(
+    const char *data, const std::size_t size)
+{
+    const auto ssl = m_ssl.get();
+    const std::size_t fragment = ssl->max_send_fragment;
+    const auto overhead = SSL3_RT_HEADER_LENGTH +
+        SSL_AEAD_CTX_max_overhead(ssl->s3->aead_write_ctx);
+
+    const auto records =
+        std::min(writeWindow(), (size + fragment - 1) / fragment);
+    const auto bytes = std::min(size, records * fragment);
+    const auto perTask = (records + m_sealWorkers - 1) / m_sealWorkers;
+    const auto tasks = (records + perTask - 1) / perTask;
+
+    // Reserve sequence numbers of all records before sealing any of them.
+    // A wrapped sequence would reuse nonces, so the write fails instead,
+    // leaving the sequence as it is.
+    const auto sequence = loadSequence(ssl->s3->write_sequence);
+    if (sequence + records < sequence) {
+        m_sealFailed = true;
+        return Want::nothing;
+    }
+
+    storeSequence(sequence + records, ssl->s3->write_sequence);
+
+    reserveWrite(bytes + records * overhead);
+
+    m_writeBegin = 0;
+    m_writeEnd = bytes + records * overhead;
+    m_written += bytes;
+    m_sealPending = tasks;
+
+    for (std::size_t task = 1; task < tasks; ++task) {
+        const auto first = task * perTask;
+        const auto last = std::min(records, first + perTask);
+        asio::post(*m_sealService, [=] {
+            this->sealRecords(data, bytes, first, last, sequence);
+            // Submitted rather than posted, so that a polled io_service is
+            // woken up as well.
+            if (--m_sealPending == 0)
+                asio::use_service<SubmissionQueue>(m_socket.get_io_context())
+                    .submit([this] { this->sealed(); });
+        });
+    }
+
+    sealRecords(data, bytes, 0, std::min(records, perTask), sequence);
+    return --m_sealPending == 0 ? Want::nothing : Want::sealing;
+}
+
+void TLSStream::sealRecords(const char *data, const std::size_t size,
+    const std::size_t first, const std::size_t last,
+    const std::uint64_t sequence)
+{
+    const auto ssl = m_ssl.get();
+    const auto aead = ssl->s3->aead_write_ctx;
+    const std::size_t fragment = ssl->max_send_fragment;
+    const auto overhead =
+        SSL3_RT_HEADER_LENGTH + SSL_AEAD_CTX_max_overhead(aead);
+
+    for (auto i = first; i < last; ++i) {
+        const auto in = reinterpret_cast<const std::uint8_t *>(data) +
+            i * fragment;
+        const auto inLen = std::min(fragment, size - i * fragment);
+        const auto out = reinterpret_cast<std::uint8_t *>(
+                             m_writeBuffer.data()) +
+            i * (fragment + overhead);
+
+        std::uint8_t seq[8];
+        storeSequence(sequence + i, seq);
+
+        std::size_t outLen = 0;
+        if (!SSL_AEAD_CTX_seal(aead, out + SSL3_RT_HEADER_LENGTH, &outLen,
+                inLen + overhead - SSL3_RT_HEADER_LENGTH,
+                SSL3_RT_APPLICATION_DATA, ssl->version, seq, in, inLen) ||
+            outLen != inLen + overhead - SSL3_RT_HEADER_LENGTH) {
+            m_sealFailed = true;
+            return;
+        }
+
+        out[0] = SSL3_RT_APPLICATION_DATA;
+        out[1] = static_cast<std::uint8_t>(ssl->version >> 8);
+        out[2] = static_cast<std::uint8_t>(ssl->version);
+        out[3] = static_cast<std::uint8_t>(outLen >> 8);
+        out[4] = static_cast<std::uint8_t>(outLen);
+    }
+}
+
+void TLSStream::sealed()
+{
+    auto resume = std::move(m_sealResume);
+    m_sealResume = nullptr;
+    resume();
+}
+
+bool TLSStream::canPipeline() const
+{
+    const auto ssl = m_ssl.get();
+
+    // The engine mustn't hold any data the pipeline would skip over.
+    return m_pipelineService && m_readBegin == m_readEnd &&
+        isIndependent(ssl, ssl->s3->aead_read_ctx) &&
+        ssl->s3->recv_shutdown == ssl_shutdown_none &&
+        SSL_pending(ssl) == 0 && ssl_read_buffer_len(ssl) == 0;
+}
+
+void TLSStream::startPipeline()
+{
+    m_pipeline = std::make_shared<Pipeline>(*this);
+    m_pipeline->chunkSize = std::max(m_readAhead, minPipelineChunkSize);
+    m_pipeline->sequence = loadSequence(m_ssl->s3->read_sequence);
+    pumpPipeline();
+}
+
+void TLSStream::stopPipeline()
+{
+    auto &p = *m_pipeline;
+
+    // Ciphertext that wasn't decrypted is handed back to the engine, which
+    // continues from the first record it hasn't seen.
+    auto sequence = p.sequence;
+    std::size_t size = p.filling ? p.filling->size : 0;
+    for (const auto &chunk : p.chunks)
+        size += chunk->size;
+
+    if (!p.chunks.empty()) {
+        const auto &front = *p.chunks.front();
+        sequence = front.sequence + front.opened;
+        size -= front.failedAt;
+    }
+
+    if (size > 0)
+        m_readBuffer = BufferPool::instance().borrow(size);
+
+    m_readBegin = m_readEnd = 0;
+    for (std::size_t i = 0; i < p.chunks.size(); ++i) {
+        const auto &chunk = *p.chunks[i];
+        const auto begin = i == 0 ? chunk.failedAt : 0;
+        std::memcpy(m_readBuffer.data() + m_readEnd, chunk.data.get() + begin,
+            chunk.size - begin);
+        m_readEnd += chunk.size - begin;
+    }
+
+    if (p.filling) {
+        std::memcpy(m_readBuffer.data() + m_readEnd, p.filling->data.get(),
+            p.filling->size);
+        m_readEnd += p.filling->size;
+    }
+
+    storeSequence(sequence, m_ssl->s3->read_sequence);
+    p.stopped = true;
+    m_pipeline.reset();
+}
+
+TLSStream::Want TLSStream::readPipelined(char *data, const std::size_t size,
+    std::error_code &ec, std::size_t &transferred)
+{
+    auto &p = *m_pipeline;
+
+    transferred = 0;
+    while (transferred < size && p.decrypted > 0) {
+        auto &chunk = *p.chunks.front();
+        if (chunk.next < chunk.plaintext.size()) {
+            const auto &record = chunk.plaintext[chunk.next];
+            const auto n = std::min(size - transferred,
+                asio::buffer_size(record) - chunk.offset);
+
+            std::memcpy(data + transferred,
+                asio::buffer_cast<const char *>(record) + chunk.offset, n);
+
+            transferred += n;
+            chunk.offset += n;
+            if (chunk.offset == asio::buffer_size(record)) {
+                ++chunk.next;
+                chunk.offset = 0;
+            }
+            continue;
+        }
+
+        if (chunk.failedAt != chunk.size) {
+            stopPipeline();
+            return Want::nothing;
+        }
+
+        chunk.size = chunk.next = chunk.offset = 0;
+        chunk.plaintext.clear();
+        p.spare.emplace_back(std::move(p.chunks.front()));
+        p.chunks.pop_front();
+        --p.decrypted;
+    }
+
+    if (!m_pipelineService && p.chunks.empty() && !p.busy) {
+        stopPipeline();
+        return Want::nothing;
+    }
+
+    pumpPipeline();
+
+    if (transferred > 0)
+        return Want::nothing;
+
+    if (p.chunks.empty() && (p.eof || p.error)) {
+        ec = p.error ? p.error : asio::ssl::error::stream_truncated;
+        return Want::nothing;
+    }
+
+    return Want::decrypting;
+}
+
+void TLSStream::pumpPipeline()
+{
+    auto &p = *m_pipeline;
+
+    while (m_pipelineService && !p.waiting && !p.eof && !p.error) {
+        handOver();
+
+        if (!p.filling) {
+            if (p.spare.empty() && p.allocated == pipelineChunks)
+                break;
+
+            if (!p.spare.empty()) {
+                p.filling = std::move(p.spare.back());
+                p.spare.pop_back();
+            }
+            else {
+                p.filling = std::make_unique<Pipeline::Chunk>(p.chunkSize);
+                ++p.allocated;
+            }
+        }
+
+        auto &chunk = *p.filling;
+        if (chunk.size == chunk.capacity)
+            break;
+
+        const auto result = ::recv(m_socket.native_handle(),
+            chunk.data.get() + chunk.size, chunk.capacity - chunk.size, 0);
+
+        if (result > 0) {
+            chunk.size += static_cast<std::size_t>(result);
+        }
+        else if (result == 0) {
+            p.eof = true;
+        }
+        else if (wouldBlock(errno)) {
+            p.waiting = true;
+            m_socket.async_wait(asio::socket_base::wait_read,
+                [pipeline = m_pipeline](const std::error_code &ec) {
+                    std::function<void()> resume;
+                    {
+                        std::shared_lock<std::shared_timed_mutex> lock{
+                            pipeline->mutex};
+                        if (!pipeline->stream || pipeline->stopped)
+                            return;
+
+                        pipeline->waiting = false;
+                        if (ec)
+                            pipeline->error = ec;
+                        else
+                            pipeline->stream->pumpPipeline();
+
+                        resume = pipeline->stream->takeReader();
+                    }
+
+                    if (resume)
+                        resume();
+                });
+        }
+        else {
+            p.error = {errno, std::system_category()};
+        }
+    }
+
+    handOver();
+    decryptNext();
+}
+
+void TLSStream::handOver()
+{
+    auto &p = *m_pipeline;
+    if (!p.filling)
+        return;
+
+    auto &chunk = *p.filling;
+    const auto data = chunk.data.get();
+
+    std::size_t end = 0;
+    std::size_t records = 0;
+    while (end + SSL3_RT_HEADER_LENGTH <= chunk.size) {
+        const std::size_t length = (data[end + 3] << 8) | data[end + 4];
+
+        // A record that can't be valid is left for the engine to reject.
+        if (length > SSL3_RT_MAX_ENCRYPTED_LENGTH) {
+            end = chunk.size;
+            ++records;
+            break;
+        }
+
+        if (end + SSL3_RT_HEADER_LENGTH + length > chunk.size)
+            break;
+
+        end += SSL3_RT_HEADER_LENGTH + length;
+        ++records;
+    }
+
+    if (records == 0)
+        return;
+
+    // A partial record at the end is moved to the next chunk.
+    std::unique_ptr<Pipeline::Chunk> next;
+    if (end < chunk.size) {
+        if (!p.spare.empty()) {
+            next = std::move(p.spare.back());
+            p.spare.pop_back();
+        }
+        else if (p.allocated < pipelineChunks) {
+            next = std::make_unique<Pipeline::Chunk>(p.chunkSize);
+            ++p.allocated;
+        }
+        else {
+            return;
+        }
+
+        next->size = chunk.size - end;
+        std::memcpy(next->data.get(), data + end, next->size);
+        chunk.size = end;
+    }
+
+    chunk.sequence = p.sequence;
+    p.sequence += records;
+    p.chunks.emplace_back(std::move(p.filling));
+    p.filling = std::move(next);
+}
+
+void TLSStream::decryptNext()
+{
+    auto &p = *m_pipeline;
+    if (p.busy || p.failed || p.decrypted == p.chunks.size())
+        return;
+
+    p.busy = true;
+    asio::post(*m_pipelineService, [
+        pipeline = m_pipeline, chunk = p.chunks[p.decrypted].get(),
+        queue = &asio::use_service<SubmissionQueue>(m_socket.get_io_context())
+    ] {
+        {
+            std::shared_lock<std::shared_timed_mutex> lock{pipeline->mutex};
+            if (!pipeline->stream)
+                return;
+
+            chunk->open(pipeline->stream->m_ssl.get());
+        }
+
+        // As with sealing, submitted to wake up a polled io_service too.
+        queue->submit([pipeline] {
+            std::function<void()> resume;
+            {
+                std::shared_lock<std::shared_timed_mutex> lock{
+                    pipeline->mutex};
+                if (!pipeline->stream || pipeline->stopped)
+                    return;
+
+                resume = pipeline->stream->decrypted();
+            }
+
+            if (resume)
+                resume();
+        });
+    });
+}
+
+std::function<void()> TLSStream::decrypted()
+{
+    auto &p = *m_pipeline;
+    const auto &chunk = *p.chunks[p.decrypted];
+
+    p.busy = false;
+    ++p.decrypted;
+    if (chunk.failedAt != chunk.size)
+        p.failed = true;
+    else
+        decryptNext();
+
+    return takeReader();
+}
+
+std::function<void()> TLSStream::takeReader()
+{
+    const auto &p = *m_pipeline;
+    if (!m_decryptResume ||
+        (p.decrypted == 0 && !(p.chunks.empty() && (p.eof || p.error))))
+        return {};
+
+    auto resume = std::move(m_decryptResume);
+    m_decryptResume = nullptr;
+    return resume;
+}
+
+const BIO_METHOD *TLSStream::bioMethod()
+{
+    static const BIO_METHOD method = {BIO_TYPE_SOCKET, "etls socket",
+        [](BIO *bio, const char *in, int size) {
+            return static_cast<TLSStream *>(bio->ptr)->bioWrite(bio, in, size);
+        },
+        [](BIO *bio, char *out, int size) {
+            return static_cast<TLSStream *>(bio->ptr)->bioRead(bio, out, size);
+        },
+        nullptr, nullptr, bioCtrl, nullptr, nullptr, nullptr};
+
+    return &method;
+}
+
+int TLSStream::bioRead(BIO *bio, char *out, const int size)
+{
+    BIO_clear_retry_flags(bio);
+
+    if (m_readBegin == m_readEnd) {
+        const auto fd = m_socket.native_handle();
+        const auto wanted = static_cast<std::size_t>(size);
+        if (wanted >= m_readAhead) {
+            const auto result = ::recv(fd, out, wanted, 0);
+            if (result < 0 && wouldBlock(errno))
+                BIO_set_retry_read(bio);
+
+            return static_cast<int>(result);
+        }
+
+        m_readBuffer = BufferPool::instance().borrow(m_readAhead);
+        const auto result = ::recv(fd, m_readBuffer.data(), m_readAhead, 0);
+        if (result <= 0) {
+            // Returning the buffer mustn't clobber the error of the read.
+            const auto error = errno;
+            m_readBuffer.reset();
+            errno = error;
+            if (result < 0 && wouldBlock(errno))
+                BIO_set_retry_read(bio);
+
+            return static_cast<int>(result);
+        }
+
+        m_readBegin = 0;
+        m_readEnd = static_cast<std::size_t>(result);
+    }
+
+    const auto n = std::min<std::size_t>(
+        static_cast<std::size_t>(size), m_readEnd - m_readBegin);
+
+    std::memcpy(out, m_readBuffer.data() + m_readBegin, n);
+    m_readBegin += n;
+    if (m_readBegin == m_readEnd)
+        m_readBuffer.reset();
+
+    return static_cast<int>(n);
+}
+
+int TLSStream::bioWrite(BIO *bio, const char *in, const int size)
+{
+    BIO_clear_retry_flags(bio);
+
+    if (m_staging) {
+        const auto n = static_cast<std::size_t>(size);
+        reserveWrite(m_writeEnd + n);
+        std::memcpy(m_writeBuffer.data() + m_writeEnd, in, n);
+        m_writeEnd += n;
+        return size;
+    }
+
+    const auto result =
+        ::send(m_socket.native_handle(), in, size, MSG_NOSIGNAL);
+    if (result < 0 && wouldBlock(errno))
+        BIO_set_retry_write(bio);
+
+    return static_cast<int>(result);
+}
+
+void TLSStream::reserveWrite(const std::size_t size)
+{
+    if (m_writeBuffer.size() >= size)
+        return;
+
+    auto buffer = BufferPool::instance().borrow(size);
+    if (m_writeEnd > 0)
+        std::memcpy(buffer.data(), m_writeBuffer.data(), m_writeEnd);
+
+    m_writeBuffer = std::move(buffer);
+}
+
+} // namespace etls
+} // namespace one
@@ -0,0 +1,559 @@
+/**
+ * @file tlsStream.hpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#ifndef ONE_ETLS_TLS_STREAM_HPP
+#define ONE_ETLS_TLS_STREAM_HPP
+
+#include "bufferPool.hpp"
+#include "submissionQueue.hpp"
+
+#include <asio/associated_allocator.hpp>
+#include <asio/buffer.hpp>
+#include <asio/detail/bind_handler.hpp>
+#include <asio/detail/handler_alloc_helpers.hpp>
+#include <asio/detail/handler_cont_helpers.hpp>
+#include <asio/detail/handler_invoke_helpers.hpp>
+#include <asio/io_service.hpp>
+#include <asio/ip/tcp.hpp>
+#include <asio/post.hpp>
+#include <asio/ssl/context.hpp>
+#include <asio/ssl/stream_base.hpp>
+#include <asio/ssl/verify_mode.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace one {
+namespace etls {
+
+/**
+ * The @c TLSStream class is a TLS stream over a TCP socket, usable as an
+ * asio AsyncReadStream and AsyncWriteStream.
+ * Unlike @c asio::ssl::stream, it doesn't stage data in intermediate
+ * buffers: the SSL engine reads ciphertext straight from the socket into
+ * its record buffer and decrypts into the caller's buffer, and encrypts
+ * from the caller's buffer straight into the socket's send buffer.
+ * At most one read and one write operation may be outstanding at a time.
+ */
+class TLSStream {
+public:
+    using lowest_layer_type = asio::ip::tcp::socket;
+
+    /**
+     * Constructor.
+     * @param ioService The @c io_service to run the stream's operations on.
+     * @param context SSL context used to create the stream's engine.
+     */
+    TLSStream(asio::io_service &ioService, asio::ssl::context &context);
+
+    /**
+     * Destructor.
+     * Detaches the stream from background work still in progress.
+     */
+    ~TLSStream();
+
+    TLSStream(const TLSStream &) = delete;
+    TLSStream &operator=(const TLSStream &) = delete;
+
+    /**
+     * @returns The underlying TCP socket.
+     */
+    lowest_layer_type &lowest_layer();
+
+    /**
+     * @returns The SSL engine.
+     */
+    SSL *native_handle();
+
+    /**
+     * Sets peer verification mode of the stream.
+     * @param mode The verification mode.
+     */
+    void set_verify_mode(const asio::ssl::verify_mode mode);
+
+    /**
+     * Sets the number of bytes requested from the socket by a single read.
+     * Ciphertext read ahead of the engine is buffered, so that all records
+     * that arrived together are decrypted after a single wakeup.
+     * The new size takes effect once currently buffered data is consumed.
+     * @param size The read size; 0 reads only what the engine asks for.
+     */
+    void setReadAhead(const std::size_t size);
+
+    /**
+     * Sets the maximum number of records encrypted by a single write.
+     * The records are staged and sent to the socket with one syscall.
+     * @param records The number of records; 0 is treated as 1.
+     */
+    void setWriteWindow(const std::size_t records);
+
+    /**
+     * @returns The maximum number of records encrypted by a single write.
+     */
+    std::size_t writeWindow() const;
+
+    /**
+     * Enables parallel encryption of writes.
+     * Records of a write are split between @c workers tasks run on
+     * @c service, each sealing its records with sequence numbers assigned
+     * up front. The write window is multiplied by the number of workers.
+     * Only AEAD ciphers of TLS 1.2 are sealed in parallel; other writes
+     * are encrypted by the engine as usual.
+     * @param service The @c io_service of a worker pool.
+     * @param workers The number of tasks a write is split between; 0 or 1
+     * disables parallel encryption.
+     */
+    void setSealWorkers(asio::io_service &service, const std::size_t workers);
+
+    /**
+     * Enables or disables pipelined receive.
+     * In pipelined mode the stream keeps reading ciphertext from the socket
+     * into a ring of buffers, independently of read operations, while
+     * complete records are decrypted on @c service. Reads only copy out the
+     * decrypted data. Only application data records of TLS 1.2 AEAD ciphers
+     * are decrypted this way; on any other record the stream hands the
+     * remaining ciphertext back to the engine.
+     * @param service The @c io_service of a worker pool, or nullptr to
+     * disable pipelining.
+     */
+    void setPipelined(asio::io_service *service);
+
+    /**
+     * Enables offloading of record processing to the kernel (Linux kTLS).
+     * Once the handshake is done and no data is buffered in userspace in
+     * a given direction, the negotiated keys and sequence numbers of that
+     * direction are handed to the socket, and further reads or writes are
+     * plain syscalls. Only AES-GCM ciphers of TLS 1.2 are offloaded; if the
+     * kernel or the cipher doesn't support it, the stream keeps processing
+     * records in userspace.
+     * @param enabled Whether to offload.
+     */
+    void setKernelOffload(const bool enabled);
+
+    /**
+     * Offloads writes to the kernel if enabled and not done yet.
+     * Must not be called while a write operation is outstanding.
+     * @returns Whether data written directly to the socket is encrypted by
+     * the kernel.
+     */
+    bool offloadWrites();
+
+    /**
+     * @returns Whether there's data for @c readBuffered.
+     */
+    bool hasBuffered() const;
+
+    /**
+     * Reads data that's at hand without waiting for the socket: bytes the
+     * engine has already decrypted and records left in the read-ahead
+     * buffer. An error hit on the way is reported by the next read.
+     * Must not be called while a read operation is outstanding.
+     * @param buffer The buffer to read data into.
+     * @returns The number of bytes read.
+     */
+    std::size_t readBuffered(const asio::mutable_buffer &buffer);
+
+    /**
+     * Encrypts a small write and sends it right away, if the stream isn't
+     * busy with anything else. Safe to call from any thread.
+     * If the write isn't completed, it has to be written again with
+     * @c async_write_some using the same buffer, which continues where this
+     * left off.
+     * @param buffer The buffer to write data from.
+     * @param recordSize Maximum payload of the records the data is sent in.
+     * @returns Whether all of the data was sent.
+     */
+    bool tryWrite(
+        const asio::const_buffer &buffer, const std::size_t recordSize);
+
+    /**
+     * Shuts down and closes the underlying socket. Waits for a concurrent
+     * @c tryWrite to finish, so that it doesn't write to a reused descriptor.
+     * @param ec Set to indicate what error occurred, if any.
+     */
+    void close(std::error_code &ec);
+
+    /**
+     * Moves the stream to another @c io_service. Must be called from the
+     * thread running the current one. Operations waiting for the socket are
+     * resumed on the new @c io_service; the socket's descriptor changes.
+     * @param ioService The new @c io_service.
+     * @returns Whether the stream was moved. Streams before the end of the
+     * handshake, with operations other than waits in progress, or using the
+     * kernel or worker threads for records stay where they are.
+     */
+    bool rebind(asio::io_service &ioService);
+
+    /**
+     * Asynchronously performs a TLS handshake.
+     * The underlying socket has to be connected.
+     * @param type Whether to act as a client or a server.
+     * @param handler Handler called with @c std::error_code on completion.
+     */
+    template <typename Handler>
+    void async_handshake(
+        const asio::ssl::stream_base::handshake_type type, Handler &&handler);
+
+    /**
+     * Asynchronously reads decrypted data into the first buffer of
+     * @c buffers. All records already received are decrypted before the
+     * operation completes, as long as they fit in the buffer.
+     * @param buffers The buffers to read data into.
+     * @param handler Handler called with @c std::error_code and number of
+     * bytes read on completion.
+     */
+    template <typename MutableBufferSequence, typename Handler>
+    void async_read_some(
+        const MutableBufferSequence &buffers, Handler &&handler);
+
+    /**
+     * Asynchronously encrypts and writes data from the first buffer of
+     * @c buffers. Up to @c writeWindow() records are encrypted up front and
+     * flushed to the socket together.
+     * @param buffers The buffers to write data from.
+     * @param handler Handler called with @c std::error_code and number of
+     * bytes written on completion.
+     */
+    template <typename ConstBufferSequence, typename Handler>
+    void async_write_some(
+        const ConstBufferSequence &buffers, Handler &&handler);
+
+private:
+    /// @c sealing and @c decrypting suspend an operation until the stream
+    /// resumes it once background work is done.
+    enum class Want { nothing, read, write, sealing, decrypting };
+
+    template <typename Operation, typename Handler, bool WithSize> class IoOp;
+    struct Pipeline;
+
+    template <bool WithSize, typename Operation, typename Handler>
+    void startOp(Operation &&operation, Handler &&handler);
+
+    Want handshake(
+        const asio::ssl::stream_base::handshake_type type, std::error_code &ec);
+
+    Want read(const asio::mutable_buffer &buffer, std::error_code &ec,
+        std::size_t &transferred);
+
+    Want write(const asio::const_buffer &buffer, std::error_code &ec,
+        std::size_t &transferred);
+
+    Want complete(
+        const int result, std::error_code &ec, std::size_t &transferred);
+
+    Want flush(std::error_code &ec);
+
+    bool tryOffload(const bool transmit);
+    bool enableKernelTLS(const bool transmit);
+    Want readKernel(char *data, const std::size_t size, std::error_code &ec,
+        std::size_t &transferred);
+    Want writeKernel(const char *data, const std::size_t size,
+        std::error_code &ec, std::size_t &transferred);
+
+    bool canSealInParallel(const std::size_t size) const;
+    Want sealInParallel(const char *data, const std::size_t size);
+    void sealRecords(const char *data, const std::size_t size,
+        const std::size_t first, const std::size_t last,
+        const std::uint64_t sequence);
+    void sealed();
+
+    bool canPipeline() const;
+    void startPipeline();
+    void stopPipeline();
+    Want readPipelined(char *data, const std::size_t size, std::error_code &ec,
+        std::size_t &transferred);
+    void pumpPipeline();
+    void handOver();
+    void decryptNext();
+    std::function<void()> decrypted();
+    std::function<void()> takeReader();
+
+    static const BIO_METHOD *bioMethod();
+    int bioRead(BIO *bio, char *out, const int size);
+    int bioWrite(BIO *bio, const char *in, const int size);
+    void reserveWrite(const std::size_t size);
+
+    lowest_layer_type m_socket;
+    std::unique_ptr<SSL, decltype(&SSL_free)> m_ssl;
+
+    // Buffers are borrowed from the shared pool only while they hold data,
+    // so that idle streams don't keep any.
+    std::size_t m_readAhead = 256 * 1024;
+    BufferPool::Buffer m_readBuffer;
+    std::size_t m_readBegin = 0;
+    std::size_t m_readEnd = 0;
+
+    // An error hit while draining records is reported by the next read,
+    // after the data decrypted before it is delivered.
+    std::error_code m_readError;
+
+    // While a write is in progress, records are appended to the staging
+    // buffer instead of being sent one by one.
+    std::size_t m_writeWindow = 16;
+    bool m_staging = false;
+    BufferPool::Buffer m_writeBuffer;
+    std::size_t m_writeBegin = 0;
+    std::size_t m_writeEnd = 0;
+    std::size_t m_written = 0;
+    std::error_code m_writeError;
+
+    asio::io_service *m_sealService = nullptr;
+    std::size_t m_sealWorkers = 0;
+    bool m_sealing = false;
+    std::atomic<std::size_t> m_sealPending{0};
+    std::atomic<bool> m_sealFailed{false};
+    std::function<void()> m_sealResume;
+
+    asio::io_service *m_pipelineService = nullptr;
+    std::shared_ptr<Pipeline> m_pipeline;
+    std::function<void()> m_decryptResume;
+
+    // Held while the engine is driven, so that other threads can use it
+    // for a write when the I/O thread doesn't.
+    std::mutex m_engineMutex;
+
+    // Operations in progress and those of them waiting for the socket;
+    // waits aborted by a move are counted as resuming until they run on
+    // the new io_service.
+    std::size_t m_operations = 0;
+    std::size_t m_waits = 0;
+    std::size_t m_resuming = 0;
+    std::atomic<std::size_t> m_generation{0};
+
+    bool m_offload = false;
+    bool m_tlsUlp = false;
+    bool m_kernelTx = false;
+    bool m_kernelRx = false;
+};
+
+/**
+ * A composed operation that drives the SSL engine, waiting for socket
+ * readiness whenever the engine can't make progress.
+ */
+template <typename Operation, typename Handler, bool WithSize>
+class TLSStream::IoOp {
+public:
+    using allocator_type =
+        typename asio::associated_allocator<Handler>::type;
+
+    IoOp(TLSStream &stream, Operation operation, Handler handler)
+        : m_stream(stream)
+        , m_operation(std::move(operation))
+        , m_handler(std::move(handler))
+    {
+    }
+
+    void operator()(std::error_code ec = {})
+    {
+        if (m_finishing) {
+            finish(m_ec, m_transferred);
+            return;
+        }
+
+        if (m_waiting) {
+            // A wait aborted by moving the stream is resumed on the
+            // stream's new io_service, which may be polled by another thread.
+            if (ec == asio::error::operation_aborted &&
+                m_generation != m_stream.m_generation.load()) {
+                m_generation = m_stream.m_generation.load();
+                m_moved = true;
+                asio::use_service<SubmissionQueue>(
+                    m_stream.m_socket.get_io_context())
+                    .submit(std::move(*this));
+                return;
+            }
+
+            m_waiting = false;
+            --m_stream.m_waits;
+            if (std::exchange(m_moved, false))
+                --m_stream.m_resuming;
+        }
+
+        const bool start = m_start;
+        m_start = false;
+
+        std::size_t transferred = 0;
+        if (!ec) {
+            std::unique_lock<std::mutex> lock{m_stream.m_engineMutex};
+            const auto want = m_operation(ec, transferred);
+            lock.unlock();
+
+            switch (want) {
+                case Want::read:
+                    wait(asio::socket_base::wait_read);
+                    return;
+
+                case Want::write:
+                    wait(asio::socket_base::wait_write);
+                    return;
+
+                case Want::sealing:
+                    suspend(m_stream.m_sealResume);
+                    return;
+
+                case Want::decrypting:
+                    suspend(m_stream.m_decryptResume);
+                    return;
+
+                case Want::nothing:
+                    break;
+            }
+        }
+
+        // A handler must not be invoked from within the initiating function.
+        // The operation stays in progress until then, so that the stream
+        // isn't moved from under it.
+        if (start) {
+            m_finishing = true;
+            m_ec = ec;
+            m_transferred = transferred;
+            asio::post(m_stream.m_socket.get_executor(), std::move(*this));
+        }
+        else {
+            finish(ec, transferred);
+        }
+    }
+
+    allocator_type get_allocator() const noexcept
+    {
+        return asio::get_associated_allocator(m_handler);
+    }
+
+    friend void *asio_handler_allocate(const std::size_t size, IoOp *op)
+    {
+        return asio_handler_alloc_helpers::allocate(size, op->m_handler);
+    }
+
+    friend void asio_handler_deallocate(
+        void *pointer, const std::size_t size, IoOp *op)
+    {
+        asio_handler_alloc_helpers::deallocate(pointer, size, op->m_handler);
+    }
+
+    friend bool asio_handler_is_continuation(IoOp *op)
+    {
+        return !op->m_start ||
+            asio_handler_cont_helpers::is_continuation(op->m_handler);
+    }
+
+    template <typename Function>
+    friend void asio_handler_invoke(Function &function, IoOp *op)
+    {
+        asio_handler_invoke_helpers::invoke(function, op->m_handler);
+    }
+
+    template <typename Function>
+    friend void asio_handler_invoke(const Function &function, IoOp *op)
+    {
+        asio_handler_invoke_helpers::invoke(function, op->m_handler);
+    }
+
+private:
+    void wait(const asio::socket_base::wait_type type)
+    {
+        m_waiting = true;
+        m_generation = m_stream.m_generation.load();
+        ++m_stream.m_waits;
+        m_stream.m_socket.async_wait(type, std::move(*this));
+    }
+
+    void finish(const std::error_code &ec, const std::size_t transferred)
+    {
+        --m_stream.m_operations;
+        bind(std::integral_constant<bool, WithSize>{}, ec, transferred)();
+    }
+
+    void suspend(std::function<void()> &resume)
+    {
+        auto op = std::make_shared<IoOp>(std::move(*this));
+        resume = [op] { (*op)(); };
+    }
+
+    auto bind(std::true_type, const std::error_code &ec,
+        const std::size_t transferred)
+    {
+        return asio::detail::bind_handler(
+            std::move(m_handler), ec, transferred);
+    }
+
+    auto bind(std::false_type, const std::error_code &ec, const std::size_t)
+    {
+        return asio::detail::bind_handler(std::move(m_handler), ec);
+    }
+
+    TLSStream &m_stream;
+    Operation m_operation;
+    Handler m_handler;
+    std::error_code m_ec;
+    std::size_t m_transferred = 0;
+    std::size_t m_generation = 0;
+    bool m_start = true;
+    bool m_waiting = false;
+    bool m_moved = false;
+    bool m_finishing = false;
+};
+
+template <bool WithSize, typename Operation, typename Handler>
+void TLSStream::startOp(Operation &&operation, Handler &&handler)
+{
+    ++m_operations;
+    IoOp<std::decay_t<Operation>, std::decay_t<Handler>, WithSize>{*this,
+        std::forward<Operation>(operation), std::forward<Handler>(handler)}();
+}
+
+template <typename Handler>
+void TLSStream::async_handshake(
+    const asio::ssl::stream_base::handshake_type type, Handler &&handler)
+{
+    startOp<false>(
+        [this, type](std::error_code &ec, std::size_t &) {
+            return this->handshake(type, ec);
+        },
+        std::forward<Handler>(handler));
+}
+
+template <typename MutableBufferSequence, typename Handler>
+void TLSStream::async_read_some(
+    const MutableBufferSequence &buffers, Handler &&handler)
+{
+    const auto buffer = asio::detail::buffer_sequence_adapter<
+        asio::mutable_buffer, MutableBufferSequence>::first(buffers);
+
+    startOp<true>(
+        [this, buffer](std::error_code &ec, std::size_t &transferred) {
+            return this->read(buffer, ec, transferred);
+        },
+        std::forward<Handler>(handler));
+}
+
+template <typename ConstBufferSequence, typename Handler>
+void TLSStream::async_write_some(
+    const ConstBufferSequence &buffers, Handler &&handler)
+{
+    const auto buffer = asio::detail::buffer_sequence_adapter<
+        asio::const_buffer, ConstBufferSequence>::first(buffers);
+
+    startOp<true>(
+        [this, buffer](std::error_code &ec, std::size_t &transferred) {
+            return this->write(buffer, ec, transferred);
+        },
+        std::forward<Handler>(handler));
+}
+
+} // namespace etls
+} // namespace one
+
+#endif // ONE_ETLS_TLS_STREAM_HPP
@@ -30,6 +30,22 @@ inline void nameThread(std::string name)
 #endif
 }
 
+/**
+ * Pins the calling thread to a single CPU. Memory the thread touches first
+ * is then allocated on the CPU's NUMA node.
+ */
+inline void pinThread(const int cpu)
+{
+#if defined(_GNU_SOURCE)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    static_cast<void>(cpu);
+#endif
+}
+
 } // namespace utils
 } // namespace etls
 } // namespace one
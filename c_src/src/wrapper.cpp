@@ -6,7 +6,9 @@
  * 'LICENSE.md'
  */
 
+#include "bufferPool.hpp"
 #include "callback.hpp"
+#include "cpuTopology.hpp"
 #include "nifpp.h"
 #include "tlsAcceptor.hpp"
 #include "tlsApplication.hpp"
@@ -16,9 +18,18 @@
 #include <asio/socket_base.hpp>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <new>
+#include <random>
 #include <string>
 #include <system_error>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
@@ -26,28 +37,128 @@
 using namespace std::literals;
 
 /**
- * A shared pointer wrapper to help with Erlang NIF environment management.
+ * A handle to a process-independent Erlang NIF environment. Copies of a handle
+ * share the environment; once the last one is gone, an environment borrowed
+ * from a socket is cleared and given back to it, and any other one is freed.
  */
 class Env {
 public:
     /**
-     * Creates a new environment by creating a @c shared_ptr with a custom
-     * deleter.
+     * An environment with the bookkeeping needed to share it.
+     */
+    struct Slot {
+        ErlNifEnv *env = nullptr;
+        void *resource = nullptr;
+        std::atomic<bool> used{false};
+        std::atomic<std::size_t> refs{0};
+    };
+
+    /**
+     * Creates a handle to a new environment of its own.
      */
     Env()
-        : env{enif_alloc_env(), enif_free_env}
+        : m_slot{new Slot}
+    {
+        m_slot->env = enif_alloc_env();
+        m_slot->refs = 1;
+    }
+
+    /**
+     * Creates a handle to an environment borrowed from a socket resource.
+     * The resource is kept alive until the environment is given back.
+     * @param slot The borrowed environment.
+     */
+    explicit Env(Slot &slot)
+        : m_slot{&slot}
+    {
+        enif_keep_resource(m_slot->resource);
+        m_slot->refs = 1;
+    }
+
+    Env(const Env &other)
+        : m_slot{other.m_slot}
+    {
+        m_slot->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Env(Env &&other) noexcept : m_slot{std::exchange(other.m_slot, nullptr)} {}
+
+    Env &operator=(const Env &) = delete;
+
+    ~Env()
     {
+        if (!m_slot ||
+            m_slot->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+
+        if (!m_slot->resource) {
+            enif_free_env(m_slot->env);
+            delete m_slot;
+            return;
+        }
+
+        auto resource = m_slot->resource;
+        enif_clear_env(m_slot->env);
+        m_slot->used.store(false, std::memory_order_release);
+        enif_release_resource(resource);
     }
 
     /**
      * Implicit conversion operator to @cErlNifEnv* .
      */
-    operator ErlNifEnv *() { return env.get(); }
+    operator ErlNifEnv *() { return m_slot->env; }
 
 private:
-    std::shared_ptr<ErlNifEnv> env;
+    Slot *m_slot;
+};
+
+/**
+ * The socket resource. Besides the socket, it holds a few environments that
+ * are reused by the socket's successive operations instead of allocating
+ * one per operation. Operations in flight at the same time, such as a send
+ * and a recv, each borrow a different environment; when all are taken, an
+ * operation gets a new one of its own.
+ */
+struct Socket {
+    explicit Socket(one::etls::TLSSocket::Ptr s)
+        : sock{std::move(s)}
+    {
+    }
+
+    Socket(const Socket &) = delete;
+    Socket &operator=(const Socket &) = delete;
+
+    ~Socket()
+    {
+        for (auto &slot : envs)
+            if (slot.env)
+                enif_free_env(slot.env);
+    }
+
+    /**
+     * @returns An environment for an operation on the socket.
+     */
+    Env env()
+    {
+        for (auto &slot : envs) {
+            if (!slot.used.exchange(true, std::memory_order_acquire)) {
+                if (!slot.env)
+                    slot.env = enif_alloc_env();
+
+                slot.resource = this;
+                return Env{slot};
+            }
+        }
+
+        return {};
+    }
+
+    one::etls::TLSSocket::Ptr sock;
+    std::array<Env::Slot, 4> envs;
 };
 
+using SocketPtr = nifpp::resource_ptr<Socket>;
+
 namespace {
 
 /**
@@ -56,15 +167,50 @@ namespace {
  */
 nifpp::str_atom ok{"ok"};
 nifpp::str_atom error{"error"};
+nifpp::str_atom packets_{"packets"};
+nifpp::str_atom sent_{"sent"};
+nifpp::str_atom wait_{"wait"};
+nifpp::str_atom more_{"more"};
+nifpp::str_atom undefined{"undefined"};
+nifpp::str_atom abs_path{"abs_path"};
+nifpp::str_atom absolute_uri{"absoluteURI"};
+nifpp::str_atom scheme_{"scheme"};
+nifpp::str_atom http_request{"http_request"};
+nifpp::str_atom http_response{"http_response"};
+nifpp::str_atom http_header{"http_header"};
+nifpp::str_atom http_eoh{"http_eoh"};
+nifpp::str_atom http_error{"http_error"};
 /** @} */
 
 /**
- * The @c TLSApplication object has a static lifetime; it will live as long
- * as the shared library is loaded into the memory and can be simultaneously
- * used by multiple multi-threaded applications.
+ * The @c TLSApplication object is created when the library is loaded, with
+ * the engine chosen by the load info; it will live as long as the shared
+ * library is loaded into the memory and can be simultaneously used by
+ * multiple multi-threaded applications.
  * The object has no external dependencies, including any lifetime dependencies.
  */
-one::etls::TLSApplication app;
+std::unique_ptr<one::etls::TLSApplication> app;
+
+/**
+ * With the select engine, each @c io_service is polled by an Erlang process,
+ * notified through @c enif_select when the @c io_service has work to do.
+ * A @c Poller is the resource the notifications are registered with.
+ */
+struct Poller {
+    /// Whether recent handlers took long enough to be run on a dirty
+    /// scheduler.
+    std::atomic<bool> heavy{false};
+};
+
+ErlNifResourceType *pollerType = nullptr;
+std::vector<Poller *> pollers;
+
+/// Time a poller runs handlers for on a normal scheduler, and the longest
+/// a handler may take before the poller moves to a dirty scheduler.
+constexpr auto pollSlice = 1ms;
+
+/// Time a poller runs handlers for on a dirty scheduler.
+constexpr auto dirtyPollSlice = 10ms;
 
 void setTLSOptions(one::etls::detail::WithSSLContext &object,
     std::string verifyMode, bool failIfNoPeerCert, bool verifyClientOnce,
@@ -142,6 +288,24 @@ one::etls::Callback<Args...> createCallback(
     return {std::forward<SF>(successFun), std::move(onError)};
 }
 
+/**
+ * Picks an environment for a call: one borrowed from the first socket among
+ * the call's arguments, or a new one if there's no socket.
+ */
+Env envFor() { return {}; }
+
+template <typename... Rest>
+Env envFor(const SocketPtr &socket, const Rest &... /*rest*/)
+{
+    return socket->env();
+}
+
+template <typename T, typename... Rest>
+Env envFor(const T & /*arg*/, const Rest &... rest)
+{
+    return envFor(rest...);
+}
+
 template <typename... Args, std::size_t... I>
 ERL_NIF_TERM wrap_helper(
     ERL_NIF_TERM (*fun)(ErlNifEnv *, Env, ErlNifPid, Args...), ErlNifEnv *env,
@@ -150,7 +314,10 @@ ERL_NIF_TERM wrap_helper(
     try {
         ErlNifPid pid;
         enif_self(env, &pid);
-        return fun(env, Env{}, pid, nifpp::get<Args>(env, args[I])...);
+        std::tuple<Args...> parsed{nifpp::get<Args>(env, args[I])...};
+        auto localEnv = envFor(std::get<I>(parsed)...);
+        return fun(env, std::move(localEnv), pid,
+            std::move(std::get<I>(parsed))...);
     }
     catch (const nifpp::badarg &) {
         return enif_make_badarg(env);
@@ -181,8 +348,7 @@ ERL_NIF_TERM connect(ErlNifEnv *env, Env localEnv, ErlNifPid pid, nifpp::TERM r,
     nifpp::TERM ref{enif_make_copy(localEnv, r)};
 
     auto onSuccess = [=](one::etls::TLSSocket::Ptr socket) mutable {
-        auto resource =
-            nifpp::construct_resource<one::etls::TLSSocket::Ptr>(socket);
+        auto resource = nifpp::construct_resource<Socket>(socket);
 
         auto message = nifpp::make(localEnv,
             std::make_tuple(ref, std::make_tuple(
@@ -192,7 +358,7 @@ ERL_NIF_TERM connect(ErlNifEnv *env, Env localEnv, ErlNifPid pid, nifpp::TERM r,
     };
 
     auto sock = std::make_shared<one::etls::TLSSocket>(
-        app, certPath, keyPath, std::move(rfc2818Hostname));
+        *app, certPath, keyPath, std::move(rfc2818Hostname));
 
     setTLSOptions(*sock, verifyMode, failIfNoPeerCert, verifyClientOnce, CAs,
         CRLs, chain, cipherList);
@@ -206,8 +372,9 @@ ERL_NIF_TERM connect(ErlNifEnv *env, Env localEnv, ErlNifPid pid, nifpp::TERM r,
 }
 
 ERL_NIF_TERM send(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
-    one::etls::TLSSocket::Ptr sock, nifpp::TERM d)
+    SocketPtr socket, nifpp::TERM d)
 {
+    auto &sock = socket->sock;
     nifpp::TERM data{enif_make_copy(localEnv, d)};
 
     ErlNifBinary bin;
@@ -215,6 +382,11 @@ ERL_NIF_TERM send(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
 
     asio::const_buffers_1 buffer{bin.data, bin.size};
 
+    // A small message on an idle socket is sent right away, skipping the
+    // trip to the I/O thread and the reply message.
+    if (sock->trySend(buffer))
+        return nifpp::make(env, sent_);
+
     auto onSuccess = [=]() mutable {
         auto message = nifpp::make(localEnv, ok);
         enif_send(nullptr, &pid, localEnv, message);
@@ -226,10 +398,120 @@ ERL_NIF_TERM send(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
     return nifpp::make(env, ok);
 }
 
+ERL_NIF_TERM sendfile(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
+    SocketPtr socket, nifpp::TERM file, std::size_t offset, std::size_t length)
+{
+    auto &sock = socket->sock;
+    auto onSuccess = [=](std::size_t sent) mutable {
+        auto message = nifpp::make(localEnv, std::make_tuple(ok, sent));
+        enif_send(nullptr, &pid, localEnv, message);
+    };
+
+    auto callback =
+        createCallback<std::size_t>(localEnv, pid, std::move(onSuccess));
+
+    int fd;
+    ErlNifBinary path;
+    if (enif_get_int(env, file, &fd))
+        sock->sendFileAsync(sock, fd, offset, length, std::move(callback));
+    else if (enif_inspect_binary(env, file, &path))
+        sock->sendFileAsync(sock,
+            std::string{reinterpret_cast<char *>(path.data), path.size},
+            offset, length, std::move(callback));
+    else
+        throw nifpp::badarg{};
+
+    return nifpp::make(env, ok);
+}
+
+ERL_NIF_TERM ws_send(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
+    SocketPtr socket, unsigned int opcode, nifpp::TERM d, bool mask)
+{
+    auto &sock = socket->sock;
+    nifpp::TERM data{enif_make_copy(localEnv, d)};
+
+    ErlNifBinary bin;
+    if (!enif_inspect_iolist_as_binary(localEnv, data, &bin))
+        throw nifpp::badarg{};
+
+    unsigned char key[4];
+    if (mask) {
+        static thread_local std::random_device rd;
+        static thread_local std::default_random_engine engine{rd()};
+        const std::uint32_t k = engine();
+        std::memcpy(key, &k, sizeof(key));
+
+        // Masking modifies the payload, so it's the only case that needs
+        // a copy.
+        ERL_NIF_TERM masked;
+        auto maskedData = enif_make_new_binary(localEnv, bin.size, &masked);
+        std::memcpy(maskedData, bin.data, bin.size);
+        one::etls::detail::unmask(
+            reinterpret_cast<char *>(maskedData), bin.size, key);
+        bin.data = maskedData;
+    }
+
+    using one::etls::detail::maxWebSocketHeaderSize;
+    const bool small = maxWebSocketHeaderSize + bin.size <=
+        one::etls::TLSSocket::maxSyncSendSize;
+
+    // A small frame is assembled in one buffer, so that it can be sent
+    // right away like a small message.
+    ERL_NIF_TERM headerTerm;
+    auto header = enif_make_new_binary(localEnv,
+        maxWebSocketHeaderSize + (small ? bin.size : 0), &headerTerm);
+    const auto headerSize = one::etls::detail::encodeWebSocketHeader(
+        header, opcode, bin.size, mask ? key : nullptr);
+
+    auto onSuccess = [=]() mutable {
+        auto message = nifpp::make(localEnv, ok);
+        enif_send(nullptr, &pid, localEnv, message);
+    };
+
+    if (small) {
+        std::memcpy(header + headerSize, bin.data, bin.size);
+        asio::const_buffers_1 frame{header, headerSize + bin.size};
+        if (sock->trySend(frame))
+            return nifpp::make(env, sent_);
+
+        sock->sendAsync(
+            sock, frame, createCallback(localEnv, pid, std::move(onSuccess)));
+
+        return nifpp::make(env, ok);
+    }
+
+    std::array<asio::const_buffer, 2> buffers{
+        {asio::buffer(header, headerSize), asio::buffer(bin.data, bin.size)}};
+
+    sock->sendAsync(
+        sock, buffers, createCallback(localEnv, pid, std::move(onSuccess)));
+
+    return nifpp::make(env, ok);
+}
+
 ERL_NIF_TERM recv(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
-    one::etls::TLSSocket::Ptr sock, std::size_t size)
+    SocketPtr socket, std::size_t size)
 {
-    auto bin = std::make_shared<nifpp::binary>(size == 0 ? 10 * 1024 : size);
+    auto &sock = socket->sock;
+
+    // Data the socket's I/O thread has already decrypted is returned right
+    // away, skipping the trip to the I/O thread and the reply message.
+    const auto buffered = sock->bufferedBytes();
+    if (buffered > 0 && buffered >= size) {
+        nifpp::binary bin{size == 0 ? buffered : size};
+        if (const auto read = sock->tryRecv({bin.data, bin.size}, size != 0)) {
+            if (read != bin.size)
+                enif_realloc_binary(&bin, read);
+
+            return nifpp::make(
+                env, std::make_tuple(ok, nifpp::make(env, bin)));
+        }
+    }
+
+    // With size 0, all records decrypted after a wakeup are returned at once,
+    // up to a buffer sized after the socket's recent reads.
+    auto bin = std::make_shared<nifpp::binary>(
+        size == 0 ? sock->recvBufferSize() : size);
 
     auto onSuccess = [=](asio::mutable_buffer buffer) mutable {
         if (bin->size != asio::buffer_size(buffer))
@@ -253,6 +535,206 @@ ERL_NIF_TERM recv(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
     return nifpp::make(env, ok);
 }
 
+/**
+ * Creates an Erlang term for a decoded packet.
+ * @param bin A binary term holding data of all packets in a batch.
+ * @param base Pointer to the beginning of the batch's data in the native
+ * buffer.
+ */
+nifpp::TERM makePacket(ErlNifEnv *env, ERL_NIF_TERM bin, const char *base,
+    const one::etls::PacketDecoder::Packet &packet)
+{
+    using Kind = one::etls::PacketDecoder::Packet::Kind;
+
+    auto sub = [&](const asio::const_buffer &b) {
+        return nifpp::TERM{enif_make_sub_binary(env, bin,
+            asio::buffer_cast<const char *>(b) - base, asio::buffer_size(b))};
+    };
+
+    auto version = [&] {
+        return std::make_tuple(packet.versionMajor, packet.versionMinor);
+    };
+
+    switch (packet.kind) {
+        case Kind::line:
+            return sub(packet.data);
+
+        case Kind::httpRequest: {
+            static const std::vector<std::string> methods{"OPTIONS", "GET",
+                "HEAD", "POST", "PUT", "DELETE", "TRACE"};
+
+            const std::string method{asio::buffer_cast<const char *>(
+                                         packet.name),
+                asio::buffer_size(packet.name)};
+
+            auto methodTerm =
+                std::find(methods.begin(), methods.end(), method) !=
+                    methods.end()
+                ? nifpp::make(env, nifpp::str_atom{method})
+                : sub(packet.name);
+
+            // The URI is split as by erlang:decode_packet/3.
+            using Uri = one::etls::PacketDecoder::Uri;
+            const auto uri = one::etls::PacketDecoder::parseUri(packet.value);
+            auto uriTerm = [&] {
+                switch (uri.kind) {
+                    case Uri::Kind::asterisk:
+                        return nifpp::make(env, nifpp::str_atom{"*"});
+
+                    case Uri::Kind::absPath:
+                        return nifpp::make(
+                            env, std::make_tuple(abs_path, sub(uri.path)));
+
+                    case Uri::Kind::absoluteUri: {
+                        ERL_NIF_TERM path;
+                        if (asio::buffer_size(uri.path) > 0)
+                            path = sub(uri.path);
+                        else
+                            *enif_make_new_binary(env, 1, &path) = '/';
+
+                        auto port = uri.port ? nifpp::make(env, uri.port)
+                                             : nifpp::make(env, undefined);
+
+                        return nifpp::make(env,
+                            std::make_tuple(absolute_uri,
+                                nifpp::str_atom{uri.https ? "https" : "http"},
+                                sub(uri.host), port, nifpp::TERM{path}));
+                    }
+
+                    case Uri::Kind::scheme:
+                        return nifpp::make(env, std::make_tuple(scheme_,
+                                                    sub(uri.scheme),
+                                                    sub(uri.path)));
+
+                    case Uri::Kind::string:
+                    default:
+                        return sub(uri.path);
+                }
+            }();
+
+            return nifpp::make(env,
+                std::make_tuple(http_request, methodTerm, uriTerm, version()));
+        }
+
+        case Kind::httpResponse:
+            return nifpp::make(env, std::make_tuple(http_response, version(),
+                                        packet.status, sub(packet.value)));
+
+        case Kind::httpHeader: {
+            // As in erlang:decode_packet/3, names of up to 20 characters are
+            // normalized to Capitalized-Words, and the fields it knows are
+            // returned as atoms along with their bit numbers.
+            static const std::vector<std::string> fields{"Cache-Control",
+                "Connection", "Date", "Pragma", "Transfer-Encoding",
+                "Upgrade", "Via", "Accept", "Accept-Charset",
+                "Accept-Encoding", "Accept-Language", "Authorization", "From",
+                "Host", "If-Modified-Since", "If-Match", "If-None-Match",
+                "If-Range", "If-Unmodified-Since", "Max-Forwards",
+                "Proxy-Authorization", "Range", "Referer", "User-Agent", "Age",
+                "Location", "Proxy-Authenticate", "Public", "Retry-After",
+                "Server", "Vary", "Warning", "Www-Authenticate", "Allow",
+                "Content-Base", "Content-Encoding", "Content-Language",
+                "Content-Length", "Content-Location", "Content-Md5",
+                "Content-Range", "Content-Type", "Etag", "Expires",
+                "Last-Modified", "Accept-Ranges", "Set-Cookie", "Set-Cookie2",
+                "X-Forwarded-For", "Cookie", "Keep-Alive", "Proxy-Connection"};
+
+            const auto original = asio::buffer_cast<const char *>(packet.name);
+            std::string name{original, asio::buffer_size(packet.name)};
+            if (name.size() <= 20) {
+                bool upper = true;
+                for (auto &c : name) {
+                    const auto u = static_cast<unsigned char>(c);
+                    c = static_cast<char>(
+                        upper ? std::toupper(u) : std::tolower(u));
+                    upper = c == '-';
+                }
+            }
+
+            const auto field = std::find(fields.begin(), fields.end(), name);
+            if (field != fields.end())
+                return nifpp::make(env,
+                    std::make_tuple(http_header,
+                        static_cast<int>(field - fields.begin()) + 1,
+                        nifpp::str_atom{name}, undefined, sub(packet.value)));
+
+            ERL_NIF_TERM nameTerm = sub(packet.name);
+            if (name.compare(0, name.size(), original, name.size()) != 0) {
+                auto data = enif_make_new_binary(env, name.size(), &nameTerm);
+                std::memcpy(data, name.data(), name.size());
+            }
+
+            return nifpp::make(env,
+                std::make_tuple(http_header, 0, nifpp::TERM{nameTerm},
+                    undefined, sub(packet.value)));
+        }
+
+        case Kind::httpEoh:
+            return nifpp::make(env, http_eoh);
+
+        case Kind::webSocket: {
+            static const std::vector<std::string> opcodes{"continuation",
+                "text", "binary", "", "", "", "", "", "close", "ping", "pong"};
+
+            auto opcode = nifpp::str_atom{opcodes.at(packet.opcode)};
+            return nifpp::make(
+                env, std::make_tuple(opcode, sub(packet.data)));
+        }
+
+        case Kind::httpError:
+        default:
+            return nifpp::make(
+                env, std::make_tuple(http_error, sub(packet.value)));
+    }
+}
+
+ERL_NIF_TERM recv_packets(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
+    SocketPtr socket, nifpp::str_atom type, std::size_t maxSize)
+{
+    auto &sock = socket->sock;
+    auto decoderType = one::etls::PacketDecoder::Type::line;
+    if (type == "line")
+        decoderType = one::etls::PacketDecoder::Type::line;
+    else if (type == "http")
+        decoderType = one::etls::PacketDecoder::Type::http;
+    else if (type == "httph")
+        decoderType = one::etls::PacketDecoder::Type::httph;
+    else if (type == "websocket")
+        decoderType = one::etls::PacketDecoder::Type::websocket;
+    else
+        throw nifpp::badarg{};
+
+    auto onSuccess = [=](
+        const std::vector<one::etls::PacketDecoder::Packet> &packets) mutable {
+        // All packets are copied into a single binary in one go, and
+        // delivered as its sub-binaries.
+        auto base = asio::buffer_cast<const char *>(packets.front().data);
+        auto &last = packets.back().data;
+        auto end = asio::buffer_cast<const char *>(last) +
+            asio::buffer_size(last);
+
+        nifpp::binary bin{static_cast<std::size_t>(end - base)};
+        std::memcpy(bin.data, base, bin.size);
+        auto binTerm = nifpp::make(localEnv, bin);
+
+        std::vector<nifpp::TERM> terms;
+        terms.reserve(packets.size());
+        for (auto &packet : packets)
+            terms.emplace_back(makePacket(localEnv, binTerm, base, packet));
+
+        auto message = nifpp::make(localEnv, std::make_tuple(packets_, terms));
+        enif_send(nullptr, &pid, localEnv, message);
+    };
+
+    auto callback =
+        createCallback<const std::vector<one::etls::PacketDecoder::Packet> &>(
+            localEnv, pid, std::move(onSuccess));
+
+    sock->recvPacketsAsync(sock, decoderType, maxSize, std::move(callback));
+
+    return nifpp::make(env, ok);
+}
+
 ERL_NIF_TERM listen(ErlNifEnv *env, Env /*localEnv*/, ErlNifPid /*pid*/,
     int port, std::string certPath, std::string keyPath, std::string verifyMode,
     bool failIfNoPeerCert, bool verifyClientOnce, std::string rfc2818Hostname,
@@ -261,7 +743,7 @@ ERL_NIF_TERM listen(ErlNifEnv *env, Env /*localEnv*/, ErlNifPid /*pid*/,
 {
     backlog = backlog == -1 ? asio::socket_base::max_connections : backlog;
     auto acceptor = std::make_shared<one::etls::TLSAcceptor>(
-        app, port, certPath, keyPath, std::move(rfc2818Hostname), backlog);
+        *app, port, certPath, keyPath, std::move(rfc2818Hostname), backlog);
 
     setTLSOptions(*acceptor, verifyMode, failIfNoPeerCert, verifyClientOnce,
         CAs, CRLs, chain, cipherList);
@@ -277,8 +759,7 @@ ERL_NIF_TERM accept(ErlNifEnv *env, Env localEnv, ErlNifPid pid, nifpp::TERM r,
     nifpp::TERM ref{enif_make_copy(localEnv, r)};
 
     auto onSuccess = [=](one::etls::TLSSocket::Ptr sock) mutable {
-        auto resource =
-            nifpp::construct_resource<one::etls::TLSSocket::Ptr>(sock);
+        auto resource = nifpp::construct_resource<Socket>(sock);
 
         auto message = nifpp::make(localEnv,
             std::make_tuple(ref, std::make_tuple(
@@ -296,8 +777,9 @@ ERL_NIF_TERM accept(ErlNifEnv *env, Env localEnv, ErlNifPid pid, nifpp::TERM r,
 }
 
 ERL_NIF_TERM handshake(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
-    nifpp::TERM r, one::etls::TLSSocket::Ptr sock)
+    nifpp::TERM r, SocketPtr socket)
 {
+    auto &sock = socket->sock;
     nifpp::TERM ref{enif_make_copy(localEnv, r)};
 
     auto onSuccess = [=]() mutable {
@@ -312,8 +794,9 @@ ERL_NIF_TERM handshake(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
 }
 
 ERL_NIF_TERM peername(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
-    nifpp::TERM r, one::etls::TLSSocket::Ptr sock)
+    nifpp::TERM r, SocketPtr socket)
 {
+    auto &sock = socket->sock;
     nifpp::TERM ref{enif_make_copy(localEnv, r)};
 
     auto onSuccess = [=](auto &endpoint) mutable {
@@ -334,9 +817,34 @@ ERL_NIF_TERM peername(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
     return nifpp::make(env, ok);
 }
 
+ERL_NIF_TERM getstat(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
+    nifpp::TERM r, SocketPtr socket)
+{
+    auto &sock = socket->sock;
+    nifpp::TERM ref{enif_make_copy(localEnv, r)};
+
+    auto onSuccess = [=](auto &stats) mutable {
+        auto message = nifpp::make(localEnv,
+            std::make_tuple(ref,
+                std::make_tuple(ok,
+                    std::vector<std::tuple<nifpp::str_atom, std::size_t>>{
+                        {"recv_buffer", stats.recvBuffer}})));
+
+        enif_send(nullptr, &pid, localEnv, message);
+    };
+
+    auto callback = createCallback<const one::etls::TLSSocket::Stats &>(
+        localEnv, pid, ref, std::move(onSuccess));
+
+    sock->statsAsync(sock, std::move(callback));
+
+    return nifpp::make(env, ok);
+}
+
 ERL_NIF_TERM sockname(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
-    nifpp::TERM r, one::etls::TLSSocket::Ptr sock)
+    nifpp::TERM r, SocketPtr socket)
 {
+    auto &sock = socket->sock;
     nifpp::TERM ref{enif_make_copy(localEnv, r)};
 
     auto onSuccess = [=](auto &endpoint) mutable {
@@ -381,8 +889,9 @@ ERL_NIF_TERM acceptor_sockname(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
 }
 
 ERL_NIF_TERM close(ErlNifEnv *env, Env localEnv, ErlNifPid pid, nifpp::TERM r,
-    one::etls::TLSSocket::Ptr sock)
+    SocketPtr socket)
 {
+    auto &sock = socket->sock;
     nifpp::TERM ref{enif_make_copy(localEnv, r)};
 
     auto onSuccess = [=]() mutable {
@@ -397,8 +906,9 @@ ERL_NIF_TERM close(ErlNifEnv *env, Env localEnv, ErlNifPid pid, nifpp::TERM r,
 }
 
 ERL_NIF_TERM certificate_chain(ErlNifEnv *env, Env /*localEnv*/,
-    ErlNifPid /*pid*/, one::etls::TLSSocket::Ptr sock)
+    ErlNifPid /*pid*/, SocketPtr socket)
 {
+    auto &sock = socket->sock;
     auto &chain = sock->certificateChain();
 
     std::vector<nifpp::TERM> terms;
@@ -413,8 +923,9 @@ ERL_NIF_TERM certificate_chain(ErlNifEnv *env, Env /*localEnv*/,
 }
 
 ERL_NIF_TERM shutdown(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
-    nifpp::TERM r, one::etls::TLSSocket::Ptr sock, nifpp::str_atom type)
+    nifpp::TERM r, SocketPtr socket, nifpp::str_atom type)
 {
+    auto &sock = socket->sock;
     nifpp::TERM ref{enif_make_copy(localEnv, r)};
 
     auto onSuccess = [=]() mutable {
@@ -438,6 +949,45 @@ ERL_NIF_TERM shutdown(ErlNifEnv *env, Env localEnv, ErlNifPid pid,
     return nifpp::make(env, ok);
 }
 
+ERL_NIF_TERM setopt(ErlNifEnv *env, Env /*localEnv*/, ErlNifPid /*pid*/,
+    SocketPtr socket, nifpp::str_atom name, std::size_t value)
+{
+    auto &sock = socket->sock;
+    using Option = one::etls::TLSSocket::Option;
+
+    static const std::unordered_map<std::string, Option> options{
+        {"record_size", Option::recordSize},
+        {"read_ahead", Option::readAhead},
+        {"write_window", Option::writeWindow},
+        {"seal_workers", Option::sealWorkers},
+        {"pipelined_recv", Option::pipelinedRecv},
+        {"ktls", Option::kernelTls},
+        {"recv_buffer_min", Option::recvBufferMin},
+        {"recv_buffer_max", Option::recvBufferMax}};
+
+    auto it = options.find(name);
+    if (it == options.end())
+        throw nifpp::badarg{};
+
+    sock->setOptionAsync(sock, it->second, value);
+    return nifpp::make(env, ok);
+}
+
+ERL_NIF_TERM request_rehome(
+    ErlNifEnv *env, Env /*localEnv*/, ErlNifPid /*pid*/, SocketPtr socket)
+{
+    socket->sock->requestRehome();
+    return nifpp::make(env, ok);
+}
+
+ERL_NIF_TERM rehome(
+    ErlNifEnv *env, Env /*localEnv*/, ErlNifPid /*pid*/, SocketPtr socket)
+{
+    auto &sock = socket->sock;
+    sock->rehomeAsync(sock);
+    return nifpp::make(env, ok);
+}
+
 ERL_NIF_TERM cipherlist(
     ErlNifEnv *env, Env /*localEnv*/, ErlNifPid /*pid*/, std::string filter)
 {
@@ -458,6 +1008,148 @@ ERL_NIF_TERM cipherlist(
     return nifpp::make(env, result);
 }
 
+ERL_NIF_TERM buffer_stats(
+    ErlNifEnv *env, Env /*localEnv*/, ErlNifPid /*pid*/)
+{
+    std::size_t pooled = 0;
+    std::size_t borrowed = 0;
+    for (std::size_t node = 0;
+         node < one::etls::CpuTopology::instance().nodes(); ++node) {
+        auto &pool = one::etls::BufferPool::instance(node);
+        pooled += pool.pooledBytes();
+        borrowed += pool.borrowedBytes();
+    }
+
+    return nifpp::make(
+        env, std::vector<std::tuple<nifpp::str_atom, std::size_t>>{
+                 {"pooled_bytes", pooled}, {"borrowed_bytes", borrowed}});
+}
+
+ERL_NIF_TERM io_stats(ErlNifEnv *env, Env /*localEnv*/, ErlNifPid /*pid*/)
+{
+    const auto stats = app->submissionStats();
+    const auto latency = stats.submitted == 0
+        ? 0
+        : static_cast<std::uint64_t>(stats.latency.count()) / stats.submitted;
+
+    return nifpp::make(
+        env, std::vector<std::tuple<nifpp::str_atom, std::uint64_t>>{
+                 {"submitted", stats.submitted}, {"wakeups", stats.wakeups},
+                 {"overflows", stats.overflows},
+                 {"mean_latency_ns", latency}});
+}
+
+ERL_NIF_TERM io_load(ErlNifEnv *env, Env /*localEnv*/, ErlNifPid /*pid*/)
+{
+    std::vector<nifpp::TERM> result;
+    for (const auto &load : app->loads()) {
+        result.emplace_back(nifpp::make(env,
+            std::vector<nifpp::TERM>{
+                nifpp::make(env, std::make_tuple(nifpp::str_atom{"sockets"},
+                                     load.sockets)),
+                nifpp::make(env,
+                    std::make_tuple(nifpp::str_atom{"bytes_per_second"},
+                        load.bytesPerSecond)),
+                nifpp::make(env,
+                    std::make_tuple(
+                        nifpp::str_atom{"queue_depth"}, load.queueDepth)),
+                nifpp::make(env, std::make_tuple(
+                                     nifpp::str_atom{"busy"}, load.busy))}));
+    }
+
+    return nifpp::make(env, result);
+}
+
+ERL_NIF_TERM engine(ErlNifEnv *env, Env /*localEnv*/, ErlNifPid /*pid*/)
+{
+    const auto select =
+        app->engine() == one::etls::TLSApplication::Engine::select;
+
+    return nifpp::make(env,
+        std::make_tuple(nifpp::str_atom{select ? "select" : "threads"},
+            app->size()));
+}
+
+ERL_NIF_TERM set_io_threads(
+    ErlNifEnv *env, Env /*localEnv*/, ErlNifPid /*pid*/, std::size_t n)
+{
+    if (n == 0)
+        throw nifpp::badarg{};
+
+    return nifpp::make(env, std::make_tuple(ok, app->resize(n)));
+}
+
+enum class PollResult { drained, yield, heavy };
+
+/**
+ * Runs ready handlers of a polled @c io_service until there are none left,
+ * or the poller's time slice runs out. Once drained, the poller is
+ * registered to be notified when the @c io_service has work again.
+ * @param dirty Whether the poller runs on a dirty scheduler.
+ */
+PollResult pollHandlers(
+    ErlNifEnv *env, const std::size_t index, const bool dirty)
+{
+    using Clock = std::chrono::steady_clock;
+
+    auto &poller = *pollers[index];
+    const auto start = Clock::now();
+    auto last = start;
+    bool heavy = false;
+
+    while (app->pollOne(index)) {
+        const auto now = Clock::now();
+        const auto took = now - last;
+        last = now;
+        heavy = heavy || took > pollSlice;
+
+        if (dirty) {
+            if (now - start >= dirtyPollSlice) {
+                poller.heavy = heavy;
+                return PollResult::yield;
+            }
+        }
+        else if (heavy) {
+            poller.heavy = true;
+            return PollResult::heavy;
+        }
+        else {
+            const auto percent =
+                std::min<int>(100, std::max<int>(1, took * 100 / pollSlice));
+            if (enif_consume_timeslice(env, percent))
+                return PollResult::yield;
+        }
+    }
+
+    if (dirty)
+        poller.heavy = heavy;
+
+    if (enif_select(env, app->pollDescriptor(index), ERL_NIF_SELECT_READ,
+            &poller, nullptr, nifpp::make(env, undefined)) < 0)
+        throw std::system_error{
+            std::make_error_code(std::errc::bad_file_descriptor)};
+
+    return PollResult::drained;
+}
+
+/**
+ * Parses a poller's index from NIF arguments.
+ */
+std::size_t pollerIndex(ErlNifEnv *env, const ERL_NIF_TERM argv[])
+{
+    std::size_t index;
+    if (!nifpp::get(env, argv[0], index) || index >= pollers.size())
+        throw nifpp::badarg{};
+
+    return index;
+}
+
+void stopPoller(ErlNifEnv * /*env*/, void * /*obj*/, ErlNifEvent /*event*/,
+    int /*isDirectCall*/)
+{
+    // The descriptor belongs to the io_service, which closes it.
+}
+
 } // namespace
 
 /**
@@ -465,14 +1157,82 @@ ERL_NIF_TERM cipherlist(
  */
 extern "C" {
 
-static int load(ErlNifEnv *env, void ** /*priv*/, ERL_NIF_TERM /*load_info*/)
+static int load(ErlNifEnv *env, void ** /*priv*/, ERL_NIF_TERM loadInfo)
 {
-    nifpp::register_resource<one::etls::TLSSocket::Ptr>(
-        env, nullptr, "TLSSocket");
+    using Engine = one::etls::TLSApplication::Engine;
+    using Placement = one::etls::TLSApplication::Placement;
+
+    nifpp::register_resource<Socket>(env, nullptr, "TLSSocket");
 
     nifpp::register_resource<one::etls::TLSAcceptor::Ptr>(
         env, nullptr, "TLSAcceptor");
 
+    ErlNifResourceTypeInit pollerInit{nullptr, &stopPoller, nullptr};
+    pollerType = enif_open_resource_type_x(
+        env, "Poller", &pollerInit, ERL_NIF_RT_CREATE, nullptr);
+
+    if (!pollerType)
+        return 1;
+
+    // With the select engine, each scheduler can poll an io_service.
+    one::etls::TLSApplication::Config config;
+    std::size_t schedulers = std::thread::hardware_concurrency();
+
+    std::vector<std::tuple<nifpp::str_atom, nifpp::TERM>> options;
+    nifpp::get(env, loadInfo, options);
+    for (auto &option : std::move(options)) {
+        const auto &name = std::get<0>(option);
+        auto term = std::get<1>(option);
+        nifpp::str_atom value;
+        if (name == "engine" && nifpp::get(env, term, value))
+            config.engine =
+                value == "select" ? Engine::select : Engine::threads;
+        else if (name == "schedulers")
+            nifpp::get(env, term, schedulers);
+        else if (name == "io_threads")
+            nifpp::get(env, term, config.ioThreads);
+        else if (name == "worker_threads")
+            nifpp::get(env, term, config.workerThreads);
+        else if (name == "thread_name")
+            nifpp::get(env, term, config.threadName);
+        else if (name == "io_cpus" && nifpp::get(env, term, value))
+            config.cpus = value == "spread"
+                ? one::etls::CpuTopology::instance().spread(
+                      one::etls::CpuTopology::allowedCpus())
+                : std::vector<int>{};
+        else if (name == "io_cpus")
+            nifpp::get(env, term, config.cpus);
+        else if (name == "io_placement" && nifpp::get(env, term, value)) {
+            if (value == "scheduler")
+                config.placement = Placement::scheduler;
+            else if (value == "power_of_two")
+                config.placement = Placement::powerOfTwo;
+            else if (value == "least_loaded")
+                config.placement = Placement::leastLoaded;
+            else
+                config.placement = Placement::roundRobin;
+        }
+        else if (name == "io_rebalance" && nifpp::get(env, term, value))
+            config.rebalance = value == "true";
+    }
+
+    if (config.engine == Engine::select ||
+        config.placement == Placement::scheduler)
+        config.ioThreads = schedulers;
+
+    try {
+        app = std::make_unique<one::etls::TLSApplication>(std::move(config));
+
+        if (app->engine() == Engine::select) {
+            for (std::size_t i = 0; i < app->size(); ++i)
+                pollers.emplace_back(new (enif_alloc_resource(
+                    pollerType, sizeof(Poller))) Poller);
+        }
+    }
+    catch (const std::exception &) {
+        return 1;
+    }
+
     return 0;
 }
 
@@ -488,12 +1248,30 @@ static ERL_NIF_TERM send_nif(
     return wrap(send, env, argv);
 }
 
+static ERL_NIF_TERM sendfile_nif(
+    ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
+{
+    return wrap(sendfile, env, argv);
+}
+
+static ERL_NIF_TERM ws_send_nif(
+    ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
+{
+    return wrap(ws_send, env, argv);
+}
+
 static ERL_NIF_TERM recv_nif(
     ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
 {
     return wrap(recv, env, argv);
 }
 
+static ERL_NIF_TERM recv_packets_nif(
+    ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
+{
+    return wrap(recv_packets, env, argv);
+}
+
 static ERL_NIF_TERM listen_nif(
     ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
 {
@@ -512,6 +1290,12 @@ static ERL_NIF_TERM handshake_nif(
     return wrap(handshake, env, argv);
 }
 
+static ERL_NIF_TERM getstat_nif(
+    ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
+{
+    return wrap(getstat, env, argv);
+}
+
 static ERL_NIF_TERM peername_nif(
     ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
 {
@@ -548,19 +1332,118 @@ static ERL_NIF_TERM shutdown_nif(
     return wrap(shutdown, env, argv);
 }
 
+static ERL_NIF_TERM setopt_nif(
+    ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
+{
+    return wrap(setopt, env, argv);
+}
+
 static ERL_NIF_TERM cipher_suites_nif(
     ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
 {
     return wrap(cipherlist, env, argv);
 }
 
+static ERL_NIF_TERM buffer_stats_nif(
+    ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
+{
+    return wrap(buffer_stats, env, argv);
+}
+
+static ERL_NIF_TERM io_stats_nif(
+    ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
+{
+    return wrap(io_stats, env, argv);
+}
+
+static ERL_NIF_TERM io_load_nif(
+    ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
+{
+    return wrap(io_load, env, argv);
+}
+
+static ERL_NIF_TERM engine_nif(
+    ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
+{
+    return wrap(engine, env, argv);
+}
+
+static ERL_NIF_TERM request_rehome_nif(
+    ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
+{
+    return wrap(request_rehome, env, argv);
+}
+
+static ERL_NIF_TERM rehome_nif(
+    ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
+{
+    return wrap(rehome, env, argv);
+}
+
+static ERL_NIF_TERM set_io_threads_nif(
+    ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
+{
+    return wrap(set_io_threads, env, argv);
+}
+
+static ERL_NIF_TERM poll_dirty_nif(
+    ErlNifEnv *env, int /*argc*/, const ERL_NIF_TERM argv[])
+{
+    try {
+        const auto result = pollHandlers(env, pollerIndex(env, argv), true);
+        return nifpp::make(
+            env, result == PollResult::drained ? wait_ : more_);
+    }
+    catch (const nifpp::badarg &) {
+        return enif_make_badarg(env);
+    }
+    catch (const std::system_error &e) {
+        return nifpp::make(
+            env, std::make_tuple(error, nifpp::str_atom{e.code().message()}));
+    }
+}
+
+static ERL_NIF_TERM poll_nif(
+    ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    try {
+        // Slow handlers, such as ones encrypting large payloads, are run on
+        // a dirty scheduler, until a round on it finds them fast again.
+        const auto index = pollerIndex(env, argv);
+        const auto result = pollers[index]->heavy
+            ? PollResult::heavy
+            : pollHandlers(env, index, false);
+
+        if (result == PollResult::heavy)
+            return enif_schedule_nif(env, "poll_dirty",
+                ERL_NIF_DIRTY_JOB_CPU_BOUND, poll_dirty_nif, argc, argv);
+
+        return nifpp::make(
+            env, result == PollResult::drained ? wait_ : more_);
+    }
+    catch (const nifpp::badarg &) {
+        return enif_make_badarg(env);
+    }
+    catch (const std::system_error &e) {
+        return nifpp::make(
+            env, std::make_tuple(error, nifpp::str_atom{e.code().message()}));
+    }
+}
+
 static ErlNifFunc nif_funcs[] = {{"connect", 13, connect_nif},
-    {"send", 2, send_nif}, {"recv", 2, recv_nif}, {"listen", 12, listen_nif},
+    {"send", 2, send_nif}, {"sendfile", 4, sendfile_nif},
+    {"ws_send", 4, ws_send_nif}, {"recv", 2, recv_nif},
+    {"recv_packets", 3, recv_packets_nif}, {"listen", 12, listen_nif},
     {"accept", 2, accept_nif}, {"handshake", 2, handshake_nif},
     {"peername", 2, peername_nif}, {"sockname", 2, sockname_nif},
     {"acceptor_sockname", 2, acceptor_sockname_nif}, {"close", 2, close_nif},
     {"certificate_chain", 1, certificate_chain_nif},
-    {"shutdown", 3, shutdown_nif}, {"cipher_suites", 1, cipher_suites_nif}};
+    {"shutdown", 3, shutdown_nif}, {"setopt", 3, setopt_nif},
+    {"getstat", 2, getstat_nif}, {"cipher_suites", 1, cipher_suites_nif},
+    {"buffer_stats", 0, buffer_stats_nif}, {"io_stats", 0, io_stats_nif},
+    {"io_load", 0, io_load_nif}, {"engine", 0, engine_nif},
+    {"set_io_threads", 1, set_io_threads_nif}, {"poll", 1, poll_nif},
+    {"request_rehome", 1, request_rehome_nif}, {"rehome", 1, rehome_nif}};
 
 #pragma GCC visibility push(default)
 ERL_NIF_INIT(etls_nif, nif_funcs, load, NULL, NULL, NULL)
@@ -0,0 +1,36 @@
+/**
+ * @file allocationCounter.cpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#include "allocationCounter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// The replacements are kept out of the tests' translation units, as GCC
+// would otherwise see them inlined into new-expressions and report
+// every delete of their result as mismatched with malloc.
+
+namespace {
+std::atomic<std::size_t> allocations{0};
+}
+
+void *operator new(std::size_t size)
+{
+    ++allocations;
+    if (auto p = std::malloc(size == 0 ? 1 : size))
+        return p;
+
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+std::size_t allocationCount() { return allocations.load(); }
@@ -0,0 +1,21 @@
+/**
+ * @file allocationCounter.hpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#ifndef ONE_ETLS_ALLOCATION_COUNTER_HPP
+#define ONE_ETLS_ALLOCATION_COUNTER_HPP
+
+#include <cstddef>
+
+/**
+ * Linking allocationCounter.cpp replaces the global operator new of the test
+ * executable with one that counts its calls.
+ * @returns Number of calls to operator new so far.
+ */
+std::size_t allocationCount();
+
+#endif // ONE_ETLS_ALLOCATION_COUNTER_HPP
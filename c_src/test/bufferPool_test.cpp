@@ -0,0 +1,68 @@
+/**
+ * @file bufferPool_test.cpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#include "bufferPool.hpp"
+
+#include <gtest/gtest.h>
+
+#include <utility>
+
+using namespace testing;
+
+struct BufferPoolTest : public Test {
+    one::etls::BufferPool pool{64 * 1024};
+};
+
+TEST_F(BufferPoolTest, shouldRoundBuffersUpToSizeClasses)
+{
+    EXPECT_EQ(4096u, pool.borrow(1).size());
+    EXPECT_EQ(4096u, pool.borrow(4096).size());
+    EXPECT_EQ(8192u, pool.borrow(4097).size());
+}
+
+TEST_F(BufferPoolTest, shouldCountBorrowedAndPooledBytes)
+{
+    auto buffer = pool.borrow(10000);
+    EXPECT_EQ(16384u, pool.borrowedBytes());
+    EXPECT_EQ(0u, pool.pooledBytes());
+
+    buffer.reset();
+    EXPECT_FALSE(buffer);
+    EXPECT_EQ(0u, pool.borrowedBytes());
+    EXPECT_EQ(16384u, pool.pooledBytes());
+}
+
+TEST_F(BufferPoolTest, shouldReuseReturnedBuffers)
+{
+    auto data = pool.borrow(5000).data();
+    auto buffer = pool.borrow(6000);
+
+    EXPECT_EQ(data, buffer.data());
+    EXPECT_EQ(0u, pool.pooledBytes());
+}
+
+TEST_F(BufferPoolTest, shouldReturnBuffersWhenMovedOver)
+{
+    auto buffer = pool.borrow(100);
+    auto other = std::move(buffer);
+    EXPECT_FALSE(buffer);
+    EXPECT_EQ(4096u, pool.borrowedBytes());
+
+    other = pool.borrow(100000);
+    EXPECT_EQ(131072u, pool.borrowedBytes());
+    EXPECT_EQ(4096u, pool.pooledBytes());
+}
+
+TEST_F(BufferPoolTest, shouldNotPoolBytesOverLimit)
+{
+    pool.borrow(48 * 1024);
+    pool.borrow(32 * 1024);
+
+    EXPECT_EQ(0u, pool.borrowedBytes());
+    EXPECT_EQ(64u * 1024, pool.pooledBytes());
+}
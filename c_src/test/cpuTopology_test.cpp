@@ -0,0 +1,51 @@
+/**
+ * @file cpuTopology_test.cpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#include "cpuTopology.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using namespace testing;
+using one::etls::CpuTopology;
+
+TEST(CpuTopologyTest, shouldParseCpuLists)
+{
+    EXPECT_EQ((std::vector<int>{0, 1, 2, 3, 8, 10, 11}),
+        CpuTopology::parseCpuList("0-3,8,10-11\n"));
+
+    EXPECT_EQ(std::vector<int>{}, CpuTopology::parseCpuList(""));
+}
+
+TEST(CpuTopologyTest, shouldMapCpusToNodes)
+{
+    CpuTopology topology{{{0, 1}, {2, 3}}};
+    EXPECT_EQ(2u, topology.nodes());
+    EXPECT_EQ(0u, topology.nodeOf(1));
+    EXPECT_EQ(1u, topology.nodeOf(2));
+    EXPECT_EQ(0u, topology.nodeOf(100));
+    EXPECT_EQ(0u, topology.nodeOf(-1));
+}
+
+TEST(CpuTopologyTest, shouldSpreadCpusOverNodes)
+{
+    CpuTopology topology{{{0, 1, 2}, {3, 4}}};
+    EXPECT_EQ((std::vector<int>{0, 3, 1, 4, 2}),
+        topology.spread({0, 1, 2, 3, 4}));
+
+    EXPECT_EQ((std::vector<int>{1, 4, 2}), topology.spread({1, 2, 4}));
+}
+
+TEST(CpuTopologyTest, shouldHaveAtLeastOneNode)
+{
+    EXPECT_EQ(1u, CpuTopology{{}}.nodes());
+    EXPECT_LE(1u, CpuTopology::instance().nodes());
+    EXPECT_GT(CpuTopology::instance().nodes(),
+        CpuTopology::instance().currentNode());
+}
@@ -0,0 +1,89 @@
+/**
+ * @file ioLoad_test.cpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#include "ioLoad.hpp"
+
+#include <asio/io_service.hpp>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+using namespace testing;
+
+struct IoLoadTest : public Test {
+    asio::io_service ioService{1};
+    asio::io_service otherService{1};
+    one::etls::IoLoad &load{asio::use_service<one::etls::IoLoad>(ioService)};
+    one::etls::IoLoad &otherLoad{
+        asio::use_service<one::etls::IoLoad>(otherService)};
+};
+
+TEST_F(IoLoadTest, shouldCountSockets)
+{
+    load.addSocket();
+    load.addSocket();
+    load.removeSocket();
+    EXPECT_EQ(1u, load.stats().sockets);
+}
+
+TEST_F(IoLoadTest, shouldMeasureRatesBetweenSamples)
+{
+    load.addBytes(1000);
+    EXPECT_EQ(0u, load.stats().bytesPerSecond);
+
+    load.sample();
+    load.addBytes(1000);
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    load.sample();
+
+    const auto stats = load.stats();
+    EXPECT_LT(0u, stats.bytesPerSecond);
+    EXPECT_GE(100000u, stats.bytesPerSecond);
+    EXPECT_LE(0.0, stats.busy);
+    EXPECT_GE(1.0, stats.busy);
+}
+
+TEST_F(IoLoadTest, shouldCountQueuedOperations)
+{
+    auto &queue = asio::use_service<one::etls::SubmissionQueue>(ioService);
+    queue.submit([] {});
+    queue.submit([] {});
+    EXPECT_EQ(2u, load.stats().queueDepth);
+
+    ioService.run();
+    EXPECT_EQ(0u, load.stats().queueDepth);
+}
+
+TEST_F(IoLoadTest, shouldCompareQueuesBeforeSockets)
+{
+    EXPECT_FALSE(load.lighterThan(otherLoad));
+    EXPECT_FALSE(otherLoad.lighterThan(load));
+
+    otherLoad.addSocket();
+    EXPECT_TRUE(load.lighterThan(otherLoad));
+
+    asio::use_service<one::etls::SubmissionQueue>(ioService).submit([] {});
+    EXPECT_TRUE(otherLoad.lighterThan(load));
+}
+
+TEST_F(IoLoadTest, shouldCountShedSockets)
+{
+    EXPECT_EQ(nullptr, load.shedTarget());
+
+    load.shed(&otherService, 2);
+    EXPECT_EQ(&otherService, load.shedTarget());
+    load.shedOne();
+    EXPECT_EQ(&otherService, load.shedTarget());
+    load.shedOne();
+    EXPECT_EQ(nullptr, load.shedTarget());
+
+    load.shed(&otherService, 1);
+    load.shed(nullptr, 1);
+    EXPECT_EQ(nullptr, load.shedTarget());
+}
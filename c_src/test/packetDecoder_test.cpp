@@ -0,0 +1,324 @@
+/**
+ * @file packetDecoder_test.cpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#include "packetDecoder.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace testing;
+using Packet = one::etls::PacketDecoder::Packet;
+using Type = one::etls::PacketDecoder::Type;
+
+namespace {
+std::string str(const asio::const_buffer &buffer)
+{
+    return {asio::buffer_cast<const char *>(buffer),
+        asio::buffer_size(buffer)};
+}
+
+std::string wsFrame(const unsigned int opcode, std::string payload,
+    const bool fin = true, const bool masked = true)
+{
+    const unsigned char key[] = {0x12, 0x34, 0x56, 0x78};
+    unsigned char header[one::etls::detail::maxWebSocketHeaderSize];
+    const auto size = one::etls::detail::encodeWebSocketHeader(
+        header, opcode, payload.size(), masked ? key : nullptr);
+
+    if (!fin)
+        header[0] &= 0x7F;
+
+    if (masked)
+        one::etls::detail::unmask(&payload[0], payload.size(), key);
+
+    return std::string{reinterpret_cast<char *>(header), size} + payload;
+}
+}
+
+struct PacketDecoderTest : public Test {
+    one::etls::PacketDecoder decoder{64};
+    std::vector<Packet> packets;
+
+    void feed(const std::string &data)
+    {
+        auto buffer = decoder.prepare();
+        ASSERT_LE(data.size(), asio::buffer_size(buffer));
+        std::memcpy(
+            asio::buffer_cast<char *>(buffer), data.data(), data.size());
+        decoder.commit(data.size());
+    }
+};
+
+TEST_F(PacketDecoderTest, shouldDecodeLines)
+{
+    decoder.setType(Type::line, 0);
+    feed("first\nsecond\nthi");
+
+    ASSERT_FALSE(decoder.decode(packets));
+    ASSERT_EQ(2u, packets.size());
+    EXPECT_EQ("first\n", str(packets[0].data));
+    EXPECT_EQ("second\n", str(packets[1].data));
+}
+
+TEST_F(PacketDecoderTest, shouldDecodeLinesSplitBetweenReads)
+{
+    decoder.setType(Type::line, 0);
+    feed("fir");
+    ASSERT_FALSE(decoder.decode(packets));
+    ASSERT_TRUE(packets.empty());
+
+    feed("st\n");
+    ASSERT_FALSE(decoder.decode(packets));
+    ASSERT_EQ(1u, packets.size());
+    EXPECT_EQ("first\n", str(packets[0].data));
+}
+
+TEST_F(PacketDecoderTest, shouldKeepDataAcrossConsume)
+{
+    decoder.setType(Type::line, 0);
+    for (int i = 0; i < 10; ++i) {
+        feed("0123456789abcdefghijklmnopqrstuvwxyz\n0123456789");
+        packets.clear();
+        ASSERT_FALSE(decoder.decode(packets));
+        ASSERT_EQ(1u, packets.size());
+        EXPECT_EQ(i == 0 ? "0123456789abcdefghijklmnopqrstuvwxyz\n"
+                         : "01234567890123456789abcdefghijklmnopqrstuvwxyz\n",
+            str(packets[0].data));
+        decoder.consume();
+    }
+}
+
+TEST_F(PacketDecoderTest, shouldFailOnTooLongLines)
+{
+    decoder.setType(Type::line, 8);
+    feed("short\n");
+    feed("waytoolong");
+
+    ASSERT_EQ(std::errc::message_size, decoder.decode(packets));
+    ASSERT_EQ(1u, packets.size());
+}
+
+TEST_F(PacketDecoderTest, shouldHandOverUndecodedData)
+{
+    decoder.setType(Type::line, 0);
+    feed("line\nrest");
+    ASSERT_FALSE(decoder.decode(packets));
+    decoder.consume();
+
+    std::string rest(10, '\0');
+    ASSERT_EQ(4u, decoder.take(asio::buffer(&rest[0], rest.size())));
+    EXPECT_EQ("rest", rest.substr(0, 4));
+    EXPECT_EQ(0u, decoder.buffered());
+}
+
+TEST_F(PacketDecoderTest, shouldDecodeHttpRequests)
+{
+    decoder.setType(Type::http, 0);
+    feed("\r\nGET /index.html HTTP/1.1\r\nHost:  example.com \r\n\r\n");
+
+    ASSERT_FALSE(decoder.decode(packets));
+    ASSERT_EQ(3u, packets.size());
+
+    EXPECT_EQ(Packet::Kind::httpRequest, packets[0].kind);
+    EXPECT_EQ("GET", str(packets[0].name));
+    EXPECT_EQ("/index.html", str(packets[0].value));
+    EXPECT_EQ(1u, packets[0].versionMajor);
+    EXPECT_EQ(1u, packets[0].versionMinor);
+
+    EXPECT_EQ(Packet::Kind::httpHeader, packets[1].kind);
+    EXPECT_EQ("Host", str(packets[1].name));
+    EXPECT_EQ("example.com", str(packets[1].value));
+
+    EXPECT_EQ(Packet::Kind::httpEoh, packets[2].kind);
+}
+
+TEST(PacketDecoderUriTest, shouldSplitUrisAsDecodePacket)
+{
+    using Uri = one::etls::PacketDecoder::Uri;
+    auto parse = [](const char *uri) {
+        return one::etls::PacketDecoder::parseUri(
+            asio::buffer(uri, std::strlen(uri)));
+    };
+
+    EXPECT_EQ(Uri::Kind::asterisk, parse("*").kind);
+    EXPECT_EQ(Uri::Kind::absPath, parse("/index.html").kind);
+    EXPECT_EQ("/index.html", str(parse("/index.html").path));
+
+    const auto http = parse("HTTP://example.com:8080/a/b?c");
+    EXPECT_EQ(Uri::Kind::absoluteUri, http.kind);
+    EXPECT_FALSE(http.https);
+    EXPECT_EQ("example.com", str(http.host));
+    EXPECT_EQ(8080u, http.port);
+    EXPECT_EQ("/a/b?c", str(http.path));
+
+    const auto https = parse("https://example.com");
+    EXPECT_EQ(Uri::Kind::absoluteUri, https.kind);
+    EXPECT_TRUE(https.https);
+    EXPECT_EQ("example.com", str(https.host));
+    EXPECT_EQ(0u, https.port);
+    EXPECT_EQ("", str(https.path));
+
+    EXPECT_EQ(0u, parse("http://example.com:80x/").port);
+    EXPECT_EQ(0u, parse("http://example.com:99999999999/").port);
+
+    const auto scheme = parse("ftp://example.com/file");
+    EXPECT_EQ(Uri::Kind::scheme, scheme.kind);
+    EXPECT_EQ("ftp", str(scheme.scheme));
+    EXPECT_EQ("//example.com/file", str(scheme.path));
+
+    EXPECT_EQ(Uri::Kind::string, parse("example.com").kind);
+    EXPECT_EQ("example.com", str(parse("example.com").path));
+}
+
+TEST_F(PacketDecoderTest, shouldDecodeHttpResponses)
+{
+    decoder.setType(Type::http, 0);
+    feed("HTTP/1.0 404 Not Found\r\n");
+
+    ASSERT_FALSE(decoder.decode(packets));
+    ASSERT_EQ(1u, packets.size());
+    EXPECT_EQ(Packet::Kind::httpResponse, packets[0].kind);
+    EXPECT_EQ(404u, packets[0].status);
+    EXPECT_EQ("Not Found", str(packets[0].value));
+    EXPECT_EQ(0u, packets[0].versionMinor);
+}
+
+TEST_F(PacketDecoderTest, shouldReportHttpErrors)
+{
+    decoder.setType(Type::httph, 0);
+    feed("not a header\r\n");
+
+    ASSERT_FALSE(decoder.decode(packets));
+    ASSERT_EQ(1u, packets.size());
+    EXPECT_EQ(Packet::Kind::httpError, packets[0].kind);
+    EXPECT_EQ("not a header", str(packets[0].value));
+}
+
+TEST_F(PacketDecoderTest, shouldDecodeWebSocketFrames)
+{
+    decoder.setType(Type::websocket, 0);
+    feed(wsFrame(1, "hello") + wsFrame(2, "world", true, false));
+
+    ASSERT_FALSE(decoder.decode(packets));
+    ASSERT_EQ(2u, packets.size());
+    EXPECT_EQ(1u, packets[0].opcode);
+    EXPECT_EQ("hello", str(packets[0].data));
+    EXPECT_EQ(2u, packets[1].opcode);
+    EXPECT_EQ("world", str(packets[1].data));
+}
+
+TEST_F(PacketDecoderTest, shouldDecodeLargeWebSocketFrames)
+{
+    decoder.setType(Type::websocket, 0);
+    const std::string payload(70000, 'x');
+    const auto frame = wsFrame(2, payload);
+
+    for (std::size_t i = 0; i < frame.size(); i += 64) {
+        ASSERT_FALSE(decoder.decode(packets));
+        ASSERT_TRUE(packets.empty());
+        feed(frame.substr(i, 64));
+    }
+
+    ASSERT_FALSE(decoder.decode(packets));
+    ASSERT_EQ(1u, packets.size());
+    EXPECT_EQ(payload, str(packets[0].data));
+}
+
+TEST_F(PacketDecoderTest, shouldReassembleFragmentedWebSocketMessages)
+{
+    decoder.setType(Type::websocket, 0);
+    feed(wsFrame(1, "frag", false) + wsFrame(9, "ping"));
+    feed(wsFrame(0, "men", false));
+
+    ASSERT_FALSE(decoder.decode(packets));
+    ASSERT_EQ(1u, packets.size());
+    EXPECT_EQ(9u, packets[0].opcode);
+    EXPECT_EQ("ping", str(packets[0].data));
+    decoder.consume();
+
+    feed(wsFrame(0, "ted"));
+    packets.clear();
+    ASSERT_FALSE(decoder.decode(packets));
+    ASSERT_EQ(1u, packets.size());
+    EXPECT_EQ(1u, packets[0].opcode);
+    EXPECT_EQ("fragmented", str(packets[0].data));
+}
+
+TEST_F(PacketDecoderTest, shouldLimitWebSocketMessageSize)
+{
+    decoder.setType(Type::websocket, 8);
+    feed(wsFrame(1, "12345", false) + wsFrame(0, "6789"));
+
+    ASSERT_EQ(std::errc::message_size, decoder.decode(packets));
+}
+
+TEST_F(PacketDecoderTest, shouldRejectHugeDeclaredWebSocketFrames)
+{
+    decoder.setType(Type::websocket, 0);
+
+    // An unmasked binary frame claiming 2^62 bytes of payload.
+    std::string header{"\x82\x7f", 2};
+    header += std::string{"\x40\0\0\0\0\0\0\0", 8};
+    feed(header);
+
+    ASSERT_EQ(std::errc::message_size, decoder.decode(packets));
+    EXPECT_GE(64u * 4, asio::buffer_size(decoder.prepare()));
+}
+
+TEST_F(PacketDecoderTest, shouldGrowBufferInStepsForLargeFrames)
+{
+    decoder.setType(Type::websocket, 0);
+    const auto frame = wsFrame(2, std::string(1024 * 1024, 'x'));
+    feed(frame.substr(0, 10));
+
+    ASSERT_FALSE(decoder.decode(packets));
+    EXPECT_GE(64u * 4, asio::buffer_size(decoder.prepare()));
+}
+
+TEST_F(PacketDecoderTest, shouldRejectMalformedWebSocketFrames)
+{
+    decoder.setType(Type::websocket, 0);
+    feed(wsFrame(0, "continuation without a message"));
+
+    ASSERT_EQ(std::errc::protocol_error, decoder.decode(packets));
+}
+
+TEST(UnmaskTest, shouldMatchScalarXor)
+{
+    const unsigned char key[] = {0xde, 0xad, 0xbe, 0xef};
+    for (std::size_t size = 0; size < 100; ++size) {
+        std::string data(size, 'a');
+        auto expected = data;
+        for (std::size_t i = 0; i < size; ++i)
+            expected[i] ^= key[i % 4];
+
+        one::etls::detail::unmask(&data[0], data.size(), key);
+        EXPECT_EQ(expected, data);
+    }
+}
+
+TEST(FindByteTest, shouldMatchMemchr)
+{
+    std::string data(300, 'a');
+    for (std::size_t begin = 0; begin < 40; ++begin) {
+        for (std::size_t pos = begin; pos < data.size(); pos += 7) {
+            data[pos] = '\n';
+            auto found = one::etls::detail::findByte(
+                data.data() + begin, data.data() + data.size(), '\n');
+            EXPECT_EQ(data.data() + pos, found);
+            data[pos] = 'a';
+        }
+
+        auto end = data.data() + data.size();
+        EXPECT_EQ(end, one::etls::detail::findByte(data.data() + begin, end,
+                           '\n'));
+    }
+}
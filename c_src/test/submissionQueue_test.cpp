@@ -0,0 +1,72 @@
+/**
+ * @file submissionQueue_test.cpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#include "submissionQueue.hpp"
+
+#include <asio/io_service.hpp>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace testing;
+
+struct SubmissionQueueTest : public Test {
+    asio::io_service ioService{1};
+    one::etls::SubmissionQueue &queue{
+        asio::use_service<one::etls::SubmissionQueue>(ioService)};
+};
+
+TEST_F(SubmissionQueueTest, shouldRunOperationsInOrderOfSubmission)
+{
+    std::vector<int> order;
+    for (int i = 0; i < 3000; ++i)
+        queue.submit([&order, i] { order.push_back(i); });
+
+    ioService.run();
+
+    ASSERT_EQ(3000u, order.size());
+    for (int i = 0; i < 3000; ++i)
+        EXPECT_EQ(i, order[i]);
+
+    EXPECT_EQ(3000u, queue.stats().submitted);
+    EXPECT_LT(0u, queue.stats().overflows);
+}
+
+TEST_F(SubmissionQueueTest, shouldWakeUpOnlyWhenNotAlreadyDraining)
+{
+    int ran = 0;
+    for (int i = 0; i < 100; ++i)
+        queue.submit([&ran] { ++ran; });
+
+    ioService.run();
+
+    EXPECT_EQ(100, ran);
+    EXPECT_EQ(1u, queue.stats().wakeups);
+    EXPECT_EQ(0u, queue.stats().overflows);
+}
+
+TEST_F(SubmissionQueueTest, shouldAcceptOperationsFromManyThreads)
+{
+    std::atomic<int> ran{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+        threads.emplace_back([&] {
+            for (int i = 0; i < 1000; ++i)
+                queue.submit([&ran] { ++ran; });
+        });
+
+    for (auto &thread : threads)
+        thread.join();
+
+    ioService.run();
+
+    EXPECT_EQ(4000, ran.load());
+    EXPECT_EQ(4000u, queue.stats().submitted);
+}
@@ -15,11 +15,16 @@
 #include <asio/ssl/context.hpp>
 #include <asio/ssl/stream.hpp>
 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
 #include <atomic>
 #include <chrono>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <thread>
+#include <vector>
 
 namespace {
 asio::ssl::context createContext()
@@ -38,12 +43,13 @@ class TestServer {
     using SSLSocket = asio::ssl::stream<asio::ip::tcp::socket>;
 
 public:
-    TestServer(const unsigned short port);
+    TestServer(const unsigned short port, const int maxSegment = 0);
     ~TestServer();
 
     bool waitForConnection(std::chrono::milliseconds timeout);
     void send(asio::const_buffer buffer);
     void receive(asio::mutable_buffer buffer);
+    std::vector<std::size_t> receiveRecords(asio::mutable_buffer buffer);
     void failConnection();
     void fail();
 
@@ -61,7 +67,7 @@ private:
     std::atomic<bool> m_failConnection{false};
 };
 
-TestServer::TestServer(const unsigned short port)
+TestServer::TestServer(const unsigned short port, const int maxSegment)
     : m_work{m_ioService}
     , m_acceptor{m_ioService,
           asio::ip::tcp::endpoint{asio::ip::tcp::v4(), port}}
@@ -69,6 +75,14 @@ TestServer::TestServer(const unsigned short port)
     , m_session{m_ioService, m_context}
 {
     m_acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+
+    // The segment size is advertised to connecting clients, which size
+    // their records after it.
+    if (maxSegment > 0)
+        m_acceptor.set_option(
+            asio::detail::socket_option::integer<IPPROTO_TCP, TCP_MAXSEG>{
+                maxSegment});
+
     m_thread = std::thread{[this] {
         try {
             m_ioService.run();
@@ -134,6 +148,36 @@ void TestServer::receive(asio::mutable_buffer buffer)
         std::this_thread::sleep_for(std::chrono::milliseconds{1});
 }
 
+std::vector<std::size_t> TestServer::receiveRecords(
+    asio::mutable_buffer buffer)
+{
+    // A read returns data of a single record, so the sizes of reads are the
+    // sizes of records' payloads, save for the last one if it doesn't fit.
+    std::vector<std::size_t> records;
+    std::atomic<bool> done{false};
+    std::function<void()> readRecord = [&] {
+        m_session.async_read_some(
+            asio::mutable_buffers_1{buffer}, [&](auto ec, auto read) {
+                if (ec)
+                    throw std::system_error{ec};
+
+                records.emplace_back(read);
+                buffer = buffer + read;
+                if (asio::buffer_size(buffer) == 0)
+                    done = true;
+                else
+                    readRecord();
+            });
+    };
+
+    asio::post(m_ioService, readRecord);
+
+    while (!done)
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+
+    return records;
+}
+
 void TestServer::failConnection() { m_failConnection = true; }
 
 void TestServer::fail() { m_session.lowest_layer().close(); }
@@ -29,8 +29,10 @@ std::default_random_engine &engine()
 
 unsigned short randomPort()
 {
+    // Ports below the usual ephemeral range can't collide with outgoing
+    // connections of earlier tests, lingering in TIME_WAIT.
     static thread_local std::uniform_int_distribution<unsigned short> dist{
-        1025, 65535};
+        1025, 32767};
     return dist(engine());
 }
 
@@ -6,6 +6,7 @@
  * 'LICENSE.md'
  */
 
+#include "allocationCounter.hpp"
 #include "callback.hpp"
 #include "testUtils.hpp"
 #include "tlsAcceptor.hpp"
@@ -14,6 +15,7 @@
 
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <thread>
 #include <vector>
 
@@ -140,6 +142,36 @@ TEST_F(TLSAcceptorTestC, shouldReturnClient_ServerCommunicableSockets)
     ASSERT_EQ(recvData, sentData);
 }
 
+TEST_F(TLSAcceptorTestC, shouldNotAllocateWhenSendingAndReceiving)
+{
+    std::vector<char> sentData(1000, 'x');
+    std::vector<char> recvData(sentData.size());
+
+    auto exchange = [&] {
+        std::atomic<bool> dataSent{false};
+        std::atomic<bool> dataReceived{false};
+
+        ssock->recvAsync(ssock, asio::buffer(recvData),
+            {[&](auto) { dataReceived = true; }, [](auto) {}});
+        csock->sendAsync(csock, asio::buffer(sentData),
+            {[&] { dataSent = true; }, [](auto) {}});
+
+        waitFor(dataSent);
+        waitFor(dataReceived);
+    };
+
+    // Warm up thread-local caches and the sockets' arenas.
+    for (int i = 0; i < 3; ++i)
+        exchange();
+
+    const auto before = allocationCount();
+    for (int i = 0; i < 10; ++i)
+        exchange();
+
+    EXPECT_EQ(0u, allocationCount() - before);
+    EXPECT_EQ(recvData, sentData);
+}
+
 TEST_F(TLSAcceptorTest, shouldReturnLocalEndpoint)
 {
     asio::ip::tcp::endpoint endpoint;
@@ -155,3 +187,40 @@ TEST_F(TLSAcceptorTest, shouldReturnLocalEndpoint)
     ASSERT_EQ("0.0.0.0", endpoint.address().to_string());
     ASSERT_EQ(port, endpoint.port());
 }
+
+TEST_F(TLSAcceptorTest, shouldReportAcceptedSocketFootprint)
+{
+    constexpr std::size_t connections = 10;
+
+    asio::io_service ioService;
+    std::vector<asio::ip::tcp::socket> clients;
+    std::vector<one::etls::TLSSocket::Ptr> sockets;
+    clients.reserve(connections + 1);
+    sockets.reserve(connections + 1);
+
+    // The first connection warms up the pools and isn't counted.
+    std::size_t counted = 0;
+    for (std::size_t i = 0; i <= connections; ++i) {
+        clients.emplace_back(ioService);
+        clients.back().connect(
+            {asio::ip::address::from_string(host), port});
+
+        std::atomic<bool> acceptCalled{false};
+        const auto before = allocationCount();
+        acceptor->acceptAsync(acceptor, {[&](one::etls::TLSSocket::Ptr s) {
+            sockets.emplace_back(std::move(s));
+            acceptCalled = true;
+        },
+                                         [](auto) {}});
+
+        ASSERT_TRUE(waitFor(acceptCalled));
+        if (i > 0)
+            counted += allocationCount() - before;
+    }
+
+    const auto perConnection = counted / connections;
+    RecordProperty("SocketSize", sizeof(one::etls::TLSSocket));
+    RecordProperty("AllocationsPerConnection", perConnection);
+
+    EXPECT_GE(2u, perConnection);
+}
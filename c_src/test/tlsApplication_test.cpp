@@ -0,0 +1,204 @@
+/**
+ * @file tlsApplication_test.cpp
+ * @author Konrad Zemek
+ * @copyright (C) 2016 ACK CYFRONET AGH
+ * @copyright This software is released under the MIT license cited in
+ * 'LICENSE.md'
+ */
+
+#include "tlsApplication.hpp"
+
+#include <gtest/gtest.h>
+
+#include <dirent.h>
+#include <poll.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <future>
+#include <thread>
+
+using namespace testing;
+using Engine = one::etls::TLSApplication::Engine;
+
+namespace {
+
+bool readable(const int fd, const int timeoutMs)
+{
+    pollfd pfd{fd, POLLIN, 0};
+    return ::poll(&pfd, 1, timeoutMs) == 1 && (pfd.revents & POLLIN);
+}
+
+std::size_t threadCount()
+{
+    std::size_t count = 0;
+    if (auto dir = ::opendir("/proc/self/task")) {
+        while (auto entry = ::readdir(dir))
+            if (entry->d_name[0] != '.')
+                ++count;
+
+        ::closedir(dir);
+    }
+
+    return count;
+}
+
+} // namespace
+
+TEST(TLSApplicationTest, shouldRunServicesOnThreadsByDefault)
+{
+    one::etls::TLSApplication app{2};
+    EXPECT_EQ(Engine::threads, app.engine());
+    EXPECT_EQ(2u, app.size());
+}
+
+TEST(TLSApplicationTest, shouldStartThreadsOnFirstUse)
+{
+    const auto before = threadCount();
+    one::etls::TLSApplication app{2};
+    EXPECT_EQ(before, threadCount());
+
+    app.ioService();
+    EXPECT_EQ(before + 2, threadCount());
+}
+
+TEST(TLSApplicationTest, shouldResizeThePool)
+{
+    one::etls::TLSApplication app{2};
+    EXPECT_NE(&app.ioService(), &app.ioService());
+
+    EXPECT_EQ(1u, app.resize(1));
+    EXPECT_EQ(1u, app.size());
+    EXPECT_EQ(&app.ioService(), &app.ioService());
+
+    EXPECT_EQ(2u, app.resize(2));
+    EXPECT_NE(&app.ioService(), &app.ioService());
+
+    EXPECT_EQ(1u, app.resize(0));
+    EXPECT_EQ(std::max<std::size_t>(2, std::thread::hardware_concurrency()),
+        app.resize(100000));
+}
+
+TEST(TLSApplicationTest, shouldLimitDefaultThreadsToAvailableCpus)
+{
+    const auto cpus = one::etls::TLSApplication::availableCpus();
+    EXPECT_LE(1u, cpus);
+    EXPECT_GE(std::max(std::thread::hardware_concurrency(), 1u), cpus);
+
+    one::etls::TLSApplication app;
+    EXPECT_EQ(cpus, app.size());
+}
+
+TEST(TLSApplicationTest, shouldPinThreadsToCpus)
+{
+    one::etls::TLSApplication::Config config;
+    config.ioThreads = 1;
+    config.cpus = {0};
+    one::etls::TLSApplication app{config};
+
+    std::promise<cpu_set_t> affinity;
+    app.ioService().post([&] {
+        cpu_set_t set;
+        sched_getaffinity(0, sizeof(set), &set);
+        affinity.set_value(set);
+    });
+
+    auto set = affinity.get_future().get();
+    EXPECT_EQ(1, CPU_COUNT(&set));
+    EXPECT_TRUE(CPU_ISSET(0, &set));
+}
+
+TEST(TLSApplicationTest, shouldPairThreadsWithServices)
+{
+    one::etls::TLSApplication::Config config;
+    config.ioThreads = 2;
+    config.placement = one::etls::TLSApplication::Placement::scheduler;
+    one::etls::TLSApplication app{config};
+
+    auto &paired = app.ioService();
+    EXPECT_EQ(&paired, &app.ioService());
+    EXPECT_EQ(2u, app.resize(1));
+
+    asio::io_service *other = nullptr;
+    std::thread{[&] { other = &app.ioService(); }}.join();
+    EXPECT_NE(&paired, other);
+
+    std::promise<asio::io_service *> own;
+    other->post([&] { own.set_value(&app.ioService()); });
+    EXPECT_EQ(other, own.get_future().get());
+}
+
+TEST(TLSApplicationTest, shouldPlaceSocketsOnLeastLoadedService)
+{
+    one::etls::TLSApplication::Config config;
+    config.ioThreads = 3;
+    config.placement = one::etls::TLSApplication::Placement::leastLoaded;
+    one::etls::TLSApplication app{config};
+
+    for (int i = 0; i < 6; ++i)
+        asio::use_service<one::etls::IoLoad>(app.ioService()).addSocket();
+
+    const auto loads = app.loads();
+    ASSERT_EQ(3u, loads.size());
+    for (const auto &load : loads)
+        EXPECT_EQ(2u, load.sockets);
+}
+
+TEST(TLSApplicationTest, shouldShedSocketsOfBusyService)
+{
+    one::etls::TLSApplication::Config config;
+    config.ioThreads = 2;
+    config.rebalance = true;
+    one::etls::TLSApplication app{config};
+
+    auto &busy = app.ioService();
+    auto &idle = app.ioService();
+    for (int i = 0; i < 4; ++i)
+        asio::use_service<one::etls::IoLoad>(busy).addSocket();
+
+    // The thread's first rebalancing, a second after it started, follows a
+    // sample taken over this work.
+    busy.post([] {
+        const auto end =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds{1200};
+        while (std::chrono::steady_clock::now() < end) {
+        }
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds{1400});
+
+    std::promise<asio::io_service *> target;
+    busy.post([&] {
+        target.set_value(
+            asio::use_service<one::etls::IoLoad>(busy).shedTarget());
+    });
+
+    EXPECT_EQ(&idle, target.get_future().get());
+}
+
+TEST(TLSApplicationTest, shouldSignalPolledServiceOnSubmission)
+{
+    one::etls::TLSApplication app{1, Engine::select};
+    ASSERT_EQ(Engine::select, app.engine());
+
+    const auto fd = app.pollDescriptor(0);
+    ASSERT_LE(0, fd);
+    while (app.pollOne(0)) {
+    }
+
+    EXPECT_FALSE(readable(fd, 0));
+
+    bool ran = false;
+    std::thread submitter{[&] {
+        asio::use_service<one::etls::SubmissionQueue>(app.ioService())
+            .submit([&] { ran = true; });
+    }};
+    submitter.join();
+
+    ASSERT_TRUE(readable(fd, 1000));
+    while (app.pollOne(0)) {
+    }
+
+    EXPECT_TRUE(ran);
+    EXPECT_FALSE(readable(fd, 0));
+}
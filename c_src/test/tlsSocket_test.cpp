@@ -6,6 +6,7 @@
  * 'LICENSE.md'
  */
 
+#include "bufferPool.hpp"
 #include "testServer.hpp"
 #include "testUtils.hpp"
 #include "tlsApplication.hpp"
@@ -13,10 +14,22 @@
 
 #include <gtest/gtest.h>
 
+#include <linux/tls.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <numeric>
 #include <string>
 #include <thread>
 #include <vector>
@@ -24,6 +37,71 @@
 using namespace std::literals;
 using namespace testing;
 
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+namespace {
+/// The largest write passed at once to the socket by a TLS stream.
+std::atomic<std::size_t> largestSend{0};
+
+/**
+ * @returns Whether the kernel can process TLS records.
+ */
+bool kernelTlsAvailable()
+{
+    std::ifstream available{"/proc/sys/net/ipv4/tcp_available_ulp"};
+    std::string ulp;
+    while (available >> ulp)
+        if (ulp == "tls")
+            return true;
+
+    return false;
+}
+
+/**
+ * @returns Number of the process's sockets whose records are processed by
+ * the kernel in both directions.
+ */
+std::size_t kernelTlsSockets()
+{
+    std::size_t count = 0;
+    for (int fd = 0; fd < 1024; ++fd) {
+        char ulp[16] = {};
+        socklen_t size = sizeof(ulp);
+        if (::getsockopt(fd, IPPROTO_TCP, TCP_ULP, ulp, &size) != 0 ||
+            std::strcmp(ulp, "tls") != 0)
+            continue;
+
+        // The crypto state of a direction can only be read once it's set.
+        char info[128];
+        size = sizeof(info);
+        const bool tx = ::getsockopt(fd, SOL_TLS, TLS_TX, info, &size) == 0;
+        size = sizeof(info);
+        const bool rx = ::getsockopt(fd, SOL_TLS, TLS_RX, info, &size) == 0;
+        if (tx && rx)
+            ++count;
+    }
+
+    return count;
+}
+}
+
+// Replaces the libc function for the test executable, so that the stream's
+// writes can be observed; asio's own writes go through sendmsg.
+extern "C" ssize_t send(int fd, const void *buf, size_t len, int flags)
+{
+    auto largest = largestSend.load();
+    while (len > largest && !largestSend.compare_exchange_weak(largest, len))
+        ;
+
+    return ::syscall(SYS_sendto, fd, buf, len, flags, nullptr, 0);
+}
+
 struct TLSSocketTest : public Test {
     std::string host{"127.0.0.1"};
     unsigned short port{randomPort()};
@@ -45,6 +123,7 @@ struct TLSSocketTestC : public TLSSocketTest {
         socket->connectAsync(
             socket, host, port, {[&](auto) { connected = true; }, [](auto) {}});
         waitFor(connected);
+        server.waitForConnection(5s);
     }
 };
 
@@ -86,6 +165,213 @@ TEST_F(TLSSocketTestC, shouldSendMessages)
     ASSERT_EQ(data, received);
 }
 
+TEST_F(TLSSocketTestC, shouldSendMessagesWithCustomRecordSize)
+{
+    // Sizes are clamped to the range allowed by TLS; 0 sizes records
+    // dynamically, with full-sized ones on a loopback.
+    const std::vector<std::pair<int, std::size_t>> recordSizes{
+        {0, 16384}, {1, 512}, {4096, 4096}, {1 << 20, 16384}};
+
+    for (const auto &recordSize : recordSizes) {
+        socket->setOptionAsync(socket,
+            one::etls::TLSSocket::Option::recordSize, recordSize.first);
+
+        std::vector<char> data(100 * 1024);
+        std::iota(data.begin(), data.end(), recordSize.first);
+        socket->sendAsync(socket, asio::buffer(data), {[] {}, [](auto) {}});
+
+        std::vector<char> received(data.size());
+        const auto records = server.receiveRecords(asio::buffer(received));
+
+        ASSERT_EQ(data, received);
+        EXPECT_EQ(recordSize.second,
+            *std::max_element(records.begin(), records.end()));
+    }
+}
+
+TEST_F(TLSSocketTestC, shouldSendMessagesWithCustomWriteWindow)
+{
+    // A full record with its header and authentication tag.
+    constexpr std::size_t record = 16384 + 5 + 8 + 16;
+
+    for (const auto writeWindow : {0, 1, 3, 64}) {
+        socket->setOptionAsync(
+            socket, one::etls::TLSSocket::Option::writeWindow, writeWindow);
+
+        std::vector<char> data(1024 * 1024);
+        std::iota(data.begin(), data.end(), writeWindow);
+        largestSend = 0;
+        socket->sendAsync(socket, asio::buffer(data), {[] {}, [](auto) {}});
+
+        std::vector<char> received(data.size());
+        server.receive(asio::buffer(received));
+
+        ASSERT_EQ(data, received);
+
+        // Records of a window are flushed to the socket together.
+        const std::size_t window = std::max(writeWindow, 1);
+        EXPECT_GE(window * record, largestSend);
+        EXPECT_LT((window - 1) * record, largestSend);
+    }
+}
+
+TEST_F(TLSSocketTestC, shouldSendMessagesWithParallelEncryption)
+{
+    for (const auto sealWorkers : {2, 3, 8}) {
+        socket->setOptionAsync(
+            socket, one::etls::TLSSocket::Option::sealWorkers, sealWorkers);
+
+        // Records are sealed by the worker pool, so a send can't complete
+        // while all the workers are busy.
+        std::promise<void> release;
+        auto released = release.get_future().share();
+        std::atomic<std::size_t> blocked{0};
+        for (std::size_t i = 0; i < app.size(); ++i)
+            asio::post(app.workerService(), [&blocked, released] {
+                ++blocked;
+                released.wait();
+            });
+        ASSERT_TRUE(waitFor([&] { return blocked == app.size(); }));
+
+        std::vector<char> data(4 * 1024 * 1024 + 123);
+        std::iota(data.begin(), data.end(), sealWorkers);
+        std::atomic<bool> sent{false};
+        socket->sendAsync(
+            socket, asio::buffer(data), {[&] { sent = true; }, [](auto) {}});
+
+        std::this_thread::sleep_for(200ms);
+        EXPECT_FALSE(sent);
+        release.set_value();
+
+        std::vector<char> received(data.size());
+        server.receive(asio::buffer(received));
+
+        ASSERT_EQ(data, received);
+        ASSERT_TRUE(waitFor(sent));
+    }
+}
+
+TEST(TLSSocketRecordSizeTest, shouldSizeRecordsByTrafficWhenNotSet)
+{
+    one::etls::TLSApplication app{1};
+    const auto port = randomPort();
+    TestServer server{port, 1000};
+    auto socket = std::make_shared<one::etls::TLSSocket>(app);
+
+    std::atomic<bool> called{false};
+    socket->connectAsync(socket, "127.0.0.1", port,
+        {[&](auto) { called = true; }, [](auto) {}});
+    ASSERT_TRUE(waitFor(called));
+    ASSERT_TRUE(server.waitForConnection(5s));
+
+    for (const auto round : {0, 1}) {
+        std::vector<char> data(256 * 1024);
+        std::iota(data.begin(), data.end(), round);
+        called = false;
+        socket->sendAsync(
+            socket, asio::buffer(data), {[&] { called = true; }, [](auto) {}});
+
+        std::vector<char> received(data.size());
+        const auto records = server.receiveRecords(asio::buffer(received));
+        ASSERT_EQ(data, received);
+        ASSERT_TRUE(waitFor(called));
+
+        // A fresh or idle connection starts with records fitting in a
+        // segment, and switches to full-sized ones after 64 KB.
+        const auto full =
+            std::find(records.begin(), records.end(), 16384u);
+        ASSERT_NE(records.end(), full);
+        EXPECT_LE(64u * 1024, std::accumulate(records.begin(), full, 0u));
+        for (auto it = records.begin(); it != full; ++it)
+            EXPECT_GE(1000u, *it);
+
+        std::this_thread::sleep_for(1100ms);
+    }
+}
+
+TEST_F(TLSSocketTestC, shouldSendFiles)
+{
+    std::vector<char> data(1024 * 1024 + 123);
+    std::iota(data.begin(), data.end(), 0);
+
+    char path[] = "/tmp/etls_sendfile_XXXXXX";
+    const auto fd = ::mkstemp(path);
+    ASSERT_LE(0, fd);
+    ::unlink(path);
+    ASSERT_EQ(static_cast<ssize_t>(data.size()),
+        ::write(fd, data.data(), data.size()));
+
+    std::atomic<std::size_t> sent{0};
+    socket->sendFileAsync(socket, fd, 100, 0,
+        {[&](std::size_t s) { sent = s; }, [](auto) {}});
+    ::close(fd);
+
+    std::vector<char> received(data.size() - 100);
+    server.receive(asio::buffer(received));
+
+    ASSERT_TRUE(waitFor([&] { return sent == received.size(); }));
+    ASSERT_TRUE(
+        std::equal(received.begin(), received.end(), data.begin() + 100));
+}
+
+TEST_F(TLSSocketTestC, shouldSendFilesByPath)
+{
+    std::vector<char> data(100 * 1024);
+    std::iota(data.begin(), data.end(), 0);
+
+    char path[] = "/tmp/etls_sendfile_XXXXXX";
+    const auto fd = ::mkstemp(path);
+    ASSERT_LE(0, fd);
+    ASSERT_EQ(static_cast<ssize_t>(data.size()),
+        ::write(fd, data.data(), data.size()));
+    ::close(fd);
+
+    std::atomic<std::size_t> sent{0};
+    socket->sendFileAsync(socket, std::string{path}, 10, 1000,
+        {[&](std::size_t s) { sent = s; }, [](auto) {}});
+
+    std::vector<char> received(1000);
+    server.receive(asio::buffer(received));
+    ::unlink(path);
+
+    ASSERT_TRUE(waitFor([&] { return sent == received.size(); }));
+    ASSERT_TRUE(
+        std::equal(received.begin(), received.end(), data.begin() + 10));
+}
+
+TEST_F(TLSSocketTestC, shouldNotifyOnSendFileError)
+{
+    std::atomic<bool> called{false};
+
+    socket->sendFileAsync(socket, std::string{"/nonexistent/etls"}, 0, 0,
+        {[](std::size_t) {}, [&](auto) { called = true; }});
+
+    ASSERT_TRUE(waitFor(called));
+}
+
+TEST_F(TLSSocketTestC, shouldReturnBuffersWhenIdle)
+{
+    auto &pool = one::etls::BufferPool::instance();
+
+    std::vector<char> data(256 * 1024);
+    std::iota(data.begin(), data.end(), 0);
+    socket->sendAsync(socket, asio::buffer(data), {[] {}, [](auto) {}});
+
+    std::vector<char> received(data.size());
+    server.receive(asio::buffer(received));
+    ASSERT_EQ(data, received);
+
+    std::atomic<bool> called{false};
+    socket->recvAsync(socket, asio::buffer(received),
+        {[&](auto) { called = true; }, [](auto) {}});
+    server.send(asio::buffer(data));
+
+    ASSERT_TRUE(waitFor(called));
+    ASSERT_EQ(data, received);
+    EXPECT_EQ(0u, pool.borrowedBytes());
+    EXPECT_LT(0u, pool.pooledBytes());
+}
+
 TEST_F(TLSSocketTestC, shouldNotifyOnSuccessfulSend)
 {
     std::atomic<bool> called{false};
@@ -192,6 +478,282 @@ TEST_F(TLSSocketTestC, shouldNotifyOnRecvAnySuccess)
     ASSERT_TRUE(waitFor(called));
 }
 
+TEST_F(TLSSocketTestC, shouldReceiveMultipleRecordsAtOnce)
+{
+    std::atomic<bool> called{false};
+    asio::mutable_buffer buffer;
+
+    std::vector<char> data(64 * 1024);
+    std::iota(data.begin(), data.end(), 0);
+    server.send(asio::buffer(data));
+
+    std::vector<char> received(data.size());
+    socket->recvAnyAsync(socket, asio::buffer(received), {[&](auto b) {
+        buffer = b;
+        called = true;
+    },
+                                                          [](auto) {}});
+
+    ASSERT_TRUE(waitFor(called));
+    ASSERT_LT(16u * 1024, asio::buffer_size(buffer));
+    ASSERT_EQ(0, memcmp(asio::buffer_cast<char *>(buffer), data.data(),
+                     asio::buffer_size(buffer)));
+}
+
+TEST_F(TLSSocketTestC, shouldAdaptRecvBufferSize)
+{
+    socket->setOptionAsync(
+        socket, one::etls::TLSSocket::Option::recvBufferMin, 1024);
+
+    auto recvAny = [&] {
+        std::atomic<bool> called{false};
+        std::size_t read = 0;
+        std::vector<char> buffer(socket->recvBufferSize());
+        socket->recvAnyAsync(socket, asio::buffer(buffer), {[&](auto b) {
+            read = asio::buffer_size(b);
+            called = true;
+        },
+                                                               [](auto) {}});
+        waitFor(called);
+        return read;
+    };
+
+    const std::string message{"ping"};
+    for (int i = 0; i < 40; ++i) {
+        server.send(asio::buffer(message));
+        ASSERT_EQ(message.size(), recvAny());
+    }
+
+    EXPECT_EQ(1024u, socket->recvBufferSize());
+
+    std::vector<char> data(64 * 1024);
+    server.send(asio::buffer(data));
+    for (std::size_t received = 0; received < data.size();)
+        received += recvAny();
+
+    std::atomic<bool> called{false};
+    one::etls::TLSSocket::Stats stats{};
+    socket->statsAsync(socket, {[&](auto &s) {
+        stats = s;
+        called = true;
+    },
+                                   [](auto) {}});
+
+    ASSERT_TRUE(waitFor(called));
+    EXPECT_LT(1024u, stats.recvBuffer);
+    EXPECT_EQ(socket->recvBufferSize(), stats.recvBuffer);
+}
+
+TEST_F(TLSSocketTestC, shouldReceiveDecryptedDataSynchronously)
+{
+    auto recv = [&](std::string &data) {
+        std::atomic<bool> called{false};
+        socket->recvAsync(socket, asio::buffer(&data[0], data.size()),
+            {[&](auto) { called = true; }, [](auto) {}});
+        return waitFor(called);
+    };
+
+    server.send(asio::buffer(std::string{"firstsecondthird"}));
+
+    std::string first(5, '\0');
+    ASSERT_TRUE(recv(first));
+    EXPECT_EQ("first", first);
+    EXPECT_EQ(11u, socket->bufferedBytes());
+
+    std::string second(6, '\0');
+    EXPECT_EQ(0u, socket->tryRecv(asio::buffer(&second[0], 12), true));
+    EXPECT_EQ(6u, socket->tryRecv(asio::buffer(&second[0], 6), true));
+    EXPECT_EQ("second", second);
+
+    std::string third(5, '\0');
+    ASSERT_TRUE(recv(third));
+    EXPECT_EQ("third", third);
+    EXPECT_EQ(0u, socket->bufferedBytes());
+}
+
+TEST_F(TLSSocketTestC, shouldSendSmallMessagesSynchronously)
+{
+    const std::string small{"small message"};
+    ASSERT_TRUE(socket->trySend(asio::buffer(small)));
+
+    std::string received(small.size(), '\0');
+    server.receive(asio::buffer(&received[0], received.size()));
+    EXPECT_EQ(small, received);
+
+    std::vector<char> large(one::etls::TLSSocket::maxSyncSendSize + 1);
+    std::iota(large.begin(), large.end(), 0);
+    ASSERT_FALSE(socket->trySend(asio::buffer(large)));
+
+    std::atomic<bool> called{false};
+    socket->sendAsync(socket, asio::buffer(large),
+        {[&] { called = true; }, [](auto) {}});
+    ASSERT_TRUE(waitFor(called));
+
+    std::vector<char> receivedLarge(large.size());
+    server.receive(asio::buffer(receivedLarge));
+    EXPECT_EQ(large, receivedLarge);
+}
+
+TEST(TLSSocketSyncSendTest, shouldSizeAndCountSynchronousSends)
+{
+    one::etls::TLSApplication app{1};
+    const auto port = randomPort();
+    TestServer server{port, 1000};
+    auto socket = std::make_shared<one::etls::TLSSocket>(app);
+
+    std::atomic<bool> called{false};
+    socket->connectAsync(socket, "127.0.0.1", port,
+        {[&](auto) { called = true; }, [](auto) {}});
+    ASSERT_TRUE(waitFor(called));
+    ASSERT_TRUE(server.waitForConnection(5s));
+
+    // A bulk transfer switches the socket to full-sized records.
+    std::vector<char> bulk(100 * 1024);
+    std::iota(bulk.begin(), bulk.end(), 0);
+    called = false;
+    socket->sendAsync(
+        socket, asio::buffer(bulk), {[&] { called = true; }, [](auto) {}});
+
+    std::vector<char> receivedBulk(bulk.size());
+    server.receive(asio::buffer(receivedBulk));
+    ASSERT_TRUE(waitFor(called));
+
+    // After an idle period, records fit in a segment again.
+    std::this_thread::sleep_for(1100ms);
+    const auto before = app.loads()[0].bytes;
+
+    std::vector<char> small(3000);
+    std::iota(small.begin(), small.end(), 1);
+    ASSERT_TRUE(socket->trySend(asio::buffer(small)));
+
+    std::vector<char> received(small.size());
+    const auto records = server.receiveRecords(asio::buffer(received));
+    EXPECT_EQ(small, received);
+    EXPECT_LT(1u, records.size());
+    for (const auto record : records)
+        EXPECT_GE(1000u, record);
+
+    EXPECT_EQ(before + small.size(), app.loads()[0].bytes);
+}
+
+TEST_F(TLSSocketTestC, shouldReceiveMessagesWithCustomReadAhead)
+{
+    for (const auto readAhead : {0, 1, 1000, 1 << 20}) {
+        socket->setOptionAsync(
+            socket, one::etls::TLSSocket::Option::readAhead, readAhead);
+
+        std::atomic<bool> called{false};
+        std::vector<char> data(100 * 1024);
+        std::iota(data.begin(), data.end(), readAhead);
+        server.send(asio::buffer(data));
+
+        std::vector<char> received(data.size());
+        socket->recvAsync(socket, asio::buffer(received),
+            {[&](auto) { called = true; }, [](auto) {}});
+
+        ASSERT_TRUE(waitFor(called));
+        ASSERT_EQ(data, received);
+    }
+}
+
+TEST_F(TLSSocketTestC, shouldReceiveMessagesWithPipelinedRecv)
+{
+    socket->setOptionAsync(
+        socket, one::etls::TLSSocket::Option::pipelinedRecv, 1);
+
+    for (const auto size : {100, 100 * 1024, 4 * 1024 * 1024 + 123}) {
+        // Records are decrypted by the worker pool, so a receive can't
+        // complete while all the workers are busy.
+        std::promise<void> release;
+        auto released = release.get_future().share();
+        std::atomic<std::size_t> blocked{0};
+        for (std::size_t i = 0; i < app.size(); ++i)
+            asio::post(app.workerService(), [&blocked, released] {
+                ++blocked;
+                released.wait();
+            });
+        ASSERT_TRUE(waitFor([&] { return blocked == app.size(); }));
+
+        std::atomic<bool> called{false};
+        std::vector<char> data(size);
+        std::iota(data.begin(), data.end(), size);
+
+        std::vector<char> received(data.size());
+        socket->recvAsync(socket, asio::buffer(received),
+            {[&](auto) { called = true; }, [](auto) {}});
+
+        // The socket stops reading once its pipeline is full, so a large
+        // message is sent in the background.
+        auto sent = std::async(
+            std::launch::async, [&] { server.send(asio::buffer(data)); });
+
+        std::this_thread::sleep_for(200ms);
+        EXPECT_FALSE(called);
+        release.set_value();
+
+        sent.get();
+        ASSERT_TRUE(waitFor(called));
+        ASSERT_EQ(data, received);
+    }
+}
+
+TEST_F(TLSSocketTestC, shouldSendAndReceiveWithKernelTls)
+{
+    // Without kernel support the stream silently falls back to processing
+    // records itself, which the other tests already cover.
+    if (!kernelTlsAvailable()) {
+        std::cout << "Skipped: the kernel has no TLS upper layer protocol"
+                  << std::endl;
+        return;
+    }
+
+    socket->setOptionAsync(socket, one::etls::TLSSocket::Option::kernelTls, 1);
+
+    for (const auto size : {100, 100 * 1024}) {
+        std::vector<char> data(size);
+        std::iota(data.begin(), data.end(), size);
+        socket->sendAsync(socket, asio::buffer(data), {[] {}, [](auto) {}});
+
+        std::vector<char> received(data.size());
+        server.receive(asio::buffer(received));
+        ASSERT_EQ(data, received);
+
+        std::atomic<bool> called{false};
+        std::fill(received.begin(), received.end(), 0);
+        socket->recvAsync(socket, asio::buffer(received),
+            {[&](auto) { called = true; }, [](auto) {}});
+        server.send(asio::buffer(data));
+
+        ASSERT_TRUE(waitFor(called));
+        ASSERT_EQ(data, received);
+    }
+
+    EXPECT_EQ(1u, kernelTlsSockets());
+
+    // Files are sent by the kernel with sendfile.
+    std::vector<char> data(1024 * 1024 + 123);
+    std::iota(data.begin(), data.end(), 0);
+
+    char path[] = "/tmp/etls_sendfile_XXXXXX";
+    const auto fd = ::mkstemp(path);
+    ASSERT_LE(0, fd);
+    ::unlink(path);
+    ASSERT_EQ(static_cast<ssize_t>(data.size()),
+        ::write(fd, data.data(), data.size()));
+
+    std::atomic<std::size_t> sent{0};
+    socket->sendFileAsync(socket, fd, 100, 0,
+        {[&](std::size_t s) { sent = s; }, [](auto) {}});
+
+    std::vector<char> received(data.size() - 100);
+    server.receive(asio::buffer(received));
+    ::close(fd);
+
+    ASSERT_TRUE(waitFor([&] { return sent == received.size(); }));
+    ASSERT_TRUE(
+        std::equal(received.begin(), received.end(), data.begin() + 100));
+}
+
 TEST_F(TLSSocketTest, shouldNotifyOnRecvAnyError)
 {
     std::atomic<bool> called{false};
@@ -255,3 +817,199 @@ TEST_F(TLSSocketTestC, shouldBeShutdownable)
 
     ASSERT_TRUE(waitFor(sendCalled));
 }
+
+TEST_F(TLSSocketTestC, shouldReceiveLinePackets)
+{
+    std::atomic<bool> called{false};
+    std::vector<std::string> lines;
+
+    const std::string data{"first\nsecond\n"};
+    server.send(asio::buffer(data));
+
+    socket->recvPacketsAsync(socket, one::etls::PacketDecoder::Type::line, 0,
+        {[&](const auto &packets) {
+            for (auto &packet : packets)
+                lines.emplace_back(
+                    asio::buffer_cast<const char *>(packet.data),
+                    asio::buffer_size(packet.data));
+            called = true;
+        },
+            [](auto) {}});
+
+    ASSERT_TRUE(waitFor(called));
+    ASSERT_FALSE(lines.empty());
+    EXPECT_EQ("first\n", lines.front());
+}
+
+TEST(TLSSocketPlacementTest, shouldKeepWorkingWhenMovedToAnotherThread)
+{
+    using Placement = one::etls::TLSApplication::Placement;
+
+    one::etls::TLSApplication::Config config;
+    config.ioThreads = 2;
+    config.placement = Placement::scheduler;
+    one::etls::TLSApplication app{config};
+
+    const auto port = randomPort();
+    TestServer server{port};
+    auto socket = std::make_shared<one::etls::TLSSocket>(app);
+
+    std::atomic<bool> connected{false};
+    socket->connectAsync(socket, "127.0.0.1", port,
+        {[&](auto) { connected = true; }, [](auto) {}});
+    ASSERT_TRUE(waitFor(connected));
+    ASSERT_TRUE(server.waitForConnection(5s));
+
+    std::thread::id before;
+    std::atomic<bool> called{false};
+    auto onStats = [&](auto) {
+        before = std::this_thread::get_id();
+        called = true;
+    };
+    socket->statsAsync(socket, {onStats, [](auto) {}});
+    ASSERT_TRUE(waitFor(called));
+
+    // The move aborts the wait of the receive, which is resumed on the new
+    // thread.
+    const auto data = randomData();
+    std::vector<char> received(data.size());
+    std::thread::id after;
+    called = false;
+    auto onRecv = [&](auto) {
+        after = std::this_thread::get_id();
+        called = true;
+    };
+    socket->recvAsync(socket, asio::buffer(received), {onRecv, [](auto) {}});
+
+    socket->requestRehome();
+    std::thread{[&] { socket->rehomeAsync(socket); }}.join();
+
+    server.send(asio::buffer(data));
+    ASSERT_TRUE(waitFor(called));
+    EXPECT_EQ(data, received);
+    EXPECT_NE(before, after);
+
+    called = false;
+    socket->sendAsync(
+        socket, asio::buffer(data), {[&] { called = true; }, [](auto) {}});
+    ASSERT_TRUE(waitFor(called));
+
+    std::vector<char> echoed(data.size());
+    server.receive(asio::buffer(echoed));
+    EXPECT_EQ(data, echoed);
+}
+
+TEST(TLSSocketPlacementTest, shouldMigrateToGivenService)
+{
+    one::etls::TLSApplication app{2};
+    const auto port = randomPort();
+    TestServer server{port};
+    auto socket = std::make_shared<one::etls::TLSSocket>(app);
+
+    std::atomic<bool> connected{false};
+    socket->connectAsync(socket, "127.0.0.1", port,
+        {[&](auto) { connected = true; }, [](auto) {}});
+    ASSERT_TRUE(waitFor(connected));
+    ASSERT_TRUE(server.waitForConnection(5s));
+
+    asio::io_service *services[] = {&app.ioService(), &app.ioService()};
+    for (const auto service : services) {
+        std::atomic<bool> called{false};
+        bool moved = false;
+        socket->migrateAsync(socket, *service, {[&](const bool m) {
+                                                    moved = m;
+                                                    called = true;
+                                                },
+                                                   [](auto) {}});
+        ASSERT_TRUE(waitFor(called));
+        EXPECT_TRUE(moved);
+
+        std::promise<std::thread::id> serviceThread;
+        service->post(
+            [&] { serviceThread.set_value(std::this_thread::get_id()); });
+
+        std::thread::id socketThread;
+        called = false;
+        socket->statsAsync(socket, {[&](auto) {
+                                        socketThread =
+                                            std::this_thread::get_id();
+                                        called = true;
+                                    },
+                                       [](auto) {}});
+        ASSERT_TRUE(waitFor(called));
+        EXPECT_EQ(serviceThread.get_future().get(), socketThread);
+        EXPECT_EQ(1u,
+            asio::use_service<one::etls::IoLoad>(*service).stats().sockets);
+    }
+
+    const auto data = randomData();
+    std::atomic<bool> called{false};
+    socket->sendAsync(
+        socket, asio::buffer(data), {[&] { called = true; }, [](auto) {}});
+    ASSERT_TRUE(waitFor(called));
+
+    std::vector<char> echoed(data.size());
+    server.receive(asio::buffer(echoed));
+    EXPECT_EQ(data, echoed);
+}
+
+TEST(TLSSocketSelectTest, shouldConnectByNameAndSealInParallelWhenPolled)
+{
+    using Engine = one::etls::TLSApplication::Engine;
+    one::etls::TLSApplication app{2, Engine::select};
+
+    const unsigned short ports[] = {randomPort(), randomPort()};
+    TestServer server0{ports[0]};
+    TestServer server1{ports[1]};
+    TestServer *servers[] = {&server0, &server1};
+
+    // The io_services are polled only once their descriptors are readable,
+    // as the Erlang pollers do.
+    std::atomic<bool> stop{false};
+    std::thread poller{[&] {
+        std::vector<pollfd> fds;
+        for (std::size_t i = 0; i < app.size(); ++i)
+            fds.push_back({app.pollDescriptor(i), POLLIN, 0});
+
+        while (!stop) {
+            if (::poll(fds.data(), fds.size(), 10) <= 0)
+                continue;
+
+            for (std::size_t i = 0; i < fds.size(); ++i)
+                if (fds[i].revents & POLLIN)
+                    while (app.pollOne(i)) {
+                    }
+        }
+    }};
+
+    // Sockets are placed on both io_services in turns.
+    for (int i = 0; i < 2; ++i) {
+        auto &server = *servers[i];
+        auto socket = std::make_shared<one::etls::TLSSocket>(app);
+
+        std::atomic<bool> connected{false};
+        socket->connectAsync(socket, "localhost", ports[i],
+            {[&](auto) { connected = true; }, [](auto) {}});
+        EXPECT_TRUE(waitFor(connected));
+        EXPECT_TRUE(server.waitForConnection(5s));
+        if (!connected)
+            break;
+
+        socket->setOptionAsync(
+            socket, one::etls::TLSSocket::Option::sealWorkers, 2);
+
+        std::vector<char> data(1024 * 1024 + 123);
+        std::iota(data.begin(), data.end(), i);
+        std::atomic<bool> sent{false};
+        socket->sendAsync(
+            socket, asio::buffer(data), {[&] { sent = true; }, [](auto) {}});
+
+        std::vector<char> received(data.size());
+        server.receive(asio::buffer(received));
+        EXPECT_EQ(data, received);
+        EXPECT_TRUE(waitFor(sent));
+    }
+
+    stop = true;
+    poller.join();
+}
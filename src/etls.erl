@@ -23,11 +23,19 @@
     acceptor :: etls_nif:acceptor()
 }).
 
+-define(NATIVE_OPTIONS,
+    [record_size, read_ahead, write_window, seal_workers, pipelined_recv,
+        ktls, recv_buffer_min, recv_buffer_max]).
+
 %% API
--export([connect/3, connect/4, send/2, recv/2, recv/3, listen/2,
+-export([connect/3, connect/4, send/2, sendfile/4, ws_send/3, ws_send/4,
+    recv/2, recv/3, recv_stream/2, recv_stream/3,
+    listen/2,
     accept/1, accept/2, handshake/1, handshake/2, setopts/2,
-    controlling_process/2, peername/1, sockname/1, close/1, peercert/1,
-    certificate_chain/1, shutdown/2, cipher_suites/0, cipher_suites/1]).
+    controlling_process/2, peername/1, sockname/1, getstat/1, close/1,
+    peercert/1,
+    certificate_chain/1, shutdown/2, cipher_suites/0, cipher_suites/1,
+    buffer_stats/0, io_stats/0, io_load/0, set_io_threads/1]).
 
 %% Types
 -type der_encoded() :: binary().
@@ -39,11 +47,63 @@
 -type str() :: binary() | string().
 
 -type option() ::
-{packet, raw | 0 | 1 | 2 | 4} |
+{packet, raw | 0 | 1 | 2 | 4 | line | http | http_bin | httph | httph_bin |
+    websocket} |
+{packet_size, non_neg_integer()} |
+{record_size, non_neg_integer()} |
+{read_ahead, non_neg_integer()} |
+{write_window, non_neg_integer()} |
+{seal_workers, non_neg_integer()} |
+{pipelined_recv, boolean()} |
+{ktls, boolean()} |
+{recv_buffer_min, pos_integer()} |
+{recv_buffer_max, pos_integer()} |
 {active, boolean() | once} |
 {exit_on_close, boolean()}.
 %% As in
 %% <a href="http://erlang.org/doc/man/inet.html#setopts-2">inet:setopts/2</a>.
+%% Line and HTTP packets are decoded natively and always contain binaries,
+%% as with http_bin and httph_bin. Header names are normalized, and the ones
+%% known to erlang:decode_packet/3 are atoms with its bit numbers, e.g.
+%% {http_header, 38, 'Content-Length', undefined, <<"42">>}. Request URIs
+%% are split the same way, e.g. {absoluteURI, http, <<"example.com">>, 8080,
+%% <<"/">>} or {scheme, <<"ftp">>, <<"//example.com/file">>}. In active mode,
+%% HTTP packets are delivered as {etls_http, Socket, HttpPacket} messages.
+%% record_size sets the payload size of outgoing TLS records (clamped to
+%% 512..16384). The default of 0 sizes records dynamically: records fit in
+%% a single TCP segment for the first 64 KB after an idle second, and are
+%% full-sized afterwards.
+%% read_ahead sets the number of bytes read from the TCP socket at once
+%% (default 262144); all records received together are decrypted before
+%% data is delivered. With 0, the socket is read only as far as the TLS
+%% engine asks.
+%% write_window sets the number of TLS records encrypted before they are
+%% written to the TCP socket with a single syscall (default 16).
+%% seal_workers splits encryption of large sends between that many tasks
+%% on a pool of worker threads (default 0, disabled), each sealing its own
+%% records; the write window grows accordingly. It applies to AES-GCM and
+%% ChaCha20-Poly1305 cipher suites.
+%% pipelined_recv (default false) keeps reading from the TCP socket while
+%% received records are decrypted on a worker thread, so that decryption of
+%% a large transfer overlaps with its arrival. Reads fall back to the regular
+%% path whenever a record other than application data arrives.
+%% ktls (default false) hands the session keys to the Linux kernel TLS
+%% module once the handshake is done, after which records are encrypted
+%% and decrypted by the kernel. It applies to AES-GCM cipher suites; with
+%% other suites, or when the tls module isn't available, the socket keeps
+%% processing records in userspace.
+%% recv_buffer_min and recv_buffer_max (default 2048 and 262144) bound the
+%% size of buffers allocated for recv(Socket, 0) and active mode. Within the
+%% bounds, the size follows a moving average of the socket's recent reads;
+%% the current size is reported by getstat/1.
+%% In websocket mode, RFC 6455 frames are unmasked and fragmented messages
+%% reassembled (up to packet_size bytes) natively. Messages are received as
+%% {Opcode, Payload} or, in active mode, {etls_ws, Socket, Opcode, Payload}.
+%% Natively decoded packets are limited to 64 MB when packet_size is 0;
+%% larger ones fail the receive with emsgsize.
+
+-type ws_opcode() :: text | binary | close | ping | pong.
+%% WebSocket message opcode.
 
 -type ssl_option() ::
 {verify_type, verify_none | verify_peer} |
@@ -102,7 +162,8 @@
 -opaque acceptor() :: #acceptor_ref{}.
 %% Am acceptor socket handle created by {@link listen/2}.
 
--export_type([option/0, ssl_option/0, listen_option/0, socket/0, acceptor/0]).
+-export_type([option/0, ssl_option/0, listen_option/0, socket/0, acceptor/0,
+    ws_opcode/0]).
 
 %%%===================================================================
 %%% API
@@ -157,7 +218,8 @@ connect(Host, Port, Options, Timeout) ->
 %%--------------------------------------------------------------------
 -spec send(Socket :: socket(), Data :: iodata()) ->
     ok | {error, Reason :: closed | atom()}.
-send(#sock_ref{sender = Sender}, Data) ->
+send(#sock_ref{socket = Sock, sender = Sender}, Data) ->
+    ok = etls_nif:rehome(Sock),
     try
         gen_fsm:sync_send_event(Sender, {send, Data}, infinity)
     catch
@@ -165,6 +227,67 @@ send(#sock_ref{sender = Sender}, Data) ->
             {error, closed}
     end.
 
+%%--------------------------------------------------------------------
+%% @doc
+%% Sends Length bytes of a file, starting at Offset, through Socket.
+%% File is a path or an integer OS file descriptor, which the socket
+%% duplicates. Length of 0 sends the rest of the file. The file is read
+%% and encrypted natively, without passing through the Erlang heap; with
+%% ktls active it's sent with the kernel's sendfile. The data is not
+%% framed according to the packet option.
+%% If the socket is closed, returns {error, closed}.
+%% @end
+%%--------------------------------------------------------------------
+-spec sendfile(Socket :: socket(), File :: file:name_all() | integer(),
+    Offset :: non_neg_integer(), Length :: non_neg_integer()) ->
+    {ok, BytesSent :: non_neg_integer()} |
+    {error, Reason :: closed | atom()}.
+sendfile(#sock_ref{sender = Sender}, File, Offset, Length) ->
+    NativeFile =
+        case is_integer(File) of
+            true -> File;
+            false ->
+                unicode:characters_to_binary(filename:flatten(File),
+                    unicode, file:native_name_encoding())
+        end,
+    try
+        gen_fsm:sync_send_event(Sender,
+            {sendfile, NativeFile, Offset, Length}, infinity)
+    catch
+        exit:{Reason, _} when Reason =:= noproc; Reason =:= shutdown ->
+            {error, closed}
+    end.
+
+%%--------------------------------------------------------------------
+%% @equiv ws_send(Socket, Opcode, Payload, false)
+%% @end
+%%--------------------------------------------------------------------
+-spec ws_send(Socket :: socket(), Opcode :: ws_opcode(), Payload :: iodata()) ->
+    ok | {error, Reason :: closed | atom()}.
+ws_send(SockRef, Opcode, Payload) ->
+    ws_send(SockRef, Opcode, Payload, false).
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Writes Payload to Socket as a single WebSocket frame.
+%% The frame header is written natively alongside the payload, so a binary
+%% payload is not copied. Clients must set Mask to true, as required by
+%% RFC 6455; masking needs a copy of the payload.
+%% If the socket is closed, returns {error, closed}.
+%% @end
+%%--------------------------------------------------------------------
+-spec ws_send(Socket :: socket(), Opcode :: ws_opcode(), Payload :: iodata(),
+    Mask :: boolean()) ->
+    ok | {error, Reason :: closed | atom()}.
+ws_send(#sock_ref{sender = Sender}, Opcode, Payload, Mask) ->
+    try
+        gen_fsm:sync_send_event(Sender, {ws_send, Opcode, Payload, Mask},
+            infinity)
+    catch
+        exit:{Reason, _} when Reason =:= noproc; Reason =:= shutdown ->
+            {error, closed}
+    end.
+
 %%--------------------------------------------------------------------
 %% @equiv recv(Socket, Size, infinity)
 %% @end
@@ -185,7 +308,8 @@ recv(SockRef, Size) ->
     Timeout :: timeout()) ->
     {ok, binary()} |
     {error, Reason :: closed | timeout | atom()}.
-recv(#sock_ref{receiver = Receiver}, Size, Timeout) ->
+recv(#sock_ref{socket = Sock, receiver = Receiver}, Size, Timeout) ->
+    ok = etls_nif:rehome(Sock),
     try
         gen_fsm:sync_send_event(Receiver, {recv, Size, Timeout}, infinity)
     catch
@@ -193,6 +317,41 @@ recv(#sock_ref{receiver = Receiver}, Size, Timeout) ->
             {error, closed}
     end.
 
+%%--------------------------------------------------------------------
+%% @equiv recv_stream(Socket, Length, 65536)
+%% @end
+%%--------------------------------------------------------------------
+-spec recv_stream(Socket :: socket(), Length :: pos_integer()) ->
+    ok | {error, Reason :: closed | atom()}.
+recv_stream(SockRef, Length) ->
+    recv_stream(SockRef, Length, 64 * 1024).
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Receives Length bytes from a socket in passive raw mode as a stream
+%% of chunks, so that a message of any size is received with bounded
+%% memory. Returns once the stream is started; the calling process then
+%% receives {etls_chunk, Socket, Data, Remaining} messages with up to
+%% ChunkSize bytes each, the last one with Remaining of 0. If the socket
+%% fails before that, {etls_closed, Socket} or
+%% {etls_error, Socket, Reason} is sent instead.
+%% If the socket is closed, returns {error, closed}.
+%% @end
+%%--------------------------------------------------------------------
+-spec recv_stream(Socket :: socket(), Length :: pos_integer(),
+    ChunkSize :: pos_integer()) ->
+    ok | {error, Reason :: closed | atom()}.
+recv_stream(#sock_ref{socket = Sock, receiver = Receiver}, Length,
+    ChunkSize) when Length > 0, ChunkSize > 0 ->
+    ok = etls_nif:rehome(Sock),
+    try
+        gen_fsm:sync_send_event(Receiver,
+            {recv_stream, Length, ChunkSize}, infinity)
+    catch
+        exit:{Reason, _} when Reason =:= noproc; Reason =:= shutdown ->
+            {error, closed}
+    end.
+
 %%--------------------------------------------------------------------
 %% @doc
 %% Creates an acceptor (listen socket).
@@ -287,7 +446,10 @@ handshake(#sock_ref{socket = Sock}, Timeout) ->
 %% @end
 %%--------------------------------------------------------------------
 -spec setopts(Socket :: socket(), Opts :: [option()]) -> ok.
-setopts(#sock_ref{receiver = Receiver, sender = Sender}, Options) ->
+setopts(#sock_ref{socket = Sock, receiver = Receiver, sender = Sender},
+    Options) ->
+    ok = etls_nif:rehome(Sock),
+    set_native_options(Sock, Options),
     gen_fsm:send_all_state_event(Receiver, {setopts, Options}),
     gen_fsm:send_all_state_event(Sender, {setopts, Options}),
     ok.
@@ -296,11 +458,15 @@ setopts(#sock_ref{receiver = Receiver, sender = Sender}, Options) ->
 %% @doc
 %% Assigns a new controlling process to the socket.
 %% A controlling process receives all messages from the socket.
+%% With the scheduler placement of sockets, the socket is moved to the I/O
+%% thread paired with the scheduler of the new controlling process on its
+%% next call to send, recv, recv_stream or setopts.
 %% @end
 %%--------------------------------------------------------------------
 -spec controlling_process(Socket :: socket(), NewControllingProcess :: pid()) ->
     ok.
-controlling_process(#sock_ref{receiver = Receiver}, Pid) ->
+controlling_process(#sock_ref{socket = Sock, receiver = Receiver}, Pid) ->
+    ok = etls_nif:request_rehome(Sock),
     gen_fsm:send_all_state_event(Receiver, {controlling_process, Pid}),
     ok.
 
@@ -319,6 +485,23 @@ peername(#sock_ref{socket = Sock}) ->
         {error, Reason} when is_atom(Reason) -> {error, Reason}
     end.
 
+%%--------------------------------------------------------------------
+%% @doc
+%% Returns runtime statistics of the socket.
+%% recv_buffer is the size of the buffer allocated for the next read of
+%% any length.
+%% @end
+%%--------------------------------------------------------------------
+-spec getstat(Socket :: socket()) ->
+    {ok, [{recv_buffer, non_neg_integer()}]} |
+    {error, Reason :: atom()}.
+getstat(#sock_ref{socket = Sock}) ->
+    Ref = make_ref(),
+    case etls_nif:getstat(Ref, Sock) of
+        ok -> receive {Ref, Result} -> Result end;
+        {error, Reason} when is_atom(Reason) -> {error, Reason}
+    end.
+
 %%--------------------------------------------------------------------
 %% @doc
 %% Returns the address and port number of the socket.
@@ -431,6 +614,62 @@ cipher_suites([C | _] = Filter) when is_list(C); is_binary(C) ->
 cipher_suites(Filter) when is_binary(Filter); is_list(Filter) ->
     etls_nif:cipher_suites(Filter).
 
+%%--------------------------------------------------------------------
+%% @doc
+%% Returns the memory use of TLS record buffers shared by all sockets.
+%% Sockets borrow buffers from a pool only while a read or write is in
+%% progress; pooled_bytes is the memory kept in the pool for reuse and
+%% borrowed_bytes the memory currently held by sockets.
+%% @end
+%%--------------------------------------------------------------------
+-spec buffer_stats() ->
+    [{pooled_bytes | borrowed_bytes, non_neg_integer()}].
+buffer_stats() ->
+    etls_nif:buffer_stats().
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Returns statistics of operations handed by Erlang processes to the
+%% I/O threads: the number of operations run, the number of times an I/O
+%% thread was woken up to run them, the number of operations that didn't
+%% fit in a thread's submission queue, and the mean time in nanoseconds
+%% between submitting an operation and its start.
+%% @end
+%%--------------------------------------------------------------------
+-spec io_stats() ->
+    [{submitted | wakeups | overflows | mean_latency_ns, non_neg_integer()}].
+io_stats() ->
+    etls_nif:io_stats().
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Returns the load of each I/O thread new sockets are placed on: the
+%% number of its sockets, the bytes they sent and received per second,
+%% the number of operations waiting for the thread, and the share of
+%% time the thread was busy, sampled every 100 ms. With the select
+%% engine nothing is sampled, as the I/O services are run by schedulers
+%% doing other work, so bytes_per_second and busy are always 0.
+%% @end
+%%--------------------------------------------------------------------
+-spec io_load() ->
+    [[{sockets | bytes_per_second | queue_depth, non_neg_integer()} |
+      {busy, float()}]].
+io_load() ->
+    etls_nif:io_load().
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Sets the number of I/O threads new sockets are spread over, and
+%% returns the number in effect. The number is capped at the larger of
+%% the configured number and the number of hardware threads; existing
+%% sockets stay on their threads. The number is fixed with the select
+%% engine.
+%% @end
+%%--------------------------------------------------------------------
+-spec set_io_threads(N :: pos_integer()) -> {ok, pos_integer()}.
+set_io_threads(N) ->
+    etls_nif:set_io_threads(N).
+
 %%%===================================================================
 %%% Internal functions
 %%%===================================================================
@@ -446,6 +685,7 @@ cipher_suites(Filter) when is_binary(Filter); is_list(Filter) ->
     Options :: [option()]) ->
     {ok, SockRef :: socket()}.
 start_socket_processes(Sock, Options) ->
+    set_native_options(Sock, Options),
     Args = [Sock, Options, self()],
     {ok, Sup} = supervisor:start_child(etls_sup, Args),
 
@@ -460,6 +700,35 @@ start_socket_processes(Sock, Options) ->
 
     {ok, SockRef}.
 
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Passes options implemented by the NIF to the native socket.
+%% @end
+%%--------------------------------------------------------------------
+-spec set_native_options(Sock :: etls_nif:socket(), Options :: list()) -> ok.
+set_native_options(Sock, Options) ->
+    lists:foreach(
+        fun({Name, Value}) ->
+            case lists:member(Name, ?NATIVE_OPTIONS) of
+                true -> ok = etls_nif:setopt(Sock, Name, native_value(Value));
+                false -> ok
+            end;
+            (_) -> ok
+        end, Options).
+
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Converts a value of a native option to an integer.
+%% @end
+%%--------------------------------------------------------------------
+-spec native_value(Value :: non_neg_integer() | boolean()) ->
+    non_neg_integer().
+native_value(true) -> 1;
+native_value(false) -> 0;
+native_value(Value) -> Value.
+
 %%--------------------------------------------------------------------
 %% @private
 %% @doc
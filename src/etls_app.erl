@@ -33,7 +33,7 @@
     {ok, pid(), State :: term()} |
     {error, Reason :: term()}.
 start(_StartType, _StartArgs) ->
-    etls_sup:start_link().
+    etls_engine_sup:start_link().
 
 %%--------------------------------------------------------------------
 %% @private
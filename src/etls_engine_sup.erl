@@ -0,0 +1,75 @@
+%%%--------------------------------------------------------------------
+%%% @author Konrad Zemek
+%%% @copyright (C) 2016 ACK CYFRONET AGH
+%%% This software is released under the MIT license
+%%% cited in 'LICENSE.md'.
+%%% @end
+%%%--------------------------------------------------------------------
+%%% @private
+%%% @doc
+%%% The top etls supervisor. Supervises the connection supervisor and,
+%%% when the select engine is used, a poller process for each native
+%%% I/O service.
+%%% @end
+%%%--------------------------------------------------------------------
+-module(etls_engine_sup).
+-author("Konrad Zemek").
+
+-behaviour(supervisor).
+
+%% API
+-export([start_link/0]).
+
+%% Supervisor callbacks
+-export([init/1]).
+
+-define(SERVER, ?MODULE).
+
+%%%===================================================================
+%%% API functions
+%%%===================================================================
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Creates a supervisor for this module.
+%% @end
+%%--------------------------------------------------------------------
+-spec start_link() ->
+    {ok, Pid :: pid()} | ignore | {error, Reason :: term()}.
+start_link() ->
+    supervisor:start_link({local, ?SERVER}, ?MODULE, []).
+
+%%%===================================================================
+%%% Supervisor callbacks
+%%%===================================================================
+
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Initializes the supervisor.
+%% @end
+%%--------------------------------------------------------------------
+-spec init(Args :: term()) ->
+    {ok, {SupFlags :: supervisor:sup_flags(),
+          [ChildSpec :: supervisor:child_spec()]}}.
+init([]) ->
+    RestartStrategy = one_for_one,
+    MaxRestarts = 1000,
+    MaxSecondsBetweenRestarts = 3600,
+
+    SupFlags = {RestartStrategy, MaxRestarts, MaxSecondsBetweenRestarts},
+
+    Connections = {connections, {etls_sup, start_link, []},
+        permanent, infinity, supervisor, [etls_sup]},
+
+    Pollers =
+        case etls_nif:engine() of
+            {select, N} ->
+                [{{poller, I}, {etls_poller, start_link, [I]},
+                    permanent, 2000, worker, [etls_poller]}
+                    || I <- lists:seq(0, N - 1)];
+            {threads, _} ->
+                []
+        end,
+
+    {ok, {SupFlags, Pollers ++ [Connections]}}.
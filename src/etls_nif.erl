@@ -16,9 +16,12 @@
 -on_load(init/0).
 
 %% API
--export([connect/13, send/2, recv/2, listen/12, accept/2, handshake/2,
-    peername/2, sockname/2, acceptor_sockname/2, close/2,
-    certificate_chain/1, shutdown/3, cipher_suites/1]).
+-export([connect/13, send/2, sendfile/4, ws_send/4, recv/2, recv_packets/3,
+    listen/12, accept/2,
+    handshake/2, peername/2, sockname/2, acceptor_sockname/2, close/2,
+    certificate_chain/1, shutdown/3, setopt/3, getstat/2, cipher_suites/1,
+    buffer_stats/0, io_stats/0, io_load/0, engine/0, set_io_threads/1, poll/1,
+    request_rehome/1, rehome/1]).
 
 -type str() :: binary() | string().
 -type socket() :: term().
@@ -52,27 +55,74 @@ connect(_Ref, _Host, _Port, _CertPath, _KeyPath, _VerifyType, _FailIfNoPeerCert,
 %% @doc
 %% Sends a message through the Socket.
 %% When finished, sends ok | {error, Reason} to the calling
-%% process.
+%% process. If a small message is sent right away, returns sent and no
+%% message is sent.
 %% @end
 %%--------------------------------------------------------------------
 -spec send(Socket :: socket(), Data :: iodata()) ->
-    ok | {error, Reason :: atom()}.
+    ok | sent | {error, Reason :: atom()}.
 send(_Sock, _Data) ->
     erlang:nif_error(etls_nif_not_loaded).
 
+%%--------------------------------------------------------------------
+%% @doc
+%% Sends Length bytes of a file, starting at Offset, through the Socket.
+%% File is a path or an OS file descriptor; Length of 0 sends the rest of
+%% the file.
+%% When finished, sends {ok, BytesSent} | {error, Reason} to the calling
+%% process.
+%% @end
+%%--------------------------------------------------------------------
+-spec sendfile(Socket :: socket(), File :: binary() | integer(),
+    Offset :: non_neg_integer(), Length :: non_neg_integer()) ->
+    ok | {error, Reason :: atom()}.
+sendfile(_Sock, _File, _Offset, _Length) ->
+    erlang:nif_error(etls_nif_not_loaded).
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Sends Data through the Socket as a single WebSocket frame.
+%% When finished, sends ok | {error, Reason} to the calling process.
+%% If a small frame is sent right away, returns sent and no message is
+%% sent.
+%% @end
+%%--------------------------------------------------------------------
+-spec ws_send(Socket :: socket(), Opcode :: 0..15, Data :: iodata(),
+    Mask :: boolean()) ->
+    ok | sent | {error, Reason :: atom()}.
+ws_send(_Sock, _Opcode, _Data, _Mask) ->
+    erlang:nif_error(etls_nif_not_loaded).
+
 %%--------------------------------------------------------------------
 %% @doc
 %% Receives a message from the Socket.
 %% When Size is 0, waits for any data to arrive on the socket.
 %% When finished, sends {ok, Data :: binary()} | {error, Reason} to
-%% the calling process.
+%% the calling process. If the data is already decrypted, it's returned
+%% directly as {ok, Data} and no message is sent.
 %% @end
 %%--------------------------------------------------------------------
 -spec recv(Socket :: socket(), Size :: non_neg_integer()) ->
-    ok | {error, Reason :: atom()}.
+    ok | {ok, binary()} | {error, Reason :: atom()}.
 recv(_Sock, _Size) ->
     erlang:nif_error(etls_nif_not_loaded).
 
+%%--------------------------------------------------------------------
+%% @doc
+%% Receives line, HTTP or WebSocket packets from the Socket.
+%% Packets are decoded natively; all packets that have arrived together
+%% are delivered at once.
+%% When finished, sends {packets, [Packet]} | {error, Reason} to the
+%% calling process.
+%% @end
+%%--------------------------------------------------------------------
+-spec recv_packets(Socket :: socket(),
+    Type :: line | http | httph | websocket,
+    MaxSize :: non_neg_integer()) ->
+    ok | {error, Reason :: atom()}.
+recv_packets(_Sock, _Type, _MaxSize) ->
+    erlang:nif_error(etls_nif_not_loaded).
+
 %%--------------------------------------------------------------------
 %% @doc
 %% Creates an acceptor socket that listens on the given port.
@@ -188,6 +238,34 @@ certificate_chain(_Sock) ->
 shutdown(_Ref, _Sock, _Type) ->
     erlang:nif_error(etls_nif_not_loaded).
 
+%%--------------------------------------------------------------------
+%% @doc
+%% Sets a native option on the socket.
+%% The option is applied asynchronously, before any subsequently
+%% requested operation. Boolean options (pipelined_recv, ktls) take
+%% 0 or 1.
+%% @end
+%%--------------------------------------------------------------------
+-spec setopt(Socket :: socket(), Name :: record_size | read_ahead |
+    write_window | seal_workers | pipelined_recv | ktls |
+    recv_buffer_min | recv_buffer_max,
+    Value :: non_neg_integer()) ->
+    ok | {error, Reason :: atom()}.
+setopt(_Sock, _Name, _Value) ->
+    erlang:nif_error(etls_nif_not_loaded).
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Returns a proplist of the socket's runtime statistics.
+%% When finished, sends {Ref, {ok, Result} | {error, Reason}} to the
+%% calling process.
+%% @end
+%%--------------------------------------------------------------------
+-spec getstat(Ref :: reference(), Socket :: socket()) ->
+    ok | {error, Reason :: atom()}.
+getstat(_Ref, _Sock) ->
+    erlang:nif_error(etls_nif_not_loaded).
+
 %%--------------------------------------------------------------------
 %% @doc
 %% Returns a list of supported cipher suites.
@@ -198,6 +276,95 @@ shutdown(_Ref, _Sock, _Type) ->
 cipher_suites(_Filter) ->
     erlang:nif_error(etls_nif_not_loaded).
 
+%%--------------------------------------------------------------------
+%% @doc
+%% Returns a proplist with the number of bytes kept in the shared buffer
+%% pool and the number of bytes currently borrowed from it.
+%% @end
+%%--------------------------------------------------------------------
+-spec buffer_stats() ->
+    [{pooled_bytes | borrowed_bytes, non_neg_integer()}].
+buffer_stats() ->
+    erlang:nif_error(etls_nif_not_loaded).
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Returns a proplist with statistics of operations submitted to the I/O
+%% threads.
+%% @end
+%%--------------------------------------------------------------------
+-spec io_stats() ->
+    [{submitted | wakeups | overflows | mean_latency_ns, non_neg_integer()}].
+io_stats() ->
+    erlang:nif_error(etls_nif_not_loaded).
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Returns a list of proplists with the load of each I/O service new
+%% sockets are placed on.
+%% @end
+%%--------------------------------------------------------------------
+-spec io_load() ->
+    [[{sockets | bytes_per_second | queue_depth, non_neg_integer()} |
+      {busy, float()}]].
+io_load() ->
+    erlang:nif_error(etls_nif_not_loaded).
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Returns the engine running native I/O, and the number of I/O services
+%% it runs.
+%% @end
+%%--------------------------------------------------------------------
+-spec engine() -> {threads | select, pos_integer()}.
+engine() ->
+    erlang:nif_error(etls_nif_not_loaded).
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Sets the number of I/O services new sockets are spread over, and
+%% returns the number in effect. Sockets keep the service they were
+%% created on. The number is fixed with the select engine.
+%% @end
+%%--------------------------------------------------------------------
+-spec set_io_threads(N :: pos_integer()) -> {ok, pos_integer()}.
+set_io_threads(_N) ->
+    erlang:nif_error(etls_nif_not_loaded).
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Runs pending work of the I/O service of a given index, for the select
+%% engine. Returns more if the time slice ran out before the work did;
+%% otherwise returns wait, and the calling process is sent
+%% {select, _, _, ready_input} once there's work again.
+%% Work that takes long is moved to a dirty scheduler.
+%% @end
+%%--------------------------------------------------------------------
+-spec poll(Index :: non_neg_integer()) ->
+    wait | more | {error, Reason :: atom()}.
+poll(_Index) ->
+    erlang:nif_error(etls_nif_not_loaded).
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Marks a socket to be moved by the next rehome/1, when sockets are
+%% placed by scheduler.
+%% @end
+%%--------------------------------------------------------------------
+-spec request_rehome(Sock :: socket()) -> ok.
+request_rehome(_Sock) ->
+    erlang:nif_error(etls_nif_not_loaded).
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Moves a socket marked by request_rehome/1 to the I/O service paired
+%% with the calling scheduler. A busy socket is moved by a later call.
+%% @end
+%%--------------------------------------------------------------------
+-spec rehome(Sock :: socket()) -> ok.
+rehome(_Sock) ->
+    erlang:nif_error(etls_nif_not_loaded).
+
 %%%===================================================================
 %%% Internal functions
 %%%===================================================================
@@ -208,6 +375,8 @@ cipher_suites(_Filter) ->
 %% Initialization function for the module.
 %% Loads the NIF native library. The library is first searched for
 %% in application priv dir, and then under ../priv and ./priv .
+%% The engine and the threads are configured from the application's
+%% environment.
 %% @end
 %%--------------------------------------------------------------------
 -spec init() -> ok | {error, Reason :: atom()}.
@@ -227,4 +396,10 @@ init() ->
                 filename:join(Dir, LibName)
         end,
 
-    erlang:load_nif(LibPath, 0).
+    Env = fun(Key, Default) ->
+        {Key, application:get_env(etls, Key, Default)}
+    end,
+    erlang:load_nif(LibPath, [Env(engine, threads), Env(io_threads, 0),
+        Env(worker_threads, 0), Env(thread_name, "TLS"), Env(io_cpus, none),
+        Env(io_placement, power_of_two), Env(io_rebalance, true),
+        {schedulers, erlang:system_info(schedulers)}]).
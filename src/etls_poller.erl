@@ -0,0 +1,155 @@
+%%%--------------------------------------------------------------------
+%%% @author Konrad Zemek
+%%% @copyright (C) 2016 ACK CYFRONET AGH
+%%% This software is released under the MIT license
+%%% cited in 'LICENSE.md'.
+%%% @end
+%%%--------------------------------------------------------------------
+%%% @private
+%%% @doc
+%%% A gen_server running socket operations of one of the native I/O
+%%% services when the select engine is used. The NIF notifies the
+%%% process through enif_select when the service has work to do, and
+%%% the process runs it in time slices, yielding between them.
+%%% @end
+%%%--------------------------------------------------------------------
+-module(etls_poller).
+-author("Konrad Zemek").
+
+-behaviour(gen_server).
+
+%% API
+-export([start_link/1]).
+
+%% gen_server callbacks
+-export([init/1,
+    handle_call/3,
+    handle_cast/2,
+    handle_info/2,
+    terminate/2,
+    code_change/3]).
+
+-record(state, {
+    index :: non_neg_integer()
+}).
+
+%%%===================================================================
+%%% API
+%%%===================================================================
+
+%%--------------------------------------------------------------------
+%% @doc
+%% Creates a gen_server process polling the I/O service of a given index.
+%% @end
+%%--------------------------------------------------------------------
+-spec start_link(Index :: non_neg_integer()) ->
+    {ok, pid()} | ignore | {error, Reason :: term()}.
+start_link(Index) ->
+    gen_server:start_link(?MODULE, Index, []).
+
+%%%===================================================================
+%%% gen_server callbacks
+%%%===================================================================
+
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Initializes the gen_server.
+%% The first poll is deferred to handle_info; it also registers the
+%% process for notifications.
+%% @end
+%%--------------------------------------------------------------------
+-spec init(Index :: non_neg_integer()) ->
+    {ok, State :: #state{}}.
+init(Index) ->
+    self() ! poll,
+    {ok, #state{index = Index}}.
+
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Handles call messages.
+%% @end
+%%--------------------------------------------------------------------
+-spec handle_call(Request :: term(), From :: {pid(), Tag :: term()},
+    State :: #state{}) ->
+    {reply, Reply :: term(), NewState :: #state{}}.
+handle_call(Request, _From, State) ->
+    {reply, {error, {bad_request, Request}}, State}.
+
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Handles cast messages.
+%% @end
+%%--------------------------------------------------------------------
+-spec handle_cast(Request :: term(), State :: #state{}) ->
+    {noreply, NewState :: #state{}}.
+handle_cast(_Request, State) ->
+    {noreply, State}.
+
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Handles messages from other processes.
+%% A select notification from the NIF, or a poll message the process
+%% sends itself after yielding, runs the service's pending work.
+%% @end
+%%--------------------------------------------------------------------
+-spec handle_info(Info :: term(), State :: #state{}) ->
+    {noreply, NewState :: #state{}} |
+    {stop, Reason :: term(), NewState :: #state{}}.
+handle_info({select, _Poller, _Ref, ready_input}, State) ->
+    poll(State);
+
+handle_info(poll, State) ->
+    poll(State);
+
+handle_info(_Info, State) ->
+    {noreply, State}.
+
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Cleans up the poller's process.
+%% @end
+%%--------------------------------------------------------------------
+-spec terminate(Reason :: normal | shutdown | {shutdown, term()} | term(),
+    State :: #state{}) -> term().
+terminate(_Reason, _State) ->
+    ok.
+
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Convert process state when code is changed
+%% @end
+%%--------------------------------------------------------------------
+-spec code_change(OldVsn :: term() | {down, term()}, State :: #state{},
+    Extra :: term()) ->
+    {ok, NewState :: #state{}}.
+code_change(_OldVsn, State, _Extra) ->
+    {ok, State}.
+
+%%%===================================================================
+%%% Internal functions
+%%%===================================================================
+
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Runs a time slice of the service's work. If there's more, the
+%% process yields to others by sending itself a message.
+%% @end
+%%--------------------------------------------------------------------
+-spec poll(State :: #state{}) ->
+    {noreply, NewState :: #state{}} |
+    {stop, Reason :: term(), NewState :: #state{}}.
+poll(#state{index = Index} = State) ->
+    case etls_nif:poll(Index) of
+        wait -> {noreply, State};
+        more ->
+            self() ! poll,
+            {noreply, State};
+        {error, Reason} -> {stop, Reason, State}
+    end.
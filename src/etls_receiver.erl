@@ -24,6 +24,8 @@
     idle/2, idle/3,
     receiving/2, receiving/3,
     receiving_header/2, receiving_header/3,
+    receiving_packets/2, receiving_packets/3,
+    streaming/2, streaming/3,
     handle_event/3,
     handle_sync_event/4,
     handle_info/3,
@@ -41,8 +43,11 @@
     active = false :: false | once | true,
     controlling_pid :: pid(),
     sock_ref :: term(),
-    packet = 0 :: 0 | 1 | 2 | 4,
-    exit_on_close = true :: boolean()
+    packet = 0 :: 0 | 1 | 2 | 4 | line | http | httph | websocket,
+    packet_size = 0 :: non_neg_integer(),
+    packets = [] :: [term()],
+    exit_on_close = true :: boolean(),
+    stream :: undefined | {pid(), ChunkSize :: pos_integer()}
 }).
 
 %%%===================================================================
@@ -101,8 +106,8 @@ idle(_Event, State) ->
 %% socket. If for any reason the request can already be satisfied
 %% from the buffer, it is, and the gen_fsm remains in the idle state.
 %% Otherwise a NIF's receive is called and the gen_fsm's state is
-%% changed to receiving_header or receiving (depending on the packet
-%% option).
+%% changed to receiving_header, receiving or receiving_packets
+%% (depending on the packet option).
 %% @end
 %%--------------------------------------------------------------------
 -spec idle(Event :: term(), From :: {pid(), term()},
@@ -138,6 +143,17 @@ idle({recv, Size, Timeout}, From, #state{packet = 0} = State) ->
                 State#state{timer = Timer, caller = From, needed = Size})
     end;
 
+idle({recv, _Size, Timeout}, From, #state{packet = Packet} = State)
+  when is_atom(Packet) ->
+    case State#state.packets of
+        [] ->
+            Timer = create_timer(Timeout),
+            recv_packets(State#state{timer = Timer, caller = From});
+
+        [Data | Rest] ->
+            {reply, {ok, Data}, idle, State#state{packets = Rest}}
+    end;
+
 idle({recv, _Size, Timeout}, From, State) ->
     #state{buffer = Buffer, packet = Packet} = State,
     case Buffer of
@@ -150,6 +166,36 @@ idle({recv, _Size, Timeout}, From, State) ->
             {reply, {ok, Buffer}, idle, State#state{buffer = <<>>}}
     end;
 
+idle({recv_stream, Length, ChunkSize}, {Pid, _},
+    #state{packet = 0} = State) ->
+    #state{buffer = Buffer, sock_ref = Ref} = State,
+    {Data, Rest} =
+        case byte_size(Buffer) of
+            BS when BS > Length -> split_binary(Buffer, Length);
+            _ -> {Buffer, <<>>}
+        end,
+
+    Remaining = Length - byte_size(Data),
+    case Data of
+        <<>> -> ok;
+        _ -> Pid ! {etls_chunk, Ref, Data, Remaining}
+    end,
+
+    case Remaining of
+        0 ->
+            {reply, ok, idle, State#state{buffer = Rest}};
+
+        _ ->
+            StreamState = State#state{buffer = Rest, needed = Remaining,
+                stream = {Pid, ChunkSize}},
+            case recv_chunk(StreamState) of
+                {stop, Reason, NewState} ->
+                    {stop, Reason, {error, Reason}, NewState};
+                {next_state, StateName, NewState} ->
+                    {reply, ok, StateName, NewState}
+            end
+    end;
+
 idle(Event, _From, State) ->
     {reply, {error, {bad_event_for_state, idle, Event}}, State}.
 
@@ -247,6 +293,88 @@ receiving_header({recv, _Size, Timeout}, From,
 receiving_header(Event, _From, State) ->
     {reply, {error, {bad_event_for_state, receiving_header, Event}}, State}.
 
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Receiving packets state callback.
+%% @end
+%%--------------------------------------------------------------------
+-spec receiving_packets(Event :: term(), State :: #state{}) ->
+    {next_state, NextStateName :: atom(), NextState :: #state{}} |
+    {next_state, NextStateName :: atom(), NextState :: #state{},
+        timeout() | hibernate} |
+    {stop, Reason :: term(), NewState :: #state{}}.
+receiving_packets(_Event, State) ->
+    {next_state, receiving_packets, State}.
+
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Synchronous receiving packets state callback.
+%% The receiving packets state waits for line, HTTP or WebSocket
+%% packets decoded by the NIF.
+%% If a client has timed out, and the gen_fsm still remains in the
+%% receiving state, this callback is used to set a new caller who will
+%% receive the data from the socket.
+%% @end
+%%--------------------------------------------------------------------
+-spec receiving_packets(Event :: term(), From :: {pid(), term()},
+    State :: #state{}) ->
+    {next_state, NextStateName :: atom(), NextState :: #state{}} |
+    {next_state, NextStateName :: atom(), NextState :: #state{},
+        timeout() | hibernate} |
+    {reply, Reply, NextStateName :: atom(), NextState :: #state{}} |
+    {reply, Reply, NextStateName :: atom(), NextState :: #state{},
+        timeout() | hibernate} |
+    {stop, Reason :: normal | term(), NewState :: #state{}} |
+    {stop, Reason :: normal | term(), Reply :: term(),
+        NewState :: #state{}}.
+receiving_packets({recv, _Size, Timeout}, From,
+    #state{caller = undefined} = State) ->
+
+    Timer = create_timer(Timeout),
+    {next_state, receiving_packets, State#state{caller = From, timer = Timer}};
+
+receiving_packets(Event, _From, State) ->
+    {reply, {error, {bad_event_for_state, receiving_packets, Event}}, State}.
+
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Streaming state callback.
+%% @end
+%%--------------------------------------------------------------------
+-spec streaming(Event :: term(), State :: #state{}) ->
+    {next_state, NextStateName :: atom(), NextState :: #state{}} |
+    {next_state, NextStateName :: atom(), NextState :: #state{},
+        timeout() | hibernate} |
+    {stop, Reason :: term(), NewState :: #state{}}.
+streaming(_Event, State) ->
+    {next_state, streaming, State}.
+
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Synchronous streaming state callback.
+%% The streaming state delivers chunks of a recv_stream request and
+%% doesn't accept other requests until it's done.
+%% @end
+%%--------------------------------------------------------------------
+-spec streaming(Event :: term(), From :: {pid(), term()},
+    State :: #state{}) ->
+    {next_state, NextStateName :: atom(), NextState :: #state{}} |
+    {next_state, NextStateName :: atom(), NextState :: #state{},
+        timeout() | hibernate} |
+    {reply, Reply, NextStateName :: atom(), NextState :: #state{}} |
+    {reply, Reply, NextStateName :: atom(), NextState :: #state{},
+        timeout() | hibernate} |
+    {stop, Reason :: normal | term(), NewState :: #state{}} |
+    {stop, Reason :: normal | term(), Reply :: term(),
+        NewState :: #state{}}.
+streaming(Event, _From, State) ->
+    {reply, {error, {bad_event_for_state, streaming, Event}}, streaming,
+        State}.
+
 %%--------------------------------------------------------------------
 %% @private
 %% @doc
@@ -269,15 +397,22 @@ handle_event({sock_ref, SockRef}, StateName, State) ->
 
 handle_event({setopts, Opts}, idle, State) ->
     #state{active = OldActive, buffer = Buffer, sock_ref = Ref,
-        exit_on_close = OldExitOnClose} = State,
+        exit_on_close = OldExitOnClose, packet_size = OldPacketSize,
+        packets = Packets} = State,
 
     Packet = get_packet(Opts, State),
+    PacketSize = proplists:get_value(packet_size, Opts, OldPacketSize),
     Active = proplists:get_value(active, Opts, OldActive),
     ExitOnClose = proplists:get_value(exit_on_close, Opts, OldExitOnClose),
-    UpdatedState = State#state{packet = Packet, exit_on_close = ExitOnClose},
+    UpdatedState = State#state{packet = Packet, packet_size = PacketSize,
+        exit_on_close = ExitOnClose},
 
     %% Handle active change
     case {OldActive, Active, Buffer} of
+        {false, _, _} when Packets =/= [], Active =/= false ->
+            deliver_packets(Packets,
+                UpdatedState#state{packets = [], active = Active});
+
         {false, _, <<>>} when Active =:= once; Active =:= true ->
             recv_packet(UpdatedState#state{active = Active});
 
@@ -294,12 +429,14 @@ handle_event({setopts, Opts}, idle, State) ->
     end;
 
 handle_event({setopts, Opts}, StateName, State) ->
-    #state{active = OldActive, exit_on_close = OldExitOnClose} = State,
+    #state{active = OldActive, exit_on_close = OldExitOnClose,
+        packet_size = OldPacketSize} = State,
     Packet = get_packet(Opts, State),
+    PacketSize = proplists:get_value(packet_size, Opts, OldPacketSize),
     Active = proplists:get_value(active, Opts, OldActive),
     ExitOnClose = proplists:get_value(exit_on_close, Opts, OldExitOnClose),
-    {next_state, StateName, State#state{
-        active = Active, packet = Packet, exit_on_close = ExitOnClose}};
+    {next_state, StateName, State#state{active = Active, packet = Packet,
+        packet_size = PacketSize, exit_on_close = ExitOnClose}};
 
 handle_event({controlling_process, Pid}, StateName, State) ->
     {next_state, StateName, State#state{controlling_pid = Pid}};
@@ -416,6 +553,23 @@ handle_info({ok, Data}, receiving, State) ->
             recv_body(ReallyNeeded, State#state{buffer = AData})
     end;
 
+handle_info({ok, Data}, streaming, State) ->
+    #state{needed = Needed, stream = {Pid, _}, sock_ref = Ref} = State,
+    Remaining = Needed - byte_size(Data),
+    Pid ! {etls_chunk, Ref, Data, Remaining},
+
+    case Remaining of
+        0 -> {next_state, idle, State#state{needed = 0, stream = undefined}};
+        _ -> recv_chunk(State#state{needed = Remaining})
+    end;
+
+handle_info({packets, Packets}, receiving_packets, State) ->
+    deliver_packets(Packets, State);
+
+handle_info({error, 'Message too long'}, _StateName, State) ->
+    reply(State#state.caller, {error, emsgsize}),
+    {stop, emsgsize, State};
+
 handle_info({error, Closed}, _StateName, State)
   when Closed =:= 'End of file'; Closed =:= 'stream truncated' ->
     reply(State#state.caller, {error, closed}),
@@ -437,22 +591,27 @@ handle_info({error, Reason}, _StateName, State) ->
 %%--------------------------------------------------------------------
 -spec terminate(Reason :: normal | shutdown | {shutdown, term()}
 | term(), StateName :: atom(), StateData :: term()) -> term().
-terminate(Reason, _StateName, State) ->
+terminate(Reason, StateName, State) ->
     #state{controlling_pid = Pid, active = Active, sock_ref = SockRef,
-        exit_on_close = ExitOnClose} = State,
+        exit_on_close = ExitOnClose, stream = Stream} = State,
+
+    Message =
+        case Reason of
+            normal -> {etls_closed, SockRef};
+            shutdown -> {etls_closed, SockRef};
+            {shutdown, _} -> {etls_closed, SockRef};
+            _ -> {etls_error, SockRef, Reason}
+        end,
 
     case Active of
         false -> ok;
-        _ ->
-            Message =
-                case Reason of
-                    normal -> {etls_closed, SockRef};
-                    shutdown -> {etls_closed, SockRef};
-                    {shutdown, _} -> {etls_closed, SockRef};
-                    _ -> {etls_error, SockRef, Reason}
-                end,
-
-            Pid ! Message
+        _ -> Pid ! Message
+    end,
+
+    case {StateName, Stream} of
+        {streaming, {StreamPid, _}} when StreamPid =/= Pid orelse
+            Active =:= false -> StreamPid ! Message;
+        _ -> ok
     end,
 
     case {Reason, ExitOnClose} of
@@ -486,10 +645,13 @@ code_change(_OldVsn, StateName, State, _Extra) ->
 %% @end
 %%--------------------------------------------------------------------
 -spec recv_packet(State :: #state{}) ->
-    {next_state, receiving_header | receiving, NextState :: #state{}} |
+    {next_state, receiving_header | receiving | receiving_packets,
+        NextState :: #state{}} |
     {stop, Reason :: atom(), State :: #state{}}.
 recv_packet(#state{packet = 0} = NextState) ->
     recv_body(0, NextState#state{needed = 0});
+recv_packet(#state{packet = Packet} = NextState) when is_atom(Packet) ->
+    recv_packets(NextState);
 recv_packet(#state{packet = Packet} = NextState) ->
     recv_header(NextState#state{needed = Packet}).
 
@@ -506,6 +668,7 @@ recv_header(State) ->
     #state{socket = Sock, packet = Packet, caller = Caller} = State,
     case etls_nif:recv(Sock, Packet) of
         ok -> {next_state, receiving_header, State};
+        {ok, _} = Result -> handle_info(Result, receiving_header, State);
         {error, Reason} when is_atom(Reason) ->
             reply(Caller, {error, Reason}),
             {stop, Reason, State}
@@ -525,11 +688,92 @@ recv_body(Size, State) ->
     #state{socket = Sock, caller = Caller} = State,
     case etls_nif:recv(Sock, Size) of
         ok -> {next_state, receiving, State};
+        {ok, _} = Result -> handle_info(Result, receiving, State);
         {error, Reason} when is_atom(Reason) ->
             reply(Caller, {error, Reason}),
             {stop, Reason, State}
     end.
 
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Receives the next chunk of a recv_stream request, of at most the
+%% requested chunk size.
+%% @end
+%%--------------------------------------------------------------------
+-spec recv_chunk(State :: #state{}) ->
+    {next_state, streaming, NextState :: #state{}} |
+    {stop, Reason :: atom(), State :: #state{}}.
+recv_chunk(State) ->
+    #state{socket = Sock, needed = Needed, stream = {_, ChunkSize}} = State,
+    case etls_nif:recv(Sock, min(Needed, ChunkSize)) of
+        ok -> {next_state, streaming, State};
+        {ok, _} = Result -> handle_info(Result, streaming, State);
+        {error, Reason} when is_atom(Reason) ->
+            {stop, Reason, State}
+    end.
+
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Receives line, HTTP or WebSocket packets, decoded by the NIF.
+%% @end
+%%--------------------------------------------------------------------
+-spec recv_packets(State :: #state{}) ->
+    {next_state, receiving_packets, NextState :: #state{}} |
+    {stop, Reason :: atom(), State :: #state{}}.
+recv_packets(State) ->
+    #state{socket = Sock, packet = Packet, packet_size = PacketSize,
+        caller = Caller} = State,
+    case etls_nif:recv_packets(Sock, Packet, PacketSize) of
+        ok -> {next_state, receiving_packets, State};
+        {error, Reason} when is_atom(Reason) ->
+            reply(Caller, {error, Reason}),
+            {stop, Reason, State}
+    end.
+
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Delivers decoded packets.
+%% The first packet goes to a waiting caller; in active mode packets are
+%% sent to the controlling process. Undelivered packets are queued until
+%% the next recv or active change.
+%% @end
+%%--------------------------------------------------------------------
+-spec deliver_packets(Packets :: [term()], State :: #state{}) ->
+    {next_state, idle | receiving_packets, NextState :: #state{}} |
+    {stop, Reason :: atom(), State :: #state{}}.
+deliver_packets([Data | Rest], #state{caller = {_, _}} = State) ->
+    gen_fsm:send_all_state_event(self(), {reply, {ok, Data}}),
+    {next_state, idle, State#state{packets = Rest}};
+
+deliver_packets(Packets, #state{active = false} = State) ->
+    {next_state, idle, State#state{packets = Packets}};
+
+deliver_packets([Data | Rest], #state{active = once} = State) ->
+    notify_packet(Data, State),
+    {next_state, idle, State#state{packets = Rest, active = false}};
+
+deliver_packets(Packets, #state{active = true} = State) ->
+    lists:foreach(fun(Data) -> notify_packet(Data, State) end, Packets),
+    recv_packets(State).
+
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Sends an active notification with a single packet.
+%% @end
+%%--------------------------------------------------------------------
+-spec notify_packet(Data :: term(), State :: #state{}) -> ok.
+notify_packet(Data, #state{packet = line, sock_ref = Ref}) ->
+    gen_fsm:send_all_state_event(self(), {notify, {etls, Ref, Data}});
+notify_packet({Opcode, Payload}, #state{packet = websocket, sock_ref = Ref}) ->
+    gen_fsm:send_all_state_event(self(),
+        {notify, {etls_ws, Ref, Opcode, Payload}});
+notify_packet(Data, #state{sock_ref = Ref}) ->
+    gen_fsm:send_all_state_event(self(), {notify, {etls_http, Ref, Data}}).
+
 %%--------------------------------------------------------------------
 %% @private
 %% @doc
@@ -548,15 +792,18 @@ create_timer(Timeout) ->
 %% @private
 %% @doc
 %% Retrieves packet value from the options proplist.
-%% A 'raw' value is converted to 0.
+%% A 'raw' value is converted to 0, and binary HTTP variants to their
+%% plain counterparts (HTTP packets are always binaries).
 %% @end
 %%--------------------------------------------------------------------
 -spec get_packet(Opts :: [etls:option() | etls:ssl_option()],
     State :: #state{}) ->
-    0 | 1 | 2 | 4.
+    0 | 1 | 2 | 4 | line | http | httph | websocket.
 get_packet(Opts, #state{packet = OldPacket}) ->
     case proplists:get_value(packet, Opts, OldPacket) of
         raw -> 0;
+        http_bin -> http;
+        httph_bin -> httph;
         Other -> Other
     end.
 
@@ -33,7 +33,7 @@
 -record(state, {
     socket :: etls_nif:socket(),
     caller :: undefined | {pid(), term()},
-    packet = 0 :: 0 | 1 | 2 | 4
+    packet = 0 :: 0 | 1 | 2 | 4 | line | http | httph | websocket
 }).
 
 %%%===================================================================
@@ -108,13 +108,29 @@ idle({send, Data}, From, State) ->
 
     SendData =
         case Packet of
-            0 -> Data;
+            _ when Packet =:= 0; is_atom(Packet) -> Data;
             _ ->
                 DS = byte_size(Data),
                 <<DS:Packet/big-unsigned-integer-unit:8, Data/binary>>
         end,
 
     case etls_nif:send(Sock, SendData) of
+        sent -> {reply, ok, idle, State};
+        ok -> {next_state, sending, State#state{caller = From}};
+        {error, Reason} when is_atom(Reason) ->
+            {stop, Reason, {error, Reason}, State}
+    end;
+
+idle({sendfile, File, Offset, Length}, From, #state{socket = Sock} = State) ->
+    case etls_nif:sendfile(Sock, File, Offset, Length) of
+        ok -> {next_state, sending, State#state{caller = From}};
+        {error, Reason} when is_atom(Reason) ->
+            {stop, Reason, {error, Reason}, State}
+    end;
+
+idle({ws_send, Opcode, Data, Mask}, From, #state{socket = Sock} = State) ->
+    case etls_nif:ws_send(Sock, ws_opcode(Opcode), Data, Mask) of
+        sent -> {reply, ok, idle, State};
         ok -> {next_state, sending, State#state{caller = From}};
         {error, Reason} when is_atom(Reason) ->
             {stop, Reason, {error, Reason}, State}
@@ -222,6 +238,10 @@ handle_info(ok, _StateName, State) ->
     gen_fsm:send_all_state_event(self(), {reply, ok}),
     {next_state, idle, State};
 
+handle_info({ok, Sent}, _StateName, State) when is_integer(Sent) ->
+    gen_fsm:send_all_state_event(self(), {reply, {ok, Sent}}),
+    {next_state, idle, State};
+
 handle_info({error, Reason}, _StateName, #state{caller = Caller} = State) ->
     reply(Caller, {error, Reason}),
     {stop, Reason, State}.
@@ -257,18 +277,34 @@ code_change(_OldVsn, StateName, State, _Extra) ->
 %% @private
 %% @doc
 %% Retrieves packet value from the options proplist.
-%% A 'raw' value is converted to 0.
+%% A 'raw' value is converted to 0, and binary HTTP variants to their
+%% plain counterparts (HTTP packets are always binaries).
 %% @end
 %%--------------------------------------------------------------------
 -spec get_packet(Opts :: [etls:option() | etls:ssl_option()],
     State :: #state{}) ->
-    0 | 1 | 2 | 4.
+    0 | 1 | 2 | 4 | line | http | httph | websocket.
 get_packet(Opts, #state{packet = OldPacket}) ->
     case proplists:get_value(packet, Opts, OldPacket) of
         raw -> 0;
+        http_bin -> http;
+        httph_bin -> httph;
         Other -> Other
     end.
 
+%%--------------------------------------------------------------------
+%% @private
+%% @doc
+%% Converts a WebSocket opcode to its numeric value.
+%% @end
+%%--------------------------------------------------------------------
+-spec ws_opcode(Opcode :: etls:ws_opcode()) -> 0..15.
+ws_opcode(text) -> 1;
+ws_opcode(binary) -> 2;
+ws_opcode(close) -> 8;
+ws_opcode(ping) -> 9;
+ws_opcode(pong) -> 10.
+
 %%--------------------------------------------------------------------
 %% @private
 %% @doc
@@ -7,7 +7,7 @@
 %%%--------------------------------------------------------------------
 %%% @private
 %%% @doc
-%%% The main etls supervisor.
+%%% The etls supervisor of connections.
 %%% @end
 %%%--------------------------------------------------------------------
 -module(etls_sup).
@@ -34,10 +34,18 @@ communication_test_() ->
         fun send_should_send_a_message/1,
         fun receive_should_receive_a_message/1,
         fun receive_should_receive_a_message_when_size_is_zero/1,
+        fun recv_stream_should_deliver_chunks/1,
+        fun getstat_should_report_recv_buffer_size/1,
         fun setopts_should_honor_active_once/1,
         fun setopts_should_honor_active_true/1,
         fun socket_should_notify_about_closure_when_active/1,
         fun setopts_should_respect_packet_options/1,
+        fun recv_should_return_lines_in_line_mode/1,
+        fun socket_should_notify_about_lines_when_active/1,
+        fun recv_should_return_http_packets_in_http_mode/1,
+        fun recv_should_split_request_uris_in_http_mode/1,
+        fun socket_should_notify_about_websocket_messages/1,
+        fun ws_send_should_send_a_websocket_frame/1,
         fun recv_should_allow_for_new_caller_after_timeout/1,
         fun recv_should_allow_for_recv_while_active/1,
         fun socket_should_allow_to_set_controlling_process/1,
@@ -116,6 +124,26 @@ receive_should_receive_a_message_when_size_is_zero({Ref, Server, Sock}) ->
             end}
     end.
 
+getstat_should_report_recv_buffer_size({_Ref, _Server, Sock}) ->
+    ok = etls:setopts(Sock, [{recv_buffer_min, 1024}, {recv_buffer_max, 4096}]),
+    ?_assertEqual({ok, [{recv_buffer, 4096}]}, etls:getstat(Sock)).
+
+recv_stream_should_deliver_chunks({Ref, Server, Sock}) ->
+    Data = crypto:rand_bytes(10000),
+    Server ! {send, Data},
+    receive
+        {Ref, send, ok} -> ok
+    end,
+
+    ok = etls:recv_stream(Sock, byte_size(Data), 4096),
+    Chunks = receive_chunks(Sock, []),
+
+    {?LINE, fun() ->
+        ?assertEqual([{4096, 5904}, {4096, 1808}, {1808, 0}],
+            [{byte_size(Chunk), Remaining} || {Chunk, Remaining} <- Chunks]),
+        ?assertEqual(Data, << <<Chunk/binary>> || {Chunk, _} <- Chunks >>)
+    end}.
+
 accept_should_accept_connections({Ref, Port}) ->
     Self = self(),
 
@@ -319,6 +347,108 @@ setopts_should_respect_packet_options({Ref, Server, Sock}) ->
             end}
     end.
 
+recv_should_return_lines_in_line_mode({Ref, Server, Sock}) ->
+    ok = etls:setopts(Sock, [{packet, line}]),
+    Server ! {send, <<"first line\nsecond ">>},
+    Server ! {send, <<"line\n">>},
+
+    receive
+        {Ref, send, _} ->
+            Result1 = etls:recv(Sock, 0, ?TIMEOUT),
+            Result2 = etls:recv(Sock, 0, ?TIMEOUT),
+            {?LINE, fun() ->
+                ?assertEqual({ok, <<"first line\n">>}, Result1),
+                ?assertEqual({ok, <<"second line\n">>}, Result2)
+            end}
+    end.
+
+socket_should_notify_about_lines_when_active({_Ref, Server, Sock}) ->
+    ok = etls:setopts(Sock, [{packet, line}, {active, true}]),
+    Server ! {send, <<"a\nb\nc\n">>},
+
+    Receive = fun() ->
+        receive
+            {etls, Sock, Line} -> Line
+        after ?TIMEOUT ->
+            {error, test_timeout}
+        end
+    end,
+
+    Lines = [Receive(), Receive(), Receive()],
+    ?_assertEqual([<<"a\n">>, <<"b\n">>, <<"c\n">>], Lines).
+
+recv_should_return_http_packets_in_http_mode({Ref, Server, Sock}) ->
+    ok = etls:setopts(Sock, [{packet, http_bin}]),
+    Server ! {send, <<"HTTP/1.1 200 OK\r\ncontent-length: 0\r\n"
+                      "x-request-id: 7\r\n\r\n">>},
+
+    receive
+        {Ref, send, _} ->
+            Result1 = etls:recv(Sock, 0, ?TIMEOUT),
+            Result2 = etls:recv(Sock, 0, ?TIMEOUT),
+            Result3 = etls:recv(Sock, 0, ?TIMEOUT),
+            Result4 = etls:recv(Sock, 0, ?TIMEOUT),
+            {?LINE, fun() ->
+                ?assertEqual({ok, {http_response, {1, 1}, 200, <<"OK">>}},
+                    Result1),
+                ?assertEqual({ok, {http_header, 38, 'Content-Length',
+                    undefined, <<"0">>}}, Result2),
+                ?assertEqual({ok, {http_header, 0, <<"X-Request-Id">>,
+                    undefined, <<"7">>}}, Result3),
+                ?assertEqual({ok, http_eoh}, Result4)
+            end}
+    end.
+
+recv_should_split_request_uris_in_http_mode({Ref, Server, Sock}) ->
+    ok = etls:setopts(Sock, [{packet, http_bin}]),
+    Server ! {send, <<"GET http://example.com:8080/index.html HTTP/1.1\r\n\r\n"
+                      "GET https://example.com HTTP/1.1\r\n\r\n"
+                      "GET ftp://example.com/file HTTP/1.1\r\n\r\n">>},
+
+    receive
+        {Ref, send, _} ->
+            Requests = [begin
+                {ok, Request} = etls:recv(Sock, 0, ?TIMEOUT),
+                {ok, http_eoh} = etls:recv(Sock, 0, ?TIMEOUT),
+                Request
+            end || _ <- lists:seq(1, 3)],
+            {?LINE, fun() ->
+                ?assertEqual([
+                    {http_request, 'GET', {absoluteURI, http,
+                        <<"example.com">>, 8080, <<"/index.html">>}, {1, 1}},
+                    {http_request, 'GET', {absoluteURI, https,
+                        <<"example.com">>, undefined, <<"/">>}, {1, 1}},
+                    {http_request, 'GET', {scheme, <<"ftp">>,
+                        <<"//example.com/file">>}, {1, 1}}], Requests)
+            end}
+    end.
+
+socket_should_notify_about_websocket_messages({_Ref, Server, Sock}) ->
+    ok = etls:setopts(Sock, [{packet, websocket}, {active, once}]),
+    Key = <<1, 2, 3, 4>>,
+    Masked = crypto:exor(<<"hell">>, Key),
+    Server ! {send, <<16#01, 16#84, Key/binary, Masked/binary>>},
+    Server ! {send, <<16#80, 16#01, "o">>},
+
+    Result =
+        receive
+            {etls_ws, Sock, Opcode, Payload} -> {Opcode, Payload}
+        after ?TIMEOUT ->
+            {error, test_timeout}
+        end,
+
+    ?_assertEqual({text, <<"hello">>}, Result).
+
+ws_send_should_send_a_websocket_frame({Ref, Server, Sock}) ->
+    DS = 1000,
+    Data = crypto:rand_bytes(DS),
+    ok = etls:ws_send(Sock, binary, Data),
+    Server ! {'receive', DS + 4},
+    receive
+        {Ref, 'receive', Result} ->
+            ?_assertEqual({ok, <<16#82, 126, DS:16, Data/binary>>}, Result)
+    end.
+
 recv_should_allow_for_new_caller_after_timeout({_Ref, Server, Sock}) ->
     Data = random_data(),
     {error, timeout} = etls:recv(Sock, byte_size(Data), 0),
@@ -610,6 +740,17 @@ server_loop(Pid, Ref, Sock) ->
             ssl:close(Sock)
     end.
 
+receive_chunks(Sock, Acc) ->
+    receive
+        {etls_chunk, Sock, Chunk, 0} ->
+            lists:reverse([{Chunk, 0} | Acc]);
+
+        {etls_chunk, Sock, Chunk, Remaining} ->
+            receive_chunks(Sock, [{Chunk, Remaining} | Acc])
+    after ?TIMEOUT ->
+        lists:reverse(Acc)
+    end.
+
 clear_queue() ->
     receive
         _ -> clear_queue()